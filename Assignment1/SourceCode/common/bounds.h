@@ -0,0 +1,80 @@
+/* bounds.h
+   Axis aligned box and bounding sphere of a mesh, worked out once when the mesh is
+   created and kept with the object so it can be culled before it is drawn.
+   The sphere is centred on the box, with the radius of the furthest vertex from there.
+   Everything is inline so the shape classes don't need another file in the project.
+*/
+
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstddef>
+
+struct bounding_volume
+{
+	glm::vec3 min;
+	glm::vec3 max;
+	glm::vec3 centre;
+	float radius;
+};
+
+// Bounds of a box, for objects that only know their extents
+inline bounding_volume boundsFromBox(const glm::vec3& box_min, const glm::vec3& box_max)
+{
+	bounding_volume b;
+	b.min = box_min;
+	b.max = box_max;
+	b.centre = (box_min + box_max) * 0.5f;
+	b.radius = glm::length(box_max - b.centre);
+	return b;
+}
+
+// Bounds of count xyz positions, stride floats apart (3 for tightly packed vec3s)
+inline bounding_volume computeBounds(const float* positions, size_t count, size_t stride = 3)
+{
+	if (count == 0) return boundsFromBox(glm::vec3(0.f), glm::vec3(0.f));
+
+	glm::vec3 box_min(positions[0], positions[1], positions[2]);
+	glm::vec3 box_max = box_min;
+	for (size_t i = 1; i < count; i++)
+	{
+		const float* p = positions + i * stride;
+		glm::vec3 v(p[0], p[1], p[2]);
+		box_min = glm::min(box_min, v);
+		box_max = glm::max(box_max, v);
+	}
+
+	bounding_volume b = boundsFromBox(box_min, box_max);
+	float radius2 = 0.f;
+	for (size_t i = 0; i < count; i++)
+	{
+		const float* p = positions + i * stride;
+		glm::vec3 d = glm::vec3(p[0], p[1], p[2]) - b.centre;
+		radius2 = glm::max(radius2, glm::dot(d, d));
+	}
+	b.radius = glm::sqrt(radius2);
+	return b;
+}
+
+// The bounds of an object drawn with the given model matrix. The box is the world axis
+// aligned box around the transformed box, the sphere is scaled by the largest axis scale
+inline bounding_volume transformBounds(const bounding_volume& b, const glm::mat4& model)
+{
+	glm::vec3 centre = glm::vec3(model * glm::vec4((b.min + b.max) * 0.5f, 1.f));
+	glm::vec3 half = (b.max - b.min) * 0.5f;
+
+	// Each world axis extent is the sum of the box's half sizes along it
+	glm::vec3 extent(0.f);
+	for (int c = 0; c < 3; c++)
+	{
+		extent += glm::abs(glm::vec3(model[c])) * half[c];
+	}
+
+	bounding_volume world;
+	world.min = centre - extent;
+	world.max = centre + extent;
+	world.centre = glm::vec3(model * glm::vec4(b.centre, 1.f));
+	float scale = glm::max(glm::length(glm::vec3(model[0])), glm::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+	world.radius = b.radius * scale;
+	return world;
+}
@@ -143,6 +143,8 @@ void Cube::makeCube()
 		0, 1.f, 0, 0, 1.f, 0, 0, 1.f, 0,
 	};
 
+	bounds = computeBounds(vertexPositions, sizeof(vertexPositions) / (3 * sizeof(GLfloat)));
+
 	/* Create the vertex buffer for the cube */
 	glGenBuffers(1, &positionBufferObject);
 	glBindBuffer(GL_ARRAY_BUFFER, positionBufferObject);
@@ -6,6 +6,7 @@ Iain Martin November 2018
 #pragma once
 
 #include "wrapper_glfw.h"
+#include "bounds.h"
 #include <vector>
 #include <glm/glm.hpp>
 
@@ -31,4 +32,6 @@ public:
 
 	int numvertices;
 
+	bounding_volume bounds;		// Set by makeCube
+
 };
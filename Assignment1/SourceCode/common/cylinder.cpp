@@ -138,6 +138,8 @@ void Cylinder::makeCylinder()
 			bottom++;
 		}
 
+		bounds = computeBounds(&vertices[0].x, numberOfvertices);
+
 		/* Create the vertex buffer for the cylinder */
 		glGenBuffers(1, &this->cylinderBufferObject);
 		glBindBuffer(GL_ARRAY_BUFFER, this->cylinderBufferObject);
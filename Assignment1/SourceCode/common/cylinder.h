@@ -10,6 +10,7 @@
 #define CYLINDER_H
 
 #include "wrapper_glfw.h"
+#include "bounds.h"
 #include <glm/glm.hpp>
 
 class Cylinder
@@ -35,6 +36,8 @@ public:
 	~Cylinder();
 	void makeCylinder();
 	void drawCylinder(int drawmode);
+
+	bounding_volume bounds;		// Set by makeCylinder
 };
 
 #endif
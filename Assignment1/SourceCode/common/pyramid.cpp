@@ -68,6 +68,8 @@ void Pyramid::makePyramid()
 
 	};
 
+	bounds = computeBounds(&pyra_vertices[0].x, numvertices);
+
 	// Specify the vertex buffer
 	glGenBuffers(1, &pyra_buffer_vertices);
 	glBindBuffer(GL_ARRAY_BUFFER, pyra_buffer_vertices);
@@ -11,6 +11,7 @@
 #pragma once
 
 #include "wrapper_glfw.h"
+#include "bounds.h"
 #include <vector>
 #include <glm/glm.hpp>
 
@@ -39,4 +40,6 @@ public:
 
 	int numvertices;
 	int drawmode;
+
+	bounding_volume bounds;		// Set by makePyramid
 };
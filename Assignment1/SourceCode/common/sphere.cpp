@@ -43,6 +43,7 @@ void Sphere::makeSphere(GLuint numlats, GLuint numlongs)
 	GLfloat* pVertices = new GLfloat[numvertices * 3];
 	GLfloat* pColours = new GLfloat[numvertices * 4];
 	makeUnitSphere(pVertices);
+	bounds = computeBounds(pVertices, numvertices);
 
 	/* Define colours as the x,y,z components of the sphere vertices */
 	for (i = 0; i < numvertices; i++)
@@ -7,6 +7,7 @@
 #pragma once
 
 #include "wrapper_glfw.h"
+#include "bounds.h"
 #include <vector>
 #include <glm/glm.hpp>
 
@@ -33,6 +34,8 @@ public:
 	int numlats;
 	int numlongs;
 
+	bounding_volume bounds;		// Set by makeSphere
+
 private:
 	void makeUnitSphere(GLfloat *pVertices);
 };
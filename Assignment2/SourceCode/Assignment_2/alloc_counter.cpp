@@ -0,0 +1,197 @@
+/* alloc_counter.cpp
+   Replacement global operator new/delete that count allocations. Each block has a
+   header in front of it holding its size, so that delete can take it off the total.
+   Only built with GM_ALLOC_COUNTER defined; otherwise the counts are stubs returning 0.
+*/
+
+#include "alloc_counter.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#include <cstdio>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#endif
+#include <chrono>
+
+#ifdef GM_ALLOC_COUNTER
+
+static std::atomic<size_t> allocations(0);
+static std::atomic<size_t> allocated_bytes(0);
+static std::atomic<size_t> peak_bytes(0);
+
+// The header is 16 bytes so the blocks keep malloc's alignment
+static const size_t header_size = 16;
+
+size_t allocationCount()
+{
+	return allocations.load(std::memory_order_relaxed);
+}
+
+size_t allocatedBytes()
+{
+	return allocated_bytes.load(std::memory_order_relaxed);
+}
+
+size_t peakAllocatedBytes()
+{
+	return peak_bytes.load(std::memory_order_relaxed);
+}
+
+void resetPeakAllocatedBytes()
+{
+	peak_bytes.store(allocatedBytes(), std::memory_order_relaxed);
+}
+
+bool allocationCounting() { return true; }
+
+#else
+
+size_t allocationCount() { return 0; }
+size_t allocatedBytes() { return 0; }
+size_t peakAllocatedBytes() { return 0; }
+void resetPeakAllocatedBytes() {}
+bool allocationCounting() { return false; }
+
+#endif
+
+size_t peakResidentBytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+	return counters.PeakWorkingSetSize;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+	return size_t(usage.ru_maxrss) * 1024;	// in KB on Linux
+#endif
+}
+
+size_t currentResidentBytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+	return counters.WorkingSetSize;
+#else
+	FILE* statm = fopen("/proc/self/statm", "r");
+	if (!statm) return 0;
+	unsigned long size = 0, resident = 0;
+	int read = fscanf(statm, "%lu %lu", &size, &resident);
+	fclose(statm);
+	return (read == 2) ? size_t(resident) * size_t(sysconf(_SC_PAGESIZE)) : 0;
+#endif
+}
+
+void trimResidentMemory()
+{
+#ifdef _WIN32
+	SetProcessWorkingSetSize(GetCurrentProcess(), SIZE_T(-1), SIZE_T(-1));
+#elif defined(__GLIBC__)
+	malloc_trim(0);
+#endif
+}
+
+
+resident_peak_sampler::resident_peak_sampler(unsigned period_ms) : start_bytes(currentResidentBytes()),
+	peak_bytes(start_bytes), stopping(false)
+{
+	sampler = std::thread([this, period_ms]()
+	{
+		while (!stopping.load(std::memory_order_relaxed))
+		{
+			size_t now = currentResidentBytes();
+			if (now > peak_bytes.load(std::memory_order_relaxed)) peak_bytes.store(now, std::memory_order_relaxed);
+			std::this_thread::sleep_for(std::chrono::milliseconds(period_ms));
+		}
+	});
+}
+
+resident_peak_sampler::~resident_peak_sampler()
+{
+	stop();
+}
+
+size_t resident_peak_sampler::stop()
+{
+	if (sampler.joinable())
+	{
+		stopping.store(true, std::memory_order_relaxed);
+		sampler.join();
+
+		// The end of the load counts too
+		size_t now = currentResidentBytes();
+		if (now > peak_bytes.load(std::memory_order_relaxed)) peak_bytes.store(now, std::memory_order_relaxed);
+	}
+	size_t peak = peak_bytes.load(std::memory_order_relaxed);
+	return (peak > start_bytes) ? peak - start_bytes : 0;
+}
+
+
+#ifdef GM_ALLOC_COUNTER
+
+static void* countedAlloc(size_t size)
+{
+	char* block = static_cast<char*>(malloc(size + header_size));
+	if (!block) return 0;
+
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	size_t now = allocated_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+	size_t peak = peak_bytes.load(std::memory_order_relaxed);
+	while (now > peak && !peak_bytes.compare_exchange_weak(peak, now, std::memory_order_relaxed)) {}
+
+	*reinterpret_cast<size_t*>(block) = size;
+	return block + header_size;
+}
+
+static void countedFree(void* p)
+{
+	if (!p) return;
+	char* block = static_cast<char*>(p) - header_size;
+	allocated_bytes.fetch_sub(*reinterpret_cast<size_t*>(block), std::memory_order_relaxed);
+	free(block);
+}
+
+
+void* operator new(size_t size)
+{
+	void* p = countedAlloc(size);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	return countedAlloc(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept
+{
+	return operator new(size, tag);
+}
+
+void operator delete(void* p) noexcept { countedFree(p); }
+void operator delete[](void* p) noexcept { countedFree(p); }
+void operator delete(void* p, size_t) noexcept { countedFree(p); }
+void operator delete[](void* p, size_t) noexcept { countedFree(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { countedFree(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { countedFree(p); }
+
+#endif
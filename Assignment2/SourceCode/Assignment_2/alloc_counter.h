@@ -0,0 +1,61 @@
+/* alloc_counter.h
+   Counts the heap allocations made through operator new, so the loader benchmarks
+   can report how many allocations a load makes and how much memory it needs at its
+   peak. The global operator new and delete are replaced in alloc_counter.cpp only when
+   GM_ALLOC_COUNTER is defined, as it puts a header and three atomics on every
+   allocation; otherwise the counts are all 0.
+
+   The resident memory of the process is measured in every build. resident_peak_sampler
+   finds the most there was during one load, so loads can be told apart without the
+   counter.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <atomic>
+#include <thread>
+
+// True if this build counts allocations (GM_ALLOC_COUNTER is defined)
+bool allocationCounting();
+
+// Number of allocations made so far by any thread
+size_t allocationCount();
+
+// Bytes currently allocated through operator new, and the most there have been
+// since the last resetPeakAllocatedBytes()
+size_t allocatedBytes();
+size_t peakAllocatedBytes();
+void resetPeakAllocatedBytes();
+
+// The most memory the process has had resident at once (the peak working set on
+// Windows), 0 if it can't be found. This can't be reset, so it covers the whole run
+size_t peakResidentBytes();
+
+// The memory the process has resident now (the working set on Windows), 0 if it can't be found
+size_t currentResidentBytes();
+
+// Give back as much resident memory as can be, so that the next measurement counts the
+// pages a load touches rather than what earlier loads left behind
+void trimResidentMemory();
+
+/* Samples currentResidentBytes() on a thread of its own from construction until stop(),
+   which returns the most that was resident above the level at the start. A spike shorter
+   than the sampling period can be missed */
+class resident_peak_sampler
+{
+public:
+	explicit resident_peak_sampler(unsigned period_ms = 1);
+	~resident_peak_sampler();
+
+	size_t stop();
+
+private:
+	resident_peak_sampler(const resident_peak_sampler&);
+	resident_peak_sampler& operator=(const resident_peak_sampler&);
+
+	size_t start_bytes;
+	std::atomic<size_t> peak_bytes;
+	std::atomic<bool> stopping;
+	std::thread sampler;
+};
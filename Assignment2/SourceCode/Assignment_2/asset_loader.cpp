@@ -0,0 +1,144 @@
+/* asset_loader.cpp
+   Each load is one worker job that does all the file work for an asset, then queues a
+   closure that does its GL calls. The closures run in the order the jobs finish, so the
+   render thread can upload one asset while others are still being parsed.
+*/
+
+#include "asset_loader.h"
+#include <iostream>
+#include <stdio.h>
+#include <memory>
+#include <atomic>
+
+using namespace std;
+
+
+asset_loader::asset_loader(thread_pool& pool) : pool(pool)
+{
+	outstanding = 0;
+	serial = false;
+}
+
+
+/* The jobs refer to this loader, so wait for them all before it goes away */
+asset_loader::~asset_loader()
+{
+	finish();
+}
+
+
+shared_future<bool> asset_loader::loadModel(TinyObjLoader& model, const string& inputfile)
+{
+	shared_ptr<promise<bool>> done = make_shared<promise<bool>>();
+	shared_future<bool> result = done->get_future().share();
+	TinyObjLoader* target = &model;
+
+	outstanding++;
+	pool.submit([this, target, inputfile, done]()
+	{
+		shared_ptr<parsed_obj> parsed = make_shared<parsed_obj>();
+		bool loaded = target->parse_obj(inputfile, *parsed);
+
+		queueUpload([target, parsed, loaded, done]()
+		{
+			if (loaded) target->upload_obj(*parsed);
+			done->set_value(loaded);
+		});
+	});
+
+	if (serial) finish();
+	return result;
+}
+
+
+shared_future<bool> asset_loader::loadModel(multipart_model& model)
+{
+	shared_ptr<promise<bool>> done = make_shared<promise<bool>>();
+	shared_future<bool> result = done->get_future().share();
+	multipart_model* target = &model;
+
+	// Shared by the part jobs, the last one to finish queues the upload
+	struct part_jobs
+	{
+		part_jobs(size_t count) : parsed(count), remaining(count), failed(false) {}
+
+		vector<parsed_obj> parsed;	// Sized up front, parsed_obj holds file mappings so can't be moved
+		atomic<size_t> remaining;
+		atomic<bool> failed;
+	};
+	shared_ptr<part_jobs> jobs = make_shared<part_jobs>(model.parts.size());
+
+	outstanding++;
+	if (model.parts.empty())
+	{
+		queueUpload([done]() { done->set_value(false); });
+	}
+
+	for (size_t i = 0; i < model.parts.size(); i++)
+	{
+		string inputfile = model.parts[i].inputfile;
+		vector<float> lod_ratios = model.lod_ratios;
+		bool stream_parse = model.stream_parse;
+		bool compress = model.textures->compression();
+		pool.submit([this, target, jobs, i, inputfile, lod_ratios, stream_parse, compress, done]()
+		{
+			TinyObjLoader parser;
+			parser.lod_ratios = lod_ratios;
+			parser.stream_parse = stream_parse;
+			if (!parser.parse_obj(inputfile, jobs->parsed[i])) jobs->failed = true;
+			if (--jobs->remaining > 0) return;
+
+			// The last part to finish also builds the texture atlas, off the GL thread
+			if (!jobs->failed) target->prepareAtlas(jobs->parsed, compress);
+
+			queueUpload([target, jobs, done]()
+			{
+				if (!jobs->failed) target->upload(jobs->parsed);
+				done->set_value(!jobs->failed);
+			});
+		});
+	}
+
+	if (serial) finish();
+	return result;
+}
+
+
+void asset_loader::queueUpload(function<void()> upload)
+{
+	{
+		lock_guard<mutex> lock(uploads_mutex);
+		uploads.push_back(move(upload));
+	}
+	uploads_ready.notify_one();
+}
+
+
+size_t asset_loader::update()
+{
+	deque<function<void()>> ready;
+	{
+		lock_guard<mutex> lock(uploads_mutex);
+		ready.swap(uploads);
+	}
+
+	for (size_t i = 0; i < ready.size(); i++)
+	{
+		ready[i]();
+		outstanding--;
+	}
+	return ready.size();
+}
+
+
+void asset_loader::finish()
+{
+	while (outstanding > 0)
+	{
+		{
+			unique_lock<mutex> lock(uploads_mutex);
+			uploads_ready.wait(lock, [this]() { return !uploads.empty(); });
+		}
+		update();
+	}
+}
@@ -0,0 +1,60 @@
+/* asset_loader.h
+   Loads models concurrently. Obj parsing runs as jobs on the worker pool, and each
+   finished job queues its GL upload (buffer creation) for the render thread, which
+   runs them from update() or finish(). Textures are streamed in by texture_cache.
+
+   Every load returns a future that becomes ready once the model has been uploaded,
+   holding false if the file could not be loaded. The model passed in must stay alive
+   until then.
+*/
+
+#pragma once
+
+#include "wrapper_glfw.h"
+#include "tiny_loader_texture.h"
+#include "multipart_model.h"
+#include "thread_pool.h"
+#include <string>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+
+class asset_loader
+{
+public:
+	asset_loader(thread_pool& pool = worker_pool());
+	~asset_loader();
+
+	// Parse an obj file on a worker, the model's buffers are created on the render thread
+	std::shared_future<bool> loadModel(TinyObjLoader& model, const std::string& inputfile);
+
+	// Parse each part of the model as a separate job, the model is uploaded once they are all done
+	std::shared_future<bool> loadModel(multipart_model& model);
+
+	// Run the uploads of any assets that have finished loading, returns how many ran.
+	// Must be called on the render thread
+	size_t update();
+
+	// Block until every requested asset has been uploaded. Must be called on the render thread
+	void finish();
+
+	// Number of requested assets that have not been uploaded yet
+	size_t pending() const { return outstanding; }
+
+	bool serial;	// Wait for each asset as it is requested, to compare against loading them concurrently
+
+private:
+	asset_loader(const asset_loader&);
+	asset_loader& operator=(const asset_loader&);
+
+	// Called by the worker jobs to hand an upload to the render thread
+	void queueUpload(std::function<void()> upload);
+
+	thread_pool& pool;
+	std::deque<std::function<void()>> uploads;
+	std::mutex uploads_mutex;
+	std::condition_variable uploads_ready;
+	size_t outstanding;		// Requested but not uploaded, only changed on the render thread
+};
@@ -34,6 +34,14 @@ if you prefer */
 #include "sphere.h"
 #include "terrain_object.h"
 #include "tiny_loader_texture.h"
+#include "multipart_model.h"
+#include "asset_loader.h"
+#include "texture_cache.h"
+#include "texture_bake.h"
+#include "mip_generate.h"
+#include "program_cache.h"
+#include "alloc_counter.h"
+#include "frustum.h"
 
 /* Include the image loader */
 #define STB_IMAGE_IMPLEMENTATION
@@ -47,6 +55,7 @@ GLuint quad_vbo, quad_normals, quad_colours, quad_tex_coords;
 
 GLuint program;
 GLuint program2;
+GLuint program3;		// object_quantized.vert, for the rocket when its vertices are quantized
 GLuint vao;
 
 GLuint colourmode;
@@ -68,6 +77,38 @@ GLuint numlats, numlongs;
 GLfloat shipmove;
 GLfloat shipcanmove;
 GLfloat shipspeed;
+GLfloat shipmove_prev;		// ship position at the previous simulation step
+
+//fixed timestep simulation, runs at sim_rate steps per second independent of the frame rate
+GLfloat sim_rate;
+double sim_accumulator;
+double last_frame_time;
+
+//asset loading, -serialload loads each asset before requesting the next to compare against
+bool serial_loading = false;
+bool quantize_rocket = true;		// -floatverts keeps the rocket's vertices as floats
+bool stream_obj = false;			// -streamobj parses obj files in one pass for the least memory
+bool first_frame_drawn;
+double load_start;					// when init started loading, to time the assets against
+
+//textures stream in after init, this many bytes of texels are uploaded each frame
+size_t texture_upload_budget = 1024 * 1024;
+bool textures_resident;			// nothing left to stream, reported each time it becomes true
+bool textures_settled;			// the first time everything loaded became resident
+
+//rocket level of detail, picked from its size on screen unless a level is forced with 'L'
+int rocket_lod = -1;			// -1 selects the level automatically
+int rocket_lod_drawn = -1;		// the level drawn last frame, to report changes
+
+//frame statistics, averaged and printed about once a second
+double frame_stats_start;
+int frame_stats_frames;
+double frame_stats_triangles;	// rocket triangles drawn since frame_stats_start
+
+//view frustum culling of the objects in display(), toggled with 'F'
+cull_frustum view_frustum;
+bool frustum_culling = true;
+int culled_last = -1;			// objects culled last frame, to report changes
 
 GLfloat light_x, light_y, light_z;
 
@@ -77,16 +118,20 @@ GLfloat speed;
 GLfloat maxdist;
 GLfloat point_size;
 
-GLuint textureID1, textureID2, textureID3, textureID4, textureID5, textureID6;
+GLuint textureID5, textureID6;		// flame and smoke, the rocket's textures come from its .mtl files
 
 /* Uniforms*/
 GLuint modelID, viewID, projectionID, lightposID, normalmatrixID;
 GLuint colourmodeID, emitmodeID;
 
 GLuint modelID2, viewID2, projectionID2, lightposID2, normalmatrixID2, point_sizeID2;
+GLuint pos_scaleID2, pos_offsetID2, fade_distanceID2;
+GLuint modelID3, viewID3, projectionID3, lightposID3, colourmodeID3;
+GLuint pos_scaleID3, pos_offsetID3;
 GLuint colourmodeID2, emitmodeID2;
 
 GLfloat aspect_ratio;
+GLfloat window_height;
 GLuint numspherevertices;
 
 /* Define textureID*/
@@ -101,63 +146,12 @@ GLfloat perlin_scale, perlin_frequency;
 GLfloat land_size;
 GLuint land_resolution;
 
-TinyObjLoader nose;
-TinyObjLoader body;
-TinyObjLoader engine;
-TinyObjLoader fins;
+/* The rocket's nose, body, engine and fins share one set of buffers */
+multipart_model rocket;
 
 using namespace std;
 using namespace glm;
 
-/* Function to load textures into the program */
-bool load_texture(char* filename, GLuint& texID, bool bGenMipmaps);
-
-bool load_texture(const char* filename, GLuint& texID, bool bGenMipmaps)
-{
-	glGenTextures(1, &texID);
-	// local image parameters
-	int width, height, nrChannels;
-
-	/* load an image file using stb_image */
-	unsigned char* data = stbi_load(filename, &width, &height, &nrChannels, 0);
-
-	// check for an error during the load process
-	if (data)
-	{
-		// Note: this is not a full check of all pixel format types, just the most common two!
-		int pixel_format = 0;
-		if (nrChannels == 3)
-			pixel_format = GL_RGB;
-		else
-			pixel_format = GL_RGBA;
-
-		// Bind the texture ID before the call to create the texture.
-			// texID[i] will now be the identifier for this specific texture
-		glBindTexture(GL_TEXTURE_2D, texID);
-
-		// Create the texture, passing in the pointer to the loaded image pixel data
-		glTexImage2D(GL_TEXTURE_2D, 0, pixel_format, width, height, 0, pixel_format, GL_UNSIGNED_BYTE, data);
-
-		// Generate Mip Maps
-		if (bGenMipmaps)
-		{
-			glGenerateMipmap(GL_TEXTURE_2D);
-		}
-		else
-		{
-			// If mipmaps are not used then ensure that the min filter is defined
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		}
-	}
-	else
-	{
-		printf("stb_image  loading error: filename=%s", filename);
-		return false;
-	}
-	stbi_image_free(data);
-	return true;
-}
-
 /*
 This function is called before entering the main rendering loop.
 Use it for all your initialisation stuff
@@ -181,25 +175,60 @@ void init(GLWrapper* glw)
 
 	//ship animation variables
 	shipmove = 0;
+	shipmove_prev = 0;
 	shipcanmove = 0;
 	shipspeed = 0;
 
+	//simulation rate
+	sim_rate = 60.f;
+	sim_accumulator = 0;
+
 	aspect_ratio = 1.3333f;
+	window_height = 768.f;
 	colourmode = 0;
 	emitmode = 0;
 	numlats = 40;		// Number of latitudes in our sphere
 	numlongs = 40;		// Number of longitudes in our sphere
 
+	/* Start loading the models and textures. They are parsed and decoded on worker threads
+	   while the rest of init runs, and uploaded as each one finishes */
+	asset_loader assets;
+	assets.serial = serial_loading;
+	load_start = glfwGetTime();
+
+	// This will flip the image so that the texture coordinates defined in
+	// the sphere, match the image orientation as loaded by stb_image
+	stbi_set_flip_vertically_on_load(true);
+
+	// The textures can be bound straight away, they show a placeholder until they have been streamed in
+	textureID5 = shared_textures().load("\images\\flame.png", false);
+	textureID6 = shared_textures().load("\images\\smoke.png", false);
+
+	/* Load and create our objects, each part is textured by the map_Kd of its .mtl file */
+	rocket.addPart("\obj\\nose.obj");
+	rocket.addPart("\obj\\body.obj");
+	rocket.addPart("\obj\\engine.obj");
+	rocket.addPart("\obj\\fins.obj");
+	rocket.quantized = quantize_rocket;
+	rocket.stream_parse = stream_obj;
+	shared_future<bool> rocket_loaded = assets.loadModel(rocket);
+
 	// Generate index (name) for one vertex array object
 	glGenVertexArrays(1, &vao);
 
 	// Create the vertex array object and make it current
 	glBindVertexArray(vao);
 
-	/* Load and build the vertex and fragment shaders */
+	/* Load and build the vertex and fragment shaders, from the binaries the last run saved if they're still valid.
+	   Any that need building are compiled together, so the driver can work on them at once */
+	program_request shaders[] = {
+		{ "terrain.vert", "terrain.frag", "", 0 },
+		{ "object.vert", "object.frag", "", 0 },
+		{ "object_quantized.vert", "object.frag", "", 0 },
+	};
 	try
 	{
-		program = glw->LoadShader("terrain.vert", "terrain.frag");
+		loadPrograms(glw, shaders, sizeof(shaders) / sizeof(shaders[0]));
 	}
 	catch (exception& e)
 	{
@@ -207,66 +236,14 @@ void init(GLWrapper* glw)
 		cin.ignore();
 		exit(0);
 	}
+	program = shaders[0].program;
+	program2 = shaders[1].program;
+	program3 = shaders[2].program;
 
-	try
-	{
-		program2 = glw->LoadShader("object.vert", "object.frag");
-	}
-	catch (exception& e)
-	{
-		cout << "Caught exception: " << e.what() << endl;
-		cin.ignore();
-		exit(0);
-	}
-
-	/* load an image file using stb_image */
-	const char* filename1 = "\images\\nose.png";
-	const char* filename2 = "\images\\body.png";
-	const char* filename3 = "\images\\engine.png";
-	const char* filename4 = "\images\\fins.png";
-	const char* filename5 = "\images\\flame.png";
-	const char* filename6 = "\images\\smoke.png";
-
-	//load image files
-
-	// This will flip the image so that the texture coordinates defined in
-	// the sphere, match the image orientation as loaded by stb_image
-	stbi_set_flip_vertically_on_load(true);
-	if (!load_texture(filename1, textureID1, true))
-	{
-		cout << "Fatal error loading texture: " << filename1 << endl;
-		exit(0);
-	}
-
-	if (!load_texture(filename2, textureID2, false))
-	{
-		cout << "Fatal error loading texture: " << filename2 << endl;
-		exit(0);
-	}
-
-	if (!load_texture(filename3, textureID3, false))
-	{
-		cout << "Fatal error loading texture: " << filename2 << endl;
-		exit(0);
-	}
-
-	if (!load_texture(filename4, textureID4, false))
-	{
-		cout << "Fatal error loading texture: " << filename2 << endl;
-		exit(0);
-	}
-
-	if (!load_texture(filename5, textureID5, false))
-	{
-		cout << "Fatal error loading texture: " << filename2 << endl;
-		exit(0);
-	}
-
-	if (!load_texture(filename6, textureID6, false))
-	{
-		cout << "Fatal error loading texture: " << filename2 << endl;
-		exit(0);
-	}
+	const program_cache_stats& programs = programCacheStats();
+	cout << "Shader programs: " << programs.loaded << " from binaries in " << programs.load_ms << " ms, saving "
+		<< programs.saved_ms << " ms of compiling, " << programs.built << " built from source in " << programs.build_ms << " ms"
+		<< (programs.parallel ? " by parallel compiles" : "") << endl;
 
 	/* Define uniforms to send to vertex shader */
 	modelID = glGetUniformLocation(program, "model");
@@ -286,12 +263,21 @@ void init(GLWrapper* glw)
 	lightposID2 = glGetUniformLocation(program2, "lightpos");
 	normalmatrixID2 = glGetUniformLocation(program2, "normalmatrix");
 	point_sizeID2 = glGetUniformLocation(program2, "size");
-
-	/* Load and create our objects*/
-	nose.load_obj("\obj\\nose.obj");
-	body.load_obj("\obj\\body.obj");
-	engine.load_obj("\obj\\engine.obj");
-	fins.load_obj("\obj\\fins.obj");
+	pos_scaleID2 = glGetUniformLocation(program2, "pos_scale");
+	pos_offsetID2 = glGetUniformLocation(program2, "pos_offset");
+	fade_distanceID2 = glGetUniformLocation(program2, "fade_distance");
+
+	/* Define uniforms to send to the quantized vertex shader */
+	modelID3 = glGetUniformLocation(program3, "model");
+	colourmodeID3 = glGetUniformLocation(program3, "colourmode");
+	viewID3 = glGetUniformLocation(program3, "view");
+	projectionID3 = glGetUniformLocation(program3, "projection");
+	lightposID3 = glGetUniformLocation(program3, "lightpos");
+	pos_scaleID3 = glGetUniformLocation(program3, "pos_scale");
+	pos_offsetID3 = glGetUniformLocation(program3, "pos_offset");
+
+	// Objects without a colour attribute array (location 3) use this constant colour
+	glVertexAttrib4f(3, 1.f, 1.f, 1.f, 1.f);
 
 	/* Create the heightfield object */
 	octaves = 10;
@@ -307,6 +293,17 @@ void init(GLWrapper* glw)
 	/* create our sphere object */
 	aSphere.makeSphere(numlats, numlongs);
 
+	// Wait for the models, running their uploads as they arrive
+	assets.finish();
+	// The loader has already reported why
+	if (!rocket_loaded.get()) exit(1);
+	cout << "Models loaded " << int((glfwGetTime() - load_start) * 1000) << " ms after starting init, peak resident memory "
+		<< peakResidentBytes() / (1024 * 1024) << " MB, " << shared_textures().pending() << " textures streaming" << endl;
+	textures_resident = false;
+
+	// The texture parameters below were always applied to the last texture loaded
+	glBindTexture(GL_TEXTURE_2D, textureID6);
+
 	// Create our quad and texture 
 	glGenBuffers(1, &quad_vbo);
 	glBindBuffer(GL_ARRAY_BUFFER, quad_vbo);
@@ -328,17 +325,93 @@ void init(GLWrapper* glw)
 	speed = 0.005f;
 	maxdist = 0.6f;
 	point_anim = new points2(10000, maxdist, speed);
+	point_anim->packed_vertices = true;
 	point_anim->create();
+	point_anim->collision_terrain = heightfield;
+	point_anim->collision = points2::COLLIDE_BOUNCE;
 	point_size = 4;
 
 	// Enable gl_PointSize
 	glEnable(GL_PROGRAM_POINT_SIZE);
+
+	last_frame_time = glfwGetTime();
+	first_frame_drawn = false;
+	frame_stats_start = last_frame_time;
+	frame_stats_frames = 0;
+	frame_stats_triangles = 0;
+}
+
+/* Transform from the particle emitter to world space, the emitter follows the ship */
+mat4 particleTransform(GLfloat ship_offset)
+{
+	mat4 transform = translate(mat4(1.0f), vec3(4, 5, -10));
+	transform = rotate(transform, -radians(180.0f), glm::vec3(1, 0, 0));
+	transform = rotate(transform, -radians(90.0f), glm::vec3(0, 1, 0));
+	transform = scale(transform, vec3(150.f, 50.f, 150.f));
+	return translate(transform, vec3(0, -(ship_offset / 500), 0));
+}
+
+/* Advance the ship and particle animation by one fixed simulation step.
+   The ship speeds were tuned at 60 steps per second so are scaled relative to that */
+void simulate(GLfloat timestep)
+{
+	GLfloat step_scale = timestep * 60.f;
+
+	//ship animation
+	shipmove_prev = shipmove;
+	if (shipcanmove == 1 && shipspeed < 10) {
+		shipspeed += 0.1f * step_scale;
+	}
+	shipmove += shipspeed * step_scale;
+
+	point_anim->local_to_world = particleTransform(shipmove);
+	point_anim->animate(timestep);
 }
 
 /* Called to update the display. Note that this function is called in the event loop in the wrapper
    class because we registered display as a callback function */
 void display()
 {
+	/* Run as many fixed simulation steps as have elapsed since the last frame,
+	   capping the frame time so that a long stall doesn't cause a burst of steps */
+	double current_time = glfwGetTime();
+	double frame_time = current_time - last_frame_time;
+	last_frame_time = current_time;
+	if (frame_time > 0.25) frame_time = 0.25;
+
+	GLfloat timestep = 1.f / sim_rate;
+	sim_accumulator += frame_time;
+	while (sim_accumulator >= timestep)
+	{
+		simulate(timestep);
+		sim_accumulator -= timestep;
+	}
+
+	// Fraction of a simulation step to interpolate the drawn positions by
+	GLfloat sim_alpha = GLfloat(sim_accumulator / timestep);
+	GLfloat shipmove_draw = mix(shipmove_prev, shipmove, sim_alpha);
+
+	// Upload the next slice of any textures that are still streaming in, towards the mip
+	// levels the models asked for last frame
+	shared_textures().update(texture_upload_budget);
+	if (!textures_resident && shared_textures().pending() == 0)
+	{
+		const texture_cache_stats& stats = shared_textures().stats();
+		const texture_residency_stats& residency = shared_textures().residency();
+		if (!textures_settled)
+		{
+			cout << "Textures resident " << int((glfwGetTime() - load_start) * 1000) << " ms after starting init, "
+				<< shared_textures().size() << " textures for " << stats.requests << " requests, " << stats.hits << " hits ("
+				<< stats.content_hits << " by content) saved " << stats.bytes_saved / 1024 << " KB" << endl;
+			textures_settled = true;
+		}
+		cout << "Texture memory " << residency.resident_bytes / 1024 << " KB resident, " << residency.requested_bytes / 1024
+			<< " KB requested, budget " << shared_textures().memory_budget / 1024 << " KB, " << residency.evicted_bytes / 1024
+			<< " KB evicted so far" << endl;
+		textures_resident = true;
+	}
+	if (shared_textures().pending() > 0) textures_resident = false;
+
 	/* Define the background colour */
 	glClearColor(0.f, 0.f, 0.f, 1.0f);
 
@@ -363,12 +436,44 @@ void display()
 	mat3 normalmatrix;
 
 	// Projection matrix : 45 Field of View, 4:3 ratio, display range : 0.1 unit <-> 100 units
-	mat4 projection = perspective(radians(30.0f), aspect_ratio, 0.1f, 1000.0f);
+	const float fov = radians(30.0f);
+	mat4 projection = perspective(fov, aspect_ratio, 0.1f, 1000.0f);
 
 	//define camera matrix
 	view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
 	cameraSpeed = 0.5f;
 
+	// World transforms of the objects, worked out before drawing so they can be culled first
+	enum { DRAW_LIGHT, DRAW_TERRAIN, DRAW_ROCKET, DRAW_PARTICLES, DRAW_COUNT };
+	mat4 transforms[DRAW_COUNT];
+	transforms[DRAW_LIGHT] = scale(translate(mat4(1.0f), vec3(light_x, light_y, light_z)), vec3(0.75f, 0.75f, 0.75f));
+	transforms[DRAW_TERRAIN] = mat4(1.0f);
+	transforms[DRAW_ROCKET] = translate(scale(translate(mat4(1.0f), vec3(4, 0, -10)), vec3(0.1f, 0.1f, 0.1f)), vec3(0, shipmove_draw, 0));
+	transforms[DRAW_PARTICLES] = particleTransform(shipmove_draw);
+
+	bounding_volume world_bounds[DRAW_COUNT];
+	world_bounds[DRAW_LIGHT] = transformBounds(aSphere.bounds, transforms[DRAW_LIGHT]);
+	world_bounds[DRAW_TERRAIN] = transformBounds(heightfield->bounds, transforms[DRAW_TERRAIN]);
+	world_bounds[DRAW_ROCKET] = transformBounds(rocket.bounds, transforms[DRAW_ROCKET]);
+	world_bounds[DRAW_PARTICLES] = transformBounds(point_anim->bounds, transforms[DRAW_PARTICLES]);
+
+	unsigned char visible[DRAW_COUNT];
+	int culled = 0;
+	if (frustum_culling)
+	{
+		view_frustum.setMatrix(projection * view);
+		culled = int(view_frustum.cull(world_bounds, DRAW_COUNT, visible));
+	}
+	else
+	{
+		for (int i = 0; i < DRAW_COUNT; i++) visible[i] = 1;
+	}
+	if (culled != culled_last)
+	{
+		cout << "Culled " << culled << " of " << DRAW_COUNT << " objects" << endl;
+		culled_last = culled;
+	}
+
 	// Define the light position and transform by the view matrix
 	vec4 lightpos = view * vec4(light_x, light_y, light_z, 1.0);
 
@@ -380,10 +485,10 @@ void display()
 
 	/* Draw a small sphere in the lightsource position to visually represent the light source */
 	model.push(model.top());
+	if (visible[DRAW_LIGHT])
 	{
 		glUniform1ui(colourmodeID, 0);
-		model.top() = translate(model.top(), vec3(light_x, light_y, light_z));
-		model.top() = scale(model.top(), vec3(0.75f, 0.75f, 0.75f)); // make a small sphere
+		model.top() = model.top() * transforms[DRAW_LIGHT]; // make a small sphere
 		// Recalculate the normal matrix and send the model and normal matrices to the vertex shader
 		glUniformMatrix4fv(modelID, 1, GL_FALSE, &(model.top()[0][0]));
 		normalmatrix = transpose(inverse(mat3(view * model.top())));
@@ -400,7 +505,10 @@ void display()
 
 	//TERRAIN
 	model.push(model.top());
+	if (visible[DRAW_TERRAIN])
 	{
+		model.top() = model.top() * transforms[DRAW_TERRAIN];
+
 		// Send the model uniform to the currently bound shader,
 		glUniformMatrix4fv(modelID, 1, GL_FALSE, &(model.top()[0][0]));
 
@@ -412,96 +520,63 @@ void display()
 	/* Change current shader */
 	glUseProgram(program2);
 
-	//NOSE
-	model.push(model.top());
-	{
-		model.top() = translate(model.top(), vec3(4, 0, -10));
-		model.top() = scale(model.top(), vec3(0.1f, 0.1f, 0.1f));
-
-		model.top() = translate(model.top(), vec3(0, shipmove, 0));
-
-		// Send the model uniform to the currently bound shader,
-		glUniformMatrix4fv(modelID2, 1, GL_FALSE, &(model.top()[0][0]));
-		glUniform1ui(colourmodeID2, colourmode);
-		glUniformMatrix4fv(viewID2, 1, GL_FALSE, &view[0][0]);
-		glUniformMatrix4fv(projectionID2, 1, GL_FALSE, &projection[0][0]);
-		glUniform4fv(lightposID2, 1, value_ptr(lightpos));
-
-		glBindTexture(GL_TEXTURE_2D, textureID1);
-		nose.drawObject(drawmode);
-	}
-	model.pop();
-
-	//BODY
-	model.push(model.top());
-	{
-		model.top() = translate(model.top(), vec3(4, 0, -10));
-		model.top() = scale(model.top(), vec3(0.1f, 0.1f, 0.1f));
-
-		model.top() = translate(model.top(), vec3(0, shipmove, 0));
-
-		// Send the model uniform to the currently bound shader,
-		glUniformMatrix4fv(modelID2, 1, GL_FALSE, &(model.top()[0][0]));
-		glUniform1ui(colourmodeID2, colourmode);
-		glUniformMatrix4fv(viewID2, 1, GL_FALSE, &view[0][0]);
-		glUniformMatrix4fv(projectionID2, 1, GL_FALSE, &projection[0][0]);
-		glUniform4fv(lightposID2, 1, value_ptr(lightpos));
-
-		glBindTexture(GL_TEXTURE_2D, textureID2);
-		body.drawObject(drawmode);
-	}
-	model.pop();
-
-	//ENGINE
-	model.push(model.top());
-	{
-		model.top() = translate(model.top(), vec3(4, 0, -10));
-		model.top() = scale(model.top(), vec3(0.1f, 0.1f, 0.1f));
-
-		model.top() = translate(model.top(), vec3(0, shipmove, 0));
-
-		// Send the model uniform to the currently bound shader,
-		glUniformMatrix4fv(modelID2, 1, GL_FALSE, &(model.top()[0][0]));
-		glUniform1ui(colourmodeID2, colourmode);
-		glUniformMatrix4fv(viewID2, 1, GL_FALSE, &view[0][0]);
-		glUniformMatrix4fv(projectionID2, 1, GL_FALSE, &projection[0][0]);
-		glUniform4fv(lightposID2, 1, value_ptr(lightpos));
-
-		glBindTexture(GL_TEXTURE_2D, textureID3);
-		engine.drawObject(drawmode);
-	}
-	model.pop();
-
-	//FINS
+	//ROCKET
 	model.push(model.top());
+	if (visible[DRAW_ROCKET])
 	{
-		model.top() = translate(model.top(), vec3(4, 0, -10));
-		model.top() = scale(model.top(), vec3(0.1f, 0.1f, 0.1f));
+		model.top() = model.top() * transforms[DRAW_ROCKET];
 
-		model.top() = translate(model.top(), vec3(0, shipmove, 0));
+		if (rocket.quantized)
+		{
+			// Quantized vertices need their own shader to decode them
+			glUseProgram(program3);
+			glUniformMatrix4fv(modelID3, 1, GL_FALSE, &(model.top()[0][0]));
+			glUniform1ui(colourmodeID3, colourmode);
+			glUniformMatrix4fv(viewID3, 1, GL_FALSE, &view[0][0]);
+			glUniformMatrix4fv(projectionID3, 1, GL_FALSE, &projection[0][0]);
+			glUniform4fv(lightposID3, 1, value_ptr(lightpos));
+			glUniform3fv(pos_scaleID3, 1, value_ptr(rocket.decode_scale));
+			glUniform3fv(pos_offsetID3, 1, value_ptr(rocket.decode_offset));
+		}
+		else
+		{
+			// Send the model uniform to the currently bound shader,
+			glUniformMatrix4fv(modelID2, 1, GL_FALSE, &(model.top()[0][0]));
+			glUniform1ui(colourmodeID2, colourmode);
+			glUniformMatrix4fv(viewID2, 1, GL_FALSE, &view[0][0]);
+			glUniformMatrix4fv(projectionID2, 1, GL_FALSE, &projection[0][0]);
+			glUniform4fv(lightposID2, 1, value_ptr(lightpos));
+		}
 
-		// Send the model uniform to the currently bound shader,
-		glUniformMatrix4fv(modelID2, 1, GL_FALSE, &(model.top()[0][0]));
-		glUniform1ui(colourmodeID2, colourmode);
-		glUniformMatrix4fv(viewID2, 1, GL_FALSE, &view[0][0]);
-		glUniformMatrix4fv(projectionID2, 1, GL_FALSE, &projection[0][0]);
-		glUniform4fv(lightposID2, 1, value_ptr(lightpos));
+		// Pick the coarsest level whose error covers under a pixel, from the size of one
+		// model unit on screen at the rocket's distance from the camera. The same size picks
+		// the mip levels of its textures to stream in
+		vec3 centre = world_bounds[DRAW_ROCKET].centre;
+		float distance = std::max(-(view * vec4(centre, 1.f)).z, 0.1f);
+		float units_per_model_unit = length(vec3(model.top()[0]));
+		float pixels_per_unit = units_per_model_unit * window_height / (2.f * distance * tan(fov * 0.5f));
+		rocket.requestTextures(pixels_per_unit);
+
+		int lod = rocket_lod;
+		if (lod < 0) lod = rocket.selectLod(pixels_per_unit);
+		if (lod != rocket_lod_drawn)
+		{
+			cout << "Rocket LOD " << lod << ": " << rocket.triangleCount(lod) << " triangles" << endl;
+			rocket_lod_drawn = lod;
+		}
+		frame_stats_triangles += rocket.triangleCount(lod);
 
-		glBindTexture(GL_TEXTURE_2D, textureID4);
-		fins.drawObject(drawmode);
+		// Binds each part's texture itself
+		rocket.drawObject(drawmode, lod);
+		glUseProgram(program2);
 	}
 	model.pop();
 
 	//PARTICLES
 	model.push(model.top());
+	if (visible[DRAW_PARTICLES])
 	{
-		model.top() = translate(model.top(), vec3(4, 5, -10));
-		model.top() = rotate(model.top(), -radians(180.0f), glm::vec3(1, 0, 0));
-		model.top() = rotate(model.top(), -radians(90.0f), glm::vec3(0, 1, 0));
-		model.top() = scale(model.top(), vec3(150.f, 50.f, 150.f));
-
-
-		model.top() = translate(model.top(), vec3(0, -(shipmove / 500), 0));
+		model.top() = model.top() * transforms[DRAW_PARTICLES];
 
 		// Send our uniforms variables to the currently bound shader,
 		glUniformMatrix4fv(modelID2, 1, GL_FALSE, &model.top()[0][0]);
@@ -510,28 +585,41 @@ void display()
 		glUniformMatrix4fv(viewID2, 1, GL_FALSE, &view[0][0]);
 		glUniformMatrix4fv(projectionID2, 1, GL_FALSE, &projection[0][0]);
 
-		//change texture depending on if the rocket is moving
+		//change texture depending on if the rocket is moving, the flame glows so it's drawn additively
 		if (shipcanmove == 1) {
 			glBindTexture(GL_TEXTURE_2D, textureID5);
 		}
 		else {
 			glBindTexture(GL_TEXTURE_2D, textureID6);
 		}
+		point_anim->additive = (shipcanmove == 1);
+
+		// Additive particles don't need sorting, others are sorted back to front and alpha blended
+		if (point_anim->additive)
+			glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+		else
+			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-		point_anim->draw();
-		point_anim->animate();
+		// Decode the packed particle positions
+		if (point_anim->packed_vertices)
+		{
+			glUniform3fv(pos_scaleID2, 1, value_ptr(point_anim->decode_scale));
+			glUniform3fv(pos_offsetID2, 1, value_ptr(point_anim->decode_offset));
+			glUniform1f(fade_distanceID2, point_anim->maxdist);
+		}
+
+		point_anim->draw(sim_alpha, view * model.top());
+
+		glBlendFunc(GL_ONE, GL_ZERO);
+		glUniform3f(pos_scaleID2, 1.f, 1.f, 1.f);
+		glUniform3f(pos_offsetID2, 0.f, 0.f, 0.f);
+		glUniform1f(fade_distanceID2, 0.f);
 	}
 	model.pop();
 
 	glDisableVertexAttribArray(0);
 	glUseProgram(0);
 
-	//ship animation
-	if (shipcanmove == 1 && shipspeed < 10) {
-		shipspeed += 0.1;
-	}
-	shipmove += shipspeed;
-
 	if (cameraPos.x > -8.5) {
 		cameraPos.x = -8.5;
 	}
@@ -544,6 +632,26 @@ void display()
 	if (cameraPos.z < -32.5) {
 		cameraPos.z = -32.5;
 	}
+
+	// Time from starting GLFW until the first frame is drawn
+	if (!first_frame_drawn)
+	{
+		first_frame_drawn = true;
+		cout << "Time to first frame: " << int(glfwGetTime() * 1000) << " ms" << endl;
+	}
+
+	// The frame rate and the rocket triangles drawn per frame, averaged over about a second
+	frame_stats_frames++;
+	double stats_time = glfwGetTime() - frame_stats_start;
+	if (stats_time >= 1.0)
+	{
+		cout << "Frames: " << int(frame_stats_frames / stats_time + 0.5) << " fps, "
+			<< stats_time * 1000 / frame_stats_frames << " ms per frame, "
+			<< size_t(frame_stats_triangles / frame_stats_frames + 0.5) << " rocket triangles per frame" << endl;
+		frame_stats_start += stats_time;
+		frame_stats_frames = 0;
+		frame_stats_triangles = 0;
+	}
 }
 
 
@@ -552,6 +660,7 @@ void display()
 static void reshape(GLFWwindow* window, int w, int h)
 {
 	glViewport(0, 0, (GLsizei)w, (GLsizei)h);
+	window_height = (float)h;
 	aspect_ratio = ((float)w / 640.f * 4.f) / ((float)h / 480.f * 3.f);
 }
 
@@ -595,7 +704,55 @@ static void keyCallback(GLFWwindow* window, int key, int s, int action, int mods
 
 	//start and reset the animation
 	if (key == 'T') shipcanmove = 1;
-	if (key == 'G') shipmove = 0, shipspeed = 0, shipcanmove = 0;
+	if (key == 'G') shipmove = 0, shipmove_prev = 0, shipspeed = 0, shipcanmove = 0;
+
+	//toggle back to front sorting of the particles
+	if (key == 'P' && action == GLFW_PRESS)
+	{
+		point_anim->depth_sort = !point_anim->depth_sort;
+		cout << "Particle depth sort " << (point_anim->depth_sort ? "on" : "off") << endl;
+	}
+
+	//cycle the particle collision response: none, bounce, slide, kill
+	if (key == 'C' && action == GLFW_PRESS)
+	{
+		const char* names[] = { "none", "bounce", "slide", "kill" };
+		point_anim->collision = points2::collision_response((point_anim->collision + 1) % 4);
+		cout << "Particle collision: " << names[point_anim->collision] << endl;
+	}
+
+	//toggle repulsion between the particles
+	if (key == 'R' && action == GLFW_PRESS)
+	{
+		point_anim->repulsion = (point_anim->repulsion > 0.f) ? 0.f : 0.0005f;
+		cout << "Particle repulsion " << (point_anim->repulsion > 0.f ? "on" : "off") << endl;
+	}
+
+	//toggle view frustum culling
+	if (key == 'F' && action == GLFW_PRESS)
+	{
+		frustum_culling = !frustum_culling;
+		cout << "Frustum culling " << (frustum_culling ? "on" : "off") << endl;
+	}
+
+	//cycle the rocket through automatic level of detail and each fixed level
+	if (key == 'L' && action == GLFW_PRESS)
+	{
+		rocket_lod = (rocket_lod < rocket.lodCount()) ? rocket_lod + 1 : -1;
+		if (rocket_lod < 0) cout << "Rocket LOD automatic" << endl;
+	}
+
+	//change the simulation rate, independent of the rendering frame rate
+	if (key == '[' && action == GLFW_PRESS && sim_rate > 10.f)
+	{
+		sim_rate -= 10.f;
+		cout << "Simulation rate = " << sim_rate << " Hz" << endl;
+	}
+	if (key == ']' && action == GLFW_PRESS && sim_rate < 240.f)
+	{
+		sim_rate += 10.f;
+		cout << "Simulation rate = " << sim_rate << " Hz" << endl;
+	}
 
 	/* Cycle between drawing vertices, mesh and filled polygons */
 	if (key == ',' && action != GLFW_PRESS)
@@ -643,6 +800,60 @@ void mouseCallback(GLFWwindow* window, double xpos, double ypos)
 /* Entry point of program */
 int main(int argc, char* argv[])
 {
+	// Benchmark the obj parsers instead of running: -benchobj [obj files]
+	if (argc > 1 && string(argv[1]) == "-benchobj")
+	{
+		vector<string> files(argv + 2, argv + argc);
+		if (files.empty())
+		{
+			files.push_back("obj/nose.obj");
+			files.push_back("obj/body.obj");
+			files.push_back("obj/engine.obj");
+			files.push_back("obj/fins.obj");
+		}
+		benchmarkObjParsing(files, 10);
+		return 0;
+	}
+
+	// Bake textures and report how long it took instead of running: -baketextures [image files]
+	if (argc > 1 && string(argv[1]) == "-baketextures")
+	{
+		vector<string> files(argv + 2, argv + argc);
+		if (files.empty())
+		{
+			files.push_back("images/nose.png");
+			files.push_back("images/body.png");
+			files.push_back("images/engine.png");
+			files.push_back("images/fins.png");
+			files.push_back("images/flame.png");
+			files.push_back("images/smoke.png");
+		}
+		bakeTextures(files, true);
+		return 0;
+	}
+
+	// Benchmark the mip generators once there is a GL context: -benchmips [image files]
+	vector<string> mip_benchmark_files;
+	bool benchmark_mips = argc > 1 && string(argv[1]) == "-benchmips";
+	if (benchmark_mips)
+	{
+		mip_benchmark_files.assign(argv + 2, argv + argc);
+		if (mip_benchmark_files.empty())
+		{
+			mip_benchmark_files.push_back("images/nose.png");
+			mip_benchmark_files.push_back("images/flame.png");
+		}
+	}
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (string(argv[i]) == "-serialload") serial_loading = true;
+		if (string(argv[i]) == "-floatverts") quantize_rocket = false;
+		if (string(argv[i]) == "-streamobj") stream_obj = true;
+		if (string(argv[i]) == "-rgbatextures") shared_textures().compress = false;
+		if (string(argv[i]) == "-texturebudget" && i + 1 < argc) shared_textures().memory_budget = size_t(atoi(argv[++i])) * 1024 * 1024;
+	}
+
 	GLWrapper* glw = new GLWrapper(1024, 768, "Gregor Mitchell - Assignment 2");;
 
 	if (!ogl_LoadFunctions())
@@ -651,6 +862,13 @@ int main(int argc, char* argv[])
 		return 0;
 	}
 
+	if (benchmark_mips)
+	{
+		benchmarkMipGeneration(mip_benchmark_files, 10);
+		delete(glw);
+		return 0;
+	}
+
 	glw->setRenderer(display);
 	glw->setKeyCallback(keyCallback);
 	glw->setCursorPosCallback(mouseCallback);
@@ -663,6 +881,11 @@ int main(int argc, char* argv[])
 
 	glw->eventLoop();
 
+	// The textures have to go while the GL context is still current
+	rocket.releaseTextures();
+	shared_textures().release(textureID5);
+	shared_textures().release(textureID6);
+	shared_textures().clear();
 	delete(glw);
 	return 0;
 }
@@ -0,0 +1,192 @@
+/* file_utils.cpp
+   Memory mapping uses CreateFileMapping/MapViewOfFile on Windows and mmap elsewhere.
+*/
+
+#include "file_utils.h"
+#include <fstream>
+#include <atomic>
+#include <algorithm>
+#include <cstdio>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+mapped_file::mapped_file()
+{
+	bytes = 0;
+	length = 0;
+	is_open_empty = false;
+#ifdef _WIN32
+	file_handle = INVALID_HANDLE_VALUE;
+	mapping_handle = 0;
+#endif
+}
+
+
+mapped_file::~mapped_file()
+{
+	close();
+}
+
+
+bool mapped_file::open(const string& path)
+{
+	close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, 0);
+	if (file == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size))
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	if (file_size.QuadPart == 0)
+	{
+		CloseHandle(file);
+		is_open_empty = true;
+		return true;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+	if (!mapping)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!view)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	file_handle = file;
+	mapping_handle = mapping;
+	bytes = static_cast<const unsigned char*>(view);
+	length = size_t(file_size.QuadPart);
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		::close(fd);
+		return false;
+	}
+
+	if (st.st_size == 0)
+	{
+		::close(fd);
+		is_open_empty = true;
+		return true;
+	}
+
+	void* view = mmap(0, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);	// The mapping keeps its own reference to the file
+	if (view == MAP_FAILED) return false;
+
+	bytes = static_cast<const unsigned char*>(view);
+	length = size_t(st.st_size);
+#endif
+	return true;
+}
+
+
+void mapped_file::close()
+{
+#ifdef _WIN32
+	if (bytes) UnmapViewOfFile(bytes);
+	if (mapping_handle) CloseHandle(mapping_handle);
+	if (file_handle != INVALID_HANDLE_VALUE) CloseHandle(file_handle);
+	mapping_handle = 0;
+	file_handle = INVALID_HANDLE_VALUE;
+#else
+	if (bytes) munmap(const_cast<unsigned char*>(bytes), length);
+#endif
+	bytes = 0;
+	length = 0;
+	is_open_empty = false;
+}
+
+
+bool fileStat(const string& path, uint64_t& size, uint64_t& mtime)
+{
+#ifdef _WIN32
+	struct __stat64 st;
+	if (_stat64(path.c_str(), &st) != 0) return false;
+#else
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0) return false;
+#endif
+	size = uint64_t(st.st_size);
+	mtime = uint64_t(st.st_mtime);
+	return true;
+}
+
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed)
+{
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	uint64_t h = seed;
+	for (size_t i = 0; i < size; i++)
+	{
+		h ^= p[i];
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+
+bool writeFileAtomic(const string& path, const file_block* blocks, size_t count)
+{
+	static atomic<unsigned> temp_serial(0);
+	string temp_path = path + "." + to_string(++temp_serial) + ".tmp";
+	{
+		ofstream out(temp_path.c_str(), ios::binary | ios::trunc);
+		if (!out) return false;
+
+		const char padding[16] = { 0 };
+		uint64_t written = 0;
+		for (size_t i = 0; i < count && out; i++)
+		{
+			while (written < blocks[i].offset && out)
+			{
+				uint64_t gap = std::min(blocks[i].offset - written, uint64_t(sizeof(padding)));
+				out.write(padding, streamsize(gap));
+				written += gap;
+			}
+			if (blocks[i].size) out.write(static_cast<const char*>(blocks[i].data), streamsize(blocks[i].size));
+			written += blocks[i].size;
+		}
+
+		if (!out)
+		{
+			out.close();
+			remove(temp_path.c_str());
+			return false;
+		}
+	}
+
+	remove(path.c_str());
+	if (rename(temp_path.c_str(), path.c_str()) == 0) return true;
+	remove(temp_path.c_str());
+	return false;
+}
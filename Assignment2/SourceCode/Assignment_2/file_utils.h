@@ -0,0 +1,61 @@
+/* file_utils.h
+   File helpers shared by the asset loaders and caches:
+   read-only memory mapping, file size/modification time, a content hash and writing a
+   cache file in one piece.
+*/
+
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+/* A read-only memory mapping of a whole file, unmapped when destroyed */
+class mapped_file
+{
+public:
+	mapped_file();
+	~mapped_file();
+
+	bool open(const std::string& path);
+	void close();
+
+	const unsigned char* data() const { return bytes; }
+	size_t size() const { return length; }
+	bool isOpen() const { return bytes != 0 || is_open_empty; }
+
+private:
+	mapped_file(const mapped_file&);
+	mapped_file& operator=(const mapped_file&);
+
+	const unsigned char* bytes;
+	size_t length;
+	bool is_open_empty;		// Zero length files can't be mapped but open fine
+#ifdef _WIN32
+	void* file_handle;
+	void* mapping_handle;
+#endif
+};
+
+// Get the size in bytes and last modification time of a file, false if it doesn't exist
+bool fileStat(const std::string& path, uint64_t& size, uint64_t& mtime);
+
+// 64 bit FNV-1a hash of a block of memory, pass a previous result as seed to continue it
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 14695981039346656037ull);
+
+// Round an offset up to the 16 byte boundary the cache files start their blocks on
+inline uint64_t alignOffset(uint64_t offset) { return (offset + 15) & ~uint64_t(15); }
+
+// A block of a file written by writeFileAtomic
+struct file_block
+{
+	uint64_t offset;
+	const void* data;
+	size_t size;
+};
+
+// Write blocks at increasing offsets, zero filling the gaps between them. The file is
+// written under a temporary name of its own and renamed over path once complete, so a
+// failed write never leaves a truncated file behind and writers of the same path on
+// several threads don't share a temporary. False, with nothing left behind, if it fails
+bool writeFileAtomic(const std::string& path, const file_block* blocks, size_t count);
@@ -0,0 +1,121 @@
+/* frustum.cpp
+   Planes are extracted as in Gribb and Hartmann, "Fast Extraction of Viewing Frustum
+   Planes from the World-View-Projection Matrix" (2001). For the box test only the corner
+   furthest along the plane normal is checked, and since the plane is the same for all
+   four boxes in a batch the corner is picked per plane rather than per box.
+*/
+
+#include "frustum.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#define FRUSTUM_SSE
+#include <xmmintrin.h>
+#endif
+
+using namespace glm;
+
+cull_frustum::cull_frustum()
+{
+	for (int p = 0; p < 6; p++) planes[p] = vec4(0.f);
+}
+
+
+void cull_frustum::setMatrix(const mat4& view_projection)
+{
+	// Rows of the matrix, glm stores it by columns
+	vec4 row[4];
+	for (int r = 0; r < 4; r++)
+	{
+		row[r] = vec4(view_projection[0][r], view_projection[1][r], view_projection[2][r], view_projection[3][r]);
+	}
+
+	planes[0] = row[3] + row[0];
+	planes[1] = row[3] - row[0];
+	planes[2] = row[3] + row[1];
+	planes[3] = row[3] - row[1];
+	planes[4] = row[3] + row[2];
+	planes[5] = row[3] - row[2];
+
+	// Normalise so that the sphere test compares real distances
+	for (int p = 0; p < 6; p++)
+	{
+		float len = length(vec3(planes[p]));
+		if (len > 0.f) planes[p] /= len;
+	}
+}
+
+
+bool cull_frustum::isVisible(const bounding_volume& b) const
+{
+	for (int p = 0; p < 6; p++)
+	{
+		vec3 n = vec3(planes[p]);
+		if (dot(n, b.centre) + planes[p].w < -b.radius) return false;
+
+		vec3 corner(n.x >= 0.f ? b.max.x : b.min.x, n.y >= 0.f ? b.max.y : b.min.y, n.z >= 0.f ? b.max.z : b.min.z);
+		if (dot(n, corner) + planes[p].w < 0.f) return false;
+	}
+	return true;
+}
+
+
+size_t cull_frustum::cull(const bounding_volume* bounds, size_t count, unsigned char* visible) const
+{
+	size_t culled = 0;
+	size_t i = 0;
+
+#ifdef FRUSTUM_SSE
+	for (; i + 4 <= count; i += 4)
+	{
+		const bounding_volume* b = bounds + i;
+
+		// Transpose four bounds into one register per component
+		__m128 cx = _mm_setr_ps(b[0].centre.x, b[1].centre.x, b[2].centre.x, b[3].centre.x);
+		__m128 cy = _mm_setr_ps(b[0].centre.y, b[1].centre.y, b[2].centre.y, b[3].centre.y);
+		__m128 cz = _mm_setr_ps(b[0].centre.z, b[1].centre.z, b[2].centre.z, b[3].centre.z);
+		__m128 neg_radius = _mm_setr_ps(-b[0].radius, -b[1].radius, -b[2].radius, -b[3].radius);
+		__m128 min_x = _mm_setr_ps(b[0].min.x, b[1].min.x, b[2].min.x, b[3].min.x);
+		__m128 min_y = _mm_setr_ps(b[0].min.y, b[1].min.y, b[2].min.y, b[3].min.y);
+		__m128 min_z = _mm_setr_ps(b[0].min.z, b[1].min.z, b[2].min.z, b[3].min.z);
+		__m128 max_x = _mm_setr_ps(b[0].max.x, b[1].max.x, b[2].max.x, b[3].max.x);
+		__m128 max_y = _mm_setr_ps(b[0].max.y, b[1].max.y, b[2].max.y, b[3].max.y);
+		__m128 max_z = _mm_setr_ps(b[0].max.z, b[1].max.z, b[2].max.z, b[3].max.z);
+
+		__m128 outside = _mm_setzero_ps();
+		for (int p = 0; p < 6; p++)
+		{
+			const vec4& plane = planes[p];
+			__m128 nx = _mm_set1_ps(plane.x);
+			__m128 ny = _mm_set1_ps(plane.y);
+			__m128 nz = _mm_set1_ps(plane.z);
+			__m128 w = _mm_set1_ps(plane.w);
+
+			__m128 sphere = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)), _mm_add_ps(_mm_mul_ps(nz, cz), w));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(sphere, neg_radius));
+
+			__m128 px = (plane.x >= 0.f) ? max_x : min_x;
+			__m128 py = (plane.y >= 0.f) ? max_y : min_y;
+			__m128 pz = (plane.z >= 0.f) ? max_z : min_z;
+			__m128 box = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, px), _mm_mul_ps(ny, py)), _mm_add_ps(_mm_mul_ps(nz, pz), w));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(box, _mm_setzero_ps()));
+		}
+
+		int mask = _mm_movemask_ps(outside);
+		for (int k = 0; k < 4; k++)
+		{
+			bool out = (mask >> k) & 1;
+			visible[i + k] = out ? 0 : 1;
+			culled += out;
+		}
+	}
+#endif
+
+	// The last few, or all of them without SSE
+	for (; i < count; i++)
+	{
+		bool in = isVisible(bounds[i]);
+		visible[i] = in ? 1 : 0;
+		culled += !in;
+	}
+	return culled;
+}
@@ -0,0 +1,32 @@
+/* frustum.h
+   CPU view frustum culling. The six planes are taken from the projection * view matrix
+   each frame, and world space bounds (bounds.h) are tested against them in batches,
+   four at a time with SSE. Bounds are culled when their sphere or their box is wholly
+   outside one of the planes. The test is conservative: bounds just outside a corner of
+   the frustum can pass, but nothing in view is ever culled.
+*/
+
+#pragma once
+
+#include "bounds.h"
+#include <glm/glm.hpp>
+#include <cstddef>
+
+class cull_frustum
+{
+public:
+	cull_frustum();
+
+	// Take the planes from a projection * view matrix, so they are in world space
+	void setMatrix(const glm::mat4& view_projection);
+
+	// Test count world space bounds, setting visible[i] to 0 if bounds[i] is outside the
+	// frustum or 1 if it may be in view. Returns the number culled
+	size_t cull(const bounding_volume* bounds, size_t count, unsigned char* visible) const;
+
+	// Test one world space bounds
+	bool isVisible(const bounding_volume& b) const;
+
+	// Left, right, bottom, top, near, far as (normal, distance), normals pointing inwards
+	glm::vec4 planes[6];
+};
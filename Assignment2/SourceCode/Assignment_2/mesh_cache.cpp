@@ -0,0 +1,218 @@
+/* mesh_cache.cpp
+   File layout: a fixed size header followed by the vertex, index, material, sub-mesh,
+   LOD and LOD sub-mesh arrays, each starting on a 16 byte boundary. All offsets are from the start of
+   the file and everything is stored in the native byte order.
+*/
+
+#include "mesh_cache.h"
+#include <cstring>
+#include <cstdio>
+
+using namespace std;
+
+static const char mesh_cache_magic[4] = { 'G', 'M', 'S', 'H' };
+// 2: the mesh is reordered by optimizeMesh before it is written
+// 3: levels of detail and the build options
+// 4: materials, with sub-meshes per material instead of per shape
+static const uint32_t mesh_cache_version = 4;
+
+struct mesh_cache_header
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t source_size;
+	uint64_t source_mtime;
+	uint64_t source_hash;
+	uint64_t build_options;
+	uint32_t vertex_count;
+	uint32_t vertex_stride;
+	uint32_t index_count;
+	uint32_t index_size;		// 2 or 4 bytes
+	uint32_t material_count;
+	uint32_t submesh_count;
+	uint32_t lod_count;
+	float bounds_min[3];
+	float bounds_max[3];
+	uint64_t vertex_offset;
+	uint64_t index_offset;
+	uint64_t material_offset;
+	uint64_t submesh_offset;
+	uint64_t lod_offset;
+	uint64_t lod_submesh_offset;
+};
+
+/* The key hashes the whole source file, which is cheap next to parsing it */
+bool makeMeshCacheKey(const string& source_path, const mapped_file& source, mesh_cache_key& key)
+{
+	if (!fileStat(source_path, key.source_size, key.source_mtime)) return false;
+
+	key.source_hash = hashBytes(source.data(), source.size());
+	key.build_options = 0;
+	return true;
+}
+
+
+bool writeMeshCache(const string& cache_path, const mesh_cache_key& key, const mesh_data& mesh)
+{
+	mesh_cache_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, mesh_cache_magic, sizeof(header.magic));
+	header.version = mesh_cache_version;
+	header.source_size = key.source_size;
+	header.source_mtime = key.source_mtime;
+	header.source_hash = key.source_hash;
+	header.build_options = key.build_options;
+	header.vertex_count = uint32_t(mesh.vertices.size());
+	header.vertex_stride = sizeof(mesh_vertex);
+	header.index_count = uint32_t(mesh.indices.size());
+	header.index_size = useShortIndices(mesh.vertices.size()) ? 2 : 4;
+	header.material_count = uint32_t(mesh.materials.size());
+	header.submesh_count = uint32_t(mesh.submeshes.size());
+	header.lod_count = uint32_t(mesh.lods.size());
+	for (int c = 0; c < 3; c++)
+	{
+		header.bounds_min[c] = mesh.bounds_min[c];
+		header.bounds_max[c] = mesh.bounds_max[c];
+	}
+	header.vertex_offset = alignOffset(sizeof(header));
+	header.index_offset = alignOffset(header.vertex_offset + uint64_t(header.vertex_count) * header.vertex_stride);
+	header.material_offset = alignOffset(header.index_offset + uint64_t(header.index_count) * header.index_size);
+	header.submesh_offset = alignOffset(header.material_offset + uint64_t(header.material_count) * sizeof(mesh_material));
+	header.lod_offset = alignOffset(header.submesh_offset + uint64_t(header.submesh_count) * sizeof(mesh_submesh));
+	header.lod_submesh_offset = alignOffset(header.lod_offset + uint64_t(header.lod_count) * sizeof(mesh_lod));
+
+	vector<GLushort> short_indices;
+	if (header.index_size == 2) short_indices.assign(mesh.indices.begin(), mesh.indices.end());
+
+	file_block blocks[] =
+	{
+		{ 0, &header, sizeof(header) },
+		{ header.vertex_offset, mesh.vertices.data(), mesh.vertices.size() * sizeof(mesh_vertex) },
+		{ header.index_offset, mesh.indices.data(), mesh.indices.size() * sizeof(GLuint) },
+		{ header.material_offset, mesh.materials.data(), mesh.materials.size() * sizeof(mesh_material) },
+		{ header.submesh_offset, mesh.submeshes.data(), mesh.submeshes.size() * sizeof(mesh_submesh) },
+		{ header.lod_offset, mesh.lods.data(), mesh.lods.size() * sizeof(mesh_lod) },
+		{ header.lod_submesh_offset, mesh.lod_submeshes.data(), mesh.lod_submeshes.size() * sizeof(mesh_submesh) },
+	};
+	if (header.index_size == 2)
+	{
+		blocks[2].data = short_indices.data();
+		blocks[2].size = short_indices.size() * sizeof(GLushort);
+	}
+	return writeFileAtomic(cache_path, blocks, sizeof(blocks) / sizeof(blocks[0]));
+}
+
+
+mesh_cache_view::mesh_cache_view()
+{
+	header = 0;
+}
+
+
+bool mesh_cache_view::open(const string& cache_path, const mesh_cache_key& key)
+{
+	close();
+	if (!file.open(cache_path)) return false;
+
+	if (file.size() < sizeof(mesh_cache_header))
+	{
+		close();
+		return false;
+	}
+
+	const mesh_cache_header* h = reinterpret_cast<const mesh_cache_header*>(file.data());
+
+	// Reject caches from another format version or another version of the source file
+	bool valid = memcmp(h->magic, mesh_cache_magic, sizeof(h->magic)) == 0 &&
+		h->version == mesh_cache_version &&
+		h->vertex_stride == sizeof(mesh_vertex) &&
+		(h->index_size == 2 || h->index_size == 4) &&
+		h->source_size == key.source_size &&
+		h->source_mtime == key.source_mtime &&
+		h->source_hash == key.source_hash &&
+		h->build_options == key.build_options;
+
+	// And any that are truncated
+	valid = valid &&
+		h->vertex_offset + uint64_t(h->vertex_count) * h->vertex_stride <= file.size() &&
+		h->index_offset + uint64_t(h->index_count) * h->index_size <= file.size() &&
+		h->material_offset + uint64_t(h->material_count) * sizeof(mesh_material) <= file.size() &&
+		h->submesh_offset + uint64_t(h->submesh_count) * sizeof(mesh_submesh) <= file.size() &&
+		h->lod_offset + uint64_t(h->lod_count) * sizeof(mesh_lod) <= file.size() &&
+		h->lod_submesh_offset + uint64_t(h->lod_count) * h->submesh_count * sizeof(mesh_submesh) <= file.size();
+
+	if (!valid)
+	{
+		close();
+		return false;
+	}
+
+	header = h;
+	return true;
+}
+
+
+void mesh_cache_view::close()
+{
+	header = 0;
+	file.close();
+}
+
+
+const mesh_vertex* mesh_cache_view::vertices() const
+{
+	return reinterpret_cast<const mesh_vertex*>(file.data() + header->vertex_offset);
+}
+
+GLuint mesh_cache_view::vertexCount() const { return header->vertex_count; }
+
+const void* mesh_cache_view::indices() const
+{
+	return file.data() + header->index_offset;
+}
+
+GLuint mesh_cache_view::indexCount() const { return header->index_count; }
+GLuint mesh_cache_view::fullIndexCount() const
+{
+	GLuint count = 0;
+	for (GLuint s = 0; s < header->submesh_count; s++) count += submeshes()[s].index_count;
+	return count;
+}
+GLenum mesh_cache_view::indexType() const { return (header->index_size == 2) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT; }
+GLuint mesh_cache_view::indexSize() const { return header->index_size; }
+
+const mesh_material* mesh_cache_view::materials() const
+{
+	return reinterpret_cast<const mesh_material*>(file.data() + header->material_offset);
+}
+
+GLuint mesh_cache_view::materialCount() const { return header->material_count; }
+
+const mesh_submesh* mesh_cache_view::submeshes() const
+{
+	return reinterpret_cast<const mesh_submesh*>(file.data() + header->submesh_offset);
+}
+
+GLuint mesh_cache_view::submeshCount() const { return header->submesh_count; }
+
+const mesh_lod* mesh_cache_view::lods() const
+{
+	return reinterpret_cast<const mesh_lod*>(file.data() + header->lod_offset);
+}
+
+GLuint mesh_cache_view::lodCount() const { return header->lod_count; }
+
+const mesh_submesh* mesh_cache_view::lodSubmeshes() const
+{
+	return reinterpret_cast<const mesh_submesh*>(file.data() + header->lod_submesh_offset);
+}
+
+glm::vec3 mesh_cache_view::boundsMin() const
+{
+	return glm::vec3(header->bounds_min[0], header->bounds_min[1], header->bounds_min[2]);
+}
+
+glm::vec3 mesh_cache_view::boundsMax() const
+{
+	return glm::vec3(header->bounds_max[0], header->bounds_max[1], header->bounds_max[2]);
+}
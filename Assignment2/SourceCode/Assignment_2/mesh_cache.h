@@ -0,0 +1,128 @@
+/* mesh_cache.h
+   Binary cache of a loaded OBJ mesh, written next to the OBJ file after the first load.
+   The cache holds the interleaved vertices, the index buffer (already narrowed to 16 bits
+   when possible), the materials and their sub-mesh ranges, the simplified levels of detail
+   and the bounds.
+   Later loads memory map it and hand the mapped data straight to OpenGL.
+
+   A cache is only used if it was built from a source file with the same size,
+   modification time and content hash, with the same build options (such as the LOD
+   ratios), and by the same version of the format. The .mtl files are not part of the key,
+   so delete the cache after editing one.
+*/
+
+#pragma once
+
+#include "wrapper_glfw.h"
+#include "file_utils.h"
+#include <vector>
+#include <string>
+#include <glm/glm.hpp>
+
+// Interleaved vertex as stored in the GL vertex buffer
+struct mesh_vertex
+{
+	GLfloat position[3];
+	GLfloat normal[3];
+	GLfloat texcoord[2];
+};
+
+// Material index of the faces that have no material
+const GLuint no_material = 0xffffffff;
+
+// A range of the index buffer holding the triangles of one material
+struct mesh_submesh
+{
+	GLuint first_index;
+	GLuint index_count;
+	GLuint material;	// Index into the mesh's materials, or no_material
+};
+
+// What the loader keeps of an .mtl material. The strings are fixed size so the
+// materials can be stored in the cache as they are
+struct mesh_material
+{
+	char name[64];
+	char diffuse_texname[192];	// The map_Kd image, relative to the working directory. Empty if none
+};
+
+// A simplified level of detail, a range of the index buffer after the full detail triangles,
+// or the full detail range itself for a level that couldn't be simplified
+struct mesh_lod
+{
+	GLuint first_index;
+	GLuint index_count;
+	float error;		// How far the surface may have moved from the full detail, in model units
+};
+
+// A mesh as built by the OBJ loader. The indices hold the full detail triangles (the
+// sub-meshes) followed by the triangles of each simplified level, all using the same vertices.
+// Every level is split into the same materials as the full detail triangles
+struct mesh_data
+{
+	std::vector<mesh_vertex> vertices;
+	std::vector<GLuint> indices;
+	std::vector<mesh_material> materials;
+	std::vector<mesh_submesh> submeshes;		// One per material used, in material order
+	std::vector<mesh_lod> lods;
+	std::vector<mesh_submesh> lod_submeshes;	// The sub-meshes of each level in turn, submeshes.size() per level
+	glm::vec3 bounds_min;
+	glm::vec3 bounds_max;
+
+	// Number of indices of the full detail triangles, which the sub-meshes cover
+	GLuint fullIndexCount() const
+	{
+		GLuint count = 0;
+		for (size_t s = 0; s < submeshes.size(); s++) count += submeshes[s].index_count;
+		return count;
+	}
+};
+
+// Identifies the exact source file a cache was built from
+struct mesh_cache_key
+{
+	uint64_t source_size;
+	uint64_t source_mtime;
+	uint64_t source_hash;
+	uint64_t build_options;		// Hash of the loader settings that change the mesh
+};
+
+// Indices are stored as 16 bits when every vertex can be addressed with them
+inline bool useShortIndices(size_t vertex_count) { return vertex_count <= 65536; }
+
+bool makeMeshCacheKey(const std::string& source_path, const mapped_file& source, mesh_cache_key& key);
+bool writeMeshCache(const std::string& cache_path, const mesh_cache_key& key, const mesh_data& mesh);
+
+struct mesh_cache_header;
+
+/* Memory mapped view of a cache file, the pointers are valid while the view is open */
+class mesh_cache_view
+{
+public:
+	mesh_cache_view();
+
+	bool open(const std::string& cache_path, const mesh_cache_key& key);
+	void close();
+	bool isOpen() const { return header != 0; }
+
+	const mesh_vertex* vertices() const;
+	GLuint vertexCount() const;
+	const void* indices() const;
+	GLuint indexCount() const;
+	GLuint fullIndexCount() const;
+	GLenum indexType() const;
+	GLuint indexSize() const;
+	const mesh_material* materials() const;
+	GLuint materialCount() const;
+	const mesh_submesh* submeshes() const;
+	GLuint submeshCount() const;
+	const mesh_lod* lods() const;
+	GLuint lodCount() const;
+	const mesh_submesh* lodSubmeshes() const;	// submeshCount() for each level
+	glm::vec3 boundsMin() const;
+	glm::vec3 boundsMax() const;
+
+private:
+	mapped_file file;
+	const mesh_cache_header* header;
+};
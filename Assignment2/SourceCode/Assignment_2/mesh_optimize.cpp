@@ -0,0 +1,318 @@
+/* mesh_optimize.cpp
+   Tipsify and the overdraw pass follow Sander, Nehab and Barczak, "Fast Triangle
+   Reordering for Vertex Locality and Reduced Overdraw" (2007). Tipsify fans around one
+   vertex at a time and picks the next fanning vertex from those just emitted that will
+   still be in the cache, falling back to a stack of recent vertices at dead ends. Each
+   fallback starts a new cluster, and the clusters are split further wherever the cache
+   miss ratio so far is within the threshold of the whole cluster's. Clusters can then
+   be drawn in any order for little cache cost.
+*/
+
+#include "mesh_optimize.h"
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+using namespace glm;
+
+vertex_cache_stats analyzeVertexCache(const GLuint* indices, size_t index_count, size_t vertex_count)
+{
+	// A vertex is in the cache if fewer than cache size misses happened since it was loaded
+	vector<size_t> loaded_at(vertex_count, 0);
+	size_t misses = 0;
+	for (size_t i = 0; i < index_count; i++)
+	{
+		GLuint v = indices[i];
+		if (loaded_at[v] == 0 || misses + 1 - loaded_at[v] > vertex_cache_size)
+		{
+			misses++;
+			loaded_at[v] = misses;
+		}
+	}
+
+	vertex_cache_stats stats;
+	stats.acmr = (index_count >= 3) ? float(misses) / float(index_count / 3) : 0.f;
+	stats.atvr = vertex_count ? float(misses) / float(vertex_count) : 0.f;
+	return stats;
+}
+
+
+/* Tipsify on a range whose indices are all less than vertex_count. Writes the reordered
+   triangles over the input and the triangle numbers where clusters start to clusters */
+static void tipsify(GLuint* indices, size_t index_count, size_t vertex_count, vector<size_t>& clusters)
+{
+	size_t triangle_count = index_count / 3;
+
+	// Triangles using each vertex, as offsets into one array
+	vector<GLuint> live(vertex_count, 0);
+	for (size_t i = 0; i < index_count; i++) live[indices[i]]++;
+
+	vector<size_t> adjacency_start(vertex_count + 1, 0);
+	for (size_t v = 0; v < vertex_count; v++) adjacency_start[v + 1] = adjacency_start[v] + live[v];
+
+	vector<GLuint> adjacency(index_count);
+	vector<size_t> fill(adjacency_start.begin(), adjacency_start.end() - 1);
+	for (size_t t = 0; t < triangle_count; t++)
+	{
+		for (int c = 0; c < 3; c++) adjacency[fill[indices[3 * t + c]]++] = GLuint(t);
+	}
+
+	vector<GLuint> output;
+	output.reserve(index_count);
+	vector<size_t> cache_time(vertex_count, 0);
+	vector<bool> emitted(triangle_count, false);
+	vector<GLuint> dead_end;
+	vector<GLuint> candidates;
+	size_t timestamp = vertex_cache_size + 1;
+	size_t cursor = 0;
+
+	clusters.clear();
+	long fanning = vertex_count ? 0 : -1;
+	if (fanning >= 0) clusters.push_back(0);
+
+	while (fanning >= 0)
+	{
+		// Emit every remaining triangle around the fanning vertex
+		candidates.clear();
+		for (size_t a = adjacency_start[fanning]; a < adjacency_start[fanning + 1]; a++)
+		{
+			GLuint t = adjacency[a];
+			if (emitted[t]) continue;
+
+			for (int c = 0; c < 3; c++)
+			{
+				GLuint v = indices[3 * t + c];
+				output.push_back(v);
+				dead_end.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+				if (timestamp - cache_time[v] > vertex_cache_size) cache_time[v] = timestamp++;
+			}
+			emitted[t] = true;
+		}
+
+		// Prefer the candidate that has been in the cache longest and will still be there
+		// after its remaining triangles are emitted
+		long next = -1;
+		long best_priority = -1;
+		for (size_t i = 0; i < candidates.size(); i++)
+		{
+			GLuint v = candidates[i];
+			if (live[v] == 0) continue;
+
+			long priority = 0;
+			if (timestamp - cache_time[v] + 2 * live[v] <= vertex_cache_size) priority = long(timestamp - cache_time[v]);
+			if (priority > best_priority)
+			{
+				best_priority = priority;
+				next = v;
+			}
+		}
+
+		// At a dead end restart from a recently used vertex, or else the next unfinished one
+		if (next < 0)
+		{
+			while (!dead_end.empty() && next < 0)
+			{
+				GLuint v = dead_end.back();
+				dead_end.pop_back();
+				if (live[v] > 0) next = v;
+			}
+			while (next < 0 && cursor < vertex_count)
+			{
+				if (live[cursor] > 0) next = long(cursor);
+				cursor++;
+			}
+			if (next >= 0) clusters.push_back(output.size() / 3);
+		}
+		fanning = next;
+	}
+
+	copy(output.begin(), output.end(), indices);
+}
+
+
+/* Split the clusters wherever the miss ratio so far reaches the threshold, then sort
+   them so that clusters facing away from the middle of the mesh are drawn first */
+static void optimizeOverdraw(GLuint* indices, size_t index_count, size_t vertex_count, const vector<vec3>& positions,
+	const vector<size_t>& hard_clusters)
+{
+	size_t triangle_count = index_count / 3;
+	if (triangle_count == 0) return;
+
+	vector<size_t> loaded_at(vertex_count, 0);
+	size_t misses = 0;
+
+	// Misses for a triangle, a fresh cache is started by moving misses past the cache size
+	auto triangleMisses = [&](size_t t)
+	{
+		size_t before = misses;
+		for (int c = 0; c < 3; c++)
+		{
+			GLuint v = indices[3 * t + c];
+			if (loaded_at[v] == 0 || misses + 1 - loaded_at[v] > vertex_cache_size)
+			{
+				misses++;
+				loaded_at[v] = misses;
+			}
+		}
+		return misses - before;
+	};
+	auto resetCache = [&]() { misses += vertex_cache_size + 1; };
+
+	vector<size_t> clusters;
+	for (size_t h = 0; h < hard_clusters.size(); h++)
+	{
+		size_t start = hard_clusters[h];
+		size_t end = (h + 1 < hard_clusters.size()) ? hard_clusters[h + 1] : triangle_count;
+
+		resetCache();
+		size_t cluster_misses = 0;
+		for (size_t t = start; t < end; t++) cluster_misses += triangleMisses(t);
+		float threshold = overdraw_threshold * float(cluster_misses) / float(end - start);
+
+		clusters.push_back(start);
+		resetCache();
+		size_t running_misses = 0, running_triangles = 0;
+		for (size_t t = start; t < end; t++)
+		{
+			running_misses += triangleMisses(t);
+			running_triangles++;
+			if (t + 1 < end && float(running_misses) / float(running_triangles) <= threshold)
+			{
+				clusters.push_back(t + 1);
+				resetCache();
+				running_misses = running_triangles = 0;
+			}
+		}
+	}
+
+	// Area weighted centroid and normal of each cluster, and the centroid of the whole range
+	vector<vec3> centroids(clusters.size()), normals(clusters.size());
+	vec3 mesh_centroid(0.f);
+	float mesh_area = 0.f;
+	for (size_t c = 0; c < clusters.size(); c++)
+	{
+		size_t start = clusters[c];
+		size_t end = (c + 1 < clusters.size()) ? clusters[c + 1] : triangle_count;
+
+		vec3 centroid(0.f), normal(0.f);
+		float area = 0.f;
+		for (size_t t = start; t < end; t++)
+		{
+			vec3 p0 = positions[indices[3 * t]];
+			vec3 p1 = positions[indices[3 * t + 1]];
+			vec3 p2 = positions[indices[3 * t + 2]];
+			vec3 n = cross(p1 - p0, p2 - p0);
+			float a = length(n);
+
+			centroid += (p0 + p1 + p2) * (a / 3.f);
+			normal += n;
+			area += a;
+		}
+
+		mesh_centroid += centroid;
+		mesh_area += area;
+		centroids[c] = (area > 0.f) ? centroid / area : positions[indices[3 * start]];
+		float len = length(normal);
+		normals[c] = (len > 0.f) ? normal / len : vec3(0.f);
+	}
+	if (mesh_area > 0.f) mesh_centroid /= mesh_area;
+
+	vector<float> sort_key(clusters.size());
+	vector<size_t> order(clusters.size());
+	for (size_t c = 0; c < clusters.size(); c++)
+	{
+		sort_key[c] = dot(centroids[c] - mesh_centroid, normals[c]);
+		order[c] = c;
+	}
+	stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sort_key[a] > sort_key[b]; });
+
+	vector<GLuint> sorted;
+	sorted.reserve(index_count);
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		size_t c = order[i];
+		size_t start = clusters[c];
+		size_t end = (c + 1 < clusters.size()) ? clusters[c + 1] : triangle_count;
+		sorted.insert(sorted.end(), indices + 3 * start, indices + 3 * end);
+	}
+	copy(sorted.begin(), sorted.end(), indices);
+}
+
+
+static const GLuint unused = ~GLuint(0);
+
+/* Run both triangle passes on a range with its vertices renumbered from zero.
+   local_id is a scratch array over all the vertices that must be all unused */
+static void optimizeRange(GLuint* range, size_t count, const mesh_vertex* vertices, vector<GLuint>& local_id)
+{
+	vector<GLuint> global_id;
+	vector<GLuint> local_indices(count);
+	vector<vec3> positions;
+	vector<size_t> clusters;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		GLuint v = range[i];
+		if (local_id[v] == unused)
+		{
+			local_id[v] = GLuint(global_id.size());
+			global_id.push_back(v);
+			const GLfloat* p = vertices[v].position;
+			positions.push_back(vec3(p[0], p[1], p[2]));
+		}
+		local_indices[i] = local_id[v];
+	}
+
+	tipsify(local_indices.data(), count, global_id.size(), clusters);
+	optimizeOverdraw(local_indices.data(), count, global_id.size(), positions, clusters);
+
+	for (size_t i = 0; i < count; i++) range[i] = global_id[local_indices[i]];
+	for (size_t v = 0; v < global_id.size(); v++) local_id[global_id[v]] = unused;
+}
+
+
+void optimizeTriangleOrder(GLuint* indices, size_t index_count, const mesh_vertex* vertices, size_t vertex_count)
+{
+	vector<GLuint> local_id(vertex_count, unused);
+	optimizeRange(indices, index_count, vertices, local_id);
+}
+
+
+void optimizeMesh(mesh_data& mesh, vertex_cache_stats& before, vertex_cache_stats& after)
+{
+	before = analyzeVertexCache(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size());
+
+	// Each sub-mesh is optimised on its own
+	vector<GLuint> local_id(mesh.vertices.size(), unused);
+	for (size_t s = 0; s < mesh.submeshes.size(); s++)
+	{
+		optimizeRange(mesh.indices.data() + mesh.submeshes[s].first_index, mesh.submeshes[s].index_count,
+			mesh.vertices.data(), local_id);
+	}
+
+	// Renumber the vertices in the order they are first used
+	vector<GLuint> remap(mesh.vertices.size(), unused);
+	vector<mesh_vertex> vertices;
+	vertices.reserve(mesh.vertices.size());
+	for (size_t i = 0; i < mesh.indices.size(); i++)
+	{
+		GLuint& v = mesh.indices[i];
+		if (remap[v] == unused)
+		{
+			remap[v] = GLuint(vertices.size());
+			vertices.push_back(mesh.vertices[v]);
+		}
+		v = remap[v];
+	}
+
+	// Keep any vertices no triangle uses at the end
+	for (size_t v = 0; v < mesh.vertices.size(); v++)
+	{
+		if (remap[v] == unused) vertices.push_back(mesh.vertices[v]);
+	}
+	mesh.vertices.swap(vertices);
+
+	after = analyzeVertexCache(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size());
+}
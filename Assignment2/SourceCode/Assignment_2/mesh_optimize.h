@@ -0,0 +1,34 @@
+/* mesh_optimize.h
+   Load time reordering of an indexed mesh, run by the obj loader before the mesh is cached:
+	 1. triangles are reordered for the post-transform vertex cache (Tipsify),
+	 2. clusters of those triangles are sorted so outward facing ones draw first, which
+		reduces overdraw from any view direction,
+	 3. vertices are reordered into the order the index buffer first uses them, so vertex
+		fetch walks the vertex buffer forwards.
+   Triangles are only moved within their sub-mesh, so the sub-mesh ranges stay valid.
+*/
+
+#pragma once
+
+#include "mesh_cache.h"
+
+// Vertex cache efficiency of a mesh, simulated with a FIFO cache
+struct vertex_cache_stats
+{
+	float acmr;		// Average cache miss ratio: vertices transformed per triangle (0.5 is ideal)
+	float atvr;		// Average transform to vertex ratio: vertices transformed per vertex (1 is ideal)
+};
+
+// Size of the FIFO cache the optimisation and stats assume
+const unsigned vertex_cache_size = 16;
+
+// Allow the overdraw pass to worsen the cache miss ratio by this factor
+const float overdraw_threshold = 1.05f;
+
+vertex_cache_stats analyzeVertexCache(const GLuint* indices, size_t index_count, size_t vertex_count);
+
+// Reorder the mesh in place, giving the cache stats from before and after
+void optimizeMesh(mesh_data& mesh, vertex_cache_stats& before, vertex_cache_stats& after);
+
+// Only the triangle passes, on one range of indices whose vertices must not be moved
+void optimizeTriangleOrder(GLuint* indices, size_t index_count, const mesh_vertex* vertices, size_t vertex_count);
@@ -0,0 +1,178 @@
+/* mesh_quantize.cpp
+   Octahedral normal encoding projects the unit sphere onto an octahedron and unfolds that
+   into a square, which spreads the precision of the two bytes evenly over all directions.
+   Of the four neighbouring byte pairs the one that decodes closest to the normal is kept,
+   rather than just rounding each component.
+*/
+
+#include "mesh_quantize.h"
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+using namespace glm;
+
+GLushort floatToHalf(float f)
+{
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(bits));
+	GLushort sign = GLushort((bits >> 16) & 0x8000);
+	uint32_t magnitude = bits & 0x7fffffff;
+
+	// Infinity and NaN, keeping NaNs as NaNs
+	if (magnitude >= 0x7f800000) return sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0);
+
+	// Too large for a half
+	if (magnitude >= 0x47800000) return sign | 0x7c00;
+
+	// Below the smallest normal half, round to a denormal
+	if (magnitude < 0x38800000)
+	{
+		if (magnitude < 0x33000000) return sign;
+
+		uint32_t exponent = magnitude >> 23;
+		uint32_t mantissa = (magnitude & 0x7fffff) | 0x800000;
+		uint32_t shift = 126 - exponent;
+		uint32_t rounded = (mantissa + (1u << (shift - 1)) - 1 + ((mantissa >> shift) & 1)) >> shift;
+		return sign | GLushort(rounded);
+	}
+
+	// Rebias the exponent and round the mantissa to nearest even. A carry out of
+	// the mantissa correctly moves to the next exponent, or to infinity
+	uint32_t half = (magnitude - 0x38000000) >> 13;
+	uint32_t remainder = magnitude & 0x1fff;
+	if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) half++;
+	return sign | GLushort(half);
+}
+
+
+float halfToFloat(GLushort h)
+{
+	uint32_t sign = uint32_t(h & 0x8000) << 16;
+	uint32_t exponent = (h >> 10) & 0x1f;
+	uint32_t mantissa = h & 0x3ff;
+
+	if (exponent == 0)
+	{
+		float f = ldexp(float(mantissa), -24);
+		return sign ? -f : f;
+	}
+
+	uint32_t bits;
+	if (exponent == 31)
+		bits = sign | 0x7f800000 | (mantissa << 13);
+	else
+		bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+
+static GLbyte toSnorm8(float v)
+{
+	return GLbyte(glm::clamp(v, -127.f, 127.f));
+}
+
+static vec2 octProject(vec3 n)
+{
+	vec2 p = vec2(n.x, n.y) / (fabs(n.x) + fabs(n.y) + fabs(n.z));
+	if (n.z < 0.f)
+	{
+		vec2 signs(p.x >= 0.f ? 1.f : -1.f, p.y >= 0.f ? 1.f : -1.f);
+		p = (vec2(1.f) - abs(vec2(p.y, p.x))) * signs;
+	}
+	return p;
+}
+
+
+void octEncode(vec3 n, GLbyte encoded[2])
+{
+	float len = length(n);
+	if (len == 0.f)
+	{
+		encoded[0] = encoded[1] = 0;
+		return;
+	}
+	n /= len;
+
+	vec2 p = octProject(n) * 127.f;
+	float best = -2.f;
+	for (int i = 0; i < 4; i++)
+	{
+		GLbyte candidate[2] = {
+			toSnorm8((i & 1) ? ceil(p.x) : floor(p.x)),
+			toSnorm8((i & 2) ? ceil(p.y) : floor(p.y))
+		};
+		float d = dot(octDecode(candidate), n);
+		if (d > best)
+		{
+			best = d;
+			encoded[0] = candidate[0];
+			encoded[1] = candidate[1];
+		}
+	}
+}
+
+
+/* Matches octDecode() in object_quantized.vert, with the bytes normalised as GL does */
+vec3 octDecode(const GLbyte encoded[2])
+{
+	vec2 e(std::max(encoded[0] / 127.f, -1.f), std::max(encoded[1] / 127.f, -1.f));
+	vec3 n(e.x, e.y, 1.f - fabs(e.x) - fabs(e.y));
+	if (n.z < 0.f)
+	{
+		vec2 signs(n.x >= 0.f ? 1.f : -1.f, n.y >= 0.f ? 1.f : -1.f);
+		vec2 xy = (vec2(1.f) - abs(vec2(n.y, n.x))) * signs;
+		n.x = xy.x;
+		n.y = xy.y;
+	}
+	return normalize(n);
+}
+
+
+void quantizeVertices(const mesh_vertex* vertices, size_t count, vec3 bounds_min, vec3 bounds_max,
+	quantized_vertex* out, vec3& decode_scale, vec3& decode_offset, quantization_error& error)
+{
+	decode_offset = bounds_min;
+	decode_scale = bounds_max - bounds_min;
+
+	// A flat axis has no extent to encode, every vertex sits at the offset
+	vec3 encode_scale;
+	for (int c = 0; c < 3; c++)
+	{
+		encode_scale[c] = (decode_scale[c] > 0.f) ? 65535.f / decode_scale[c] : 0.f;
+	}
+
+	error.position = error.normal_degrees = error.texcoord = 0.f;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		const mesh_vertex& v = vertices[i];
+		quantized_vertex& q = out[i];
+
+		vec3 p(v.position[0], v.position[1], v.position[2]);
+		vec3 encoded = glm::clamp((p - decode_offset) * encode_scale, vec3(0.f), vec3(65535.f)) + 0.5f;
+		for (int c = 0; c < 3; c++) q.position[c] = GLushort(encoded[c]);
+
+		vec3 decoded = vec3(q.position[0], q.position[1], q.position[2]) / 65535.f * decode_scale + decode_offset;
+		error.position = std::max(error.position, length(decoded - p));
+
+		// Missing normals were left as zero, they stay unusable either way
+		vec3 n(v.normal[0], v.normal[1], v.normal[2]);
+		octEncode(n, q.normal);
+		if (length(n) > 0.f)
+		{
+			float d = glm::clamp(dot(octDecode(q.normal), normalize(n)), -1.f, 1.f);
+			error.normal_degrees = std::max(error.normal_degrees, degrees(acos(d)));
+		}
+
+		for (int c = 0; c < 2; c++)
+		{
+			q.texcoord[c] = floatToHalf(v.texcoord[c]);
+			error.texcoord = std::max(error.texcoord, fabs(halfToFloat(q.texcoord[c]) - v.texcoord[c]));
+		}
+	}
+}
@@ -0,0 +1,40 @@
+/* mesh_quantize.h
+   Compressed vertex format for loaded meshes, 12 bytes a vertex instead of the 32 of
+   mesh_vertex:
+	 position	3 x 16 bit unsigned normalised, within the mesh bounds
+	 normal		2 x 8 bit signed normalised, octahedral encoded
+	 texcoord	2 x half float
+   object_quantized.vert decodes it, rebuilding positions as position * pos_scale + pos_offset.
+*/
+
+#pragma once
+
+#include "wrapper_glfw.h"
+#include "mesh_cache.h"
+#include <glm/glm.hpp>
+
+struct quantized_vertex
+{
+	GLushort position[3];
+	GLbyte normal[2];
+	GLushort texcoord[2];
+};
+
+// The largest errors measured over the quantized vertices
+struct quantization_error
+{
+	float position;			// Distance in model units
+	float normal_degrees;	// Angle between the original and decoded normals
+	float texcoord;
+};
+
+// Quantize count vertices into out. Positions are encoded within [bounds_min, bounds_max],
+// which must contain every vertex, and decode_scale and decode_offset are set to rebuild them
+void quantizeVertices(const mesh_vertex* vertices, size_t count, glm::vec3 bounds_min, glm::vec3 bounds_max,
+	quantized_vertex* out, glm::vec3& decode_scale, glm::vec3& decode_offset, quantization_error& error);
+
+// Conversions used by the format, round to nearest
+GLushort floatToHalf(float f);
+float halfToFloat(GLushort h);
+void octEncode(glm::vec3 n, GLbyte encoded[2]);
+glm::vec3 octDecode(const GLbyte encoded[2]);
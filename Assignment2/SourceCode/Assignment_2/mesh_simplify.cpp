@@ -0,0 +1,323 @@
+/* mesh_simplify.cpp
+   Each vertex has a quadric that sums the squared distance to the planes of its triangles.
+   The cost of collapsing vertex a onto b is a's quadric measured at b, and b takes on a's
+   quadric afterwards, so the cost grows with the surface already removed around it.
+
+   Collapses are made in passes: every candidate edge is costed and sorted, then the
+   cheapest are collapsed until the target is reached. A collapse marks the vertices of the
+   triangles around it as touched, and touched vertices wait for the next pass, so the
+   checks made against the current triangles stay valid within a pass.
+*/
+
+#include "mesh_simplify.h"
+#include "mesh_optimize.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+using namespace glm;
+
+// Symmetric 4x4 matrix of a sum of plane equations (a, b, c, d)
+struct quadric
+{
+	double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+
+	void clear() { a2 = ab = ac = ad = b2 = bc = bd = c2 = cd = d2 = 0; }
+
+	void addPlane(dvec3 n, double d)
+	{
+		a2 += n.x * n.x; ab += n.x * n.y; ac += n.x * n.z; ad += n.x * d;
+		b2 += n.y * n.y; bc += n.y * n.z; bd += n.y * d;
+		c2 += n.z * n.z; cd += n.z * d;
+		d2 += d * d;
+	}
+
+	void add(const quadric& q)
+	{
+		a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+		b2 += q.b2; bc += q.bc; bd += q.bd;
+		c2 += q.c2; cd += q.cd;
+		d2 += q.d2;
+	}
+
+	// Sum of the squared distances from p to the planes
+	double error(dvec3 p) const
+	{
+		double e = a2 * p.x * p.x + 2 * ab * p.x * p.y + 2 * ac * p.x * p.z + 2 * ad * p.x
+			+ b2 * p.y * p.y + 2 * bc * p.y * p.z + 2 * bd * p.y
+			+ c2 * p.z * p.z + 2 * cd * p.z
+			+ d2;
+		return e > 0 ? e : 0;
+	}
+};
+
+struct collapse
+{
+	double cost;
+	GLuint from, to;
+
+	bool operator<(const collapse& c) const { return cost < c.cost; }
+};
+
+
+static vec3 vertexPosition(const mesh_vertex& v) { return vec3(v.position[0], v.position[1], v.position[2]); }
+static vec3 vertexNormal(const mesh_vertex& v) { return vec3(v.normal[0], v.normal[1], v.normal[2]); }
+
+
+/* Lock the vertices that share a position with another vertex (seams) and those on an
+   edge that isn't shared by exactly two triangles (borders and non-manifold edges) */
+static void findLockedVertices(const mesh_vertex* vertices, size_t vertex_count, const GLuint* indices, size_t index_count,
+	vector<bool>& locked)
+{
+	locked.assign(vertex_count, false);
+
+	vector<GLuint> by_position(vertex_count);
+	for (size_t v = 0; v < vertex_count; v++) by_position[v] = GLuint(v);
+	auto positionLess = [&](GLuint a, GLuint b)
+	{
+		const GLfloat* p = vertices[a].position;
+		const GLfloat* q = vertices[b].position;
+		return lexicographical_compare(p, p + 3, q, q + 3);
+	};
+	sort(by_position.begin(), by_position.end(), positionLess);
+	for (size_t i = 1; i < vertex_count; i++)
+	{
+		if (!positionLess(by_position[i - 1], by_position[i]))
+		{
+			locked[by_position[i - 1]] = true;
+			locked[by_position[i]] = true;
+		}
+	}
+
+	vector<uint64_t> edges;
+	edges.reserve(index_count);
+	for (size_t t = 0; t + 2 < index_count; t += 3)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			GLuint a = indices[t + c], b = indices[t + (c + 1) % 3];
+			edges.push_back((uint64_t(std::min(a, b)) << 32) | std::max(a, b));
+		}
+	}
+	sort(edges.begin(), edges.end());
+	for (size_t i = 0; i < edges.size();)
+	{
+		size_t run = i + 1;
+		while (run < edges.size() && edges[run] == edges[i]) run++;
+		if (run - i != 2)
+		{
+			locked[GLuint(edges[i] >> 32)] = true;
+			locked[GLuint(edges[i] & 0xffffffff)] = true;
+		}
+		i = run;
+	}
+}
+
+
+float simplifyTriangles(const mesh_vertex* vertices, size_t vertex_count, const GLuint* indices, size_t index_count,
+	size_t target_index_count, float max_error, vector<GLuint>& simplified)
+{
+	simplified.assign(indices, indices + index_count);
+
+	vector<bool> locked;
+	findLockedVertices(vertices, vertex_count, indices, index_count, locked);
+
+	vector<dvec3> positions(vertex_count);
+	for (size_t v = 0; v < vertex_count; v++) positions[v] = dvec3(vertexPosition(vertices[v]));
+
+	// Plane quadrics of the input triangles
+	vector<quadric> quadrics(vertex_count);
+	for (size_t v = 0; v < vertex_count; v++) quadrics[v].clear();
+	for (size_t t = 0; t + 2 < index_count; t += 3)
+	{
+		dvec3 p0 = positions[indices[t]], p1 = positions[indices[t + 1]], p2 = positions[indices[t + 2]];
+		dvec3 n = cross(p1 - p0, p2 - p0);
+		double len = length(n);
+		if (len == 0) continue;
+		n /= len;
+		for (int c = 0; c < 3; c++) quadrics[indices[t + c]].addPlane(n, -dot(n, p0));
+	}
+
+	const float min_normal_dot = cos(radians(simplify_max_normal_angle));
+	const double max_cost = double(max_error) * max_error;
+	double largest_cost = 0;
+
+	vector<GLuint> remap(vertex_count);
+	vector<bool> touched(vertex_count);
+	vector<GLuint> adjacency_start, adjacency;
+	vector<collapse> candidates;
+
+	while (simplified.size() > target_index_count)
+	{
+		size_t triangle_count = simplified.size() / 3;
+
+		// Triangles around each vertex
+		adjacency_start.assign(vertex_count + 1, 0);
+		for (size_t i = 0; i < simplified.size(); i++) adjacency_start[simplified[i] + 1]++;
+		for (size_t v = 0; v < vertex_count; v++) adjacency_start[v + 1] += adjacency_start[v];
+		adjacency.resize(simplified.size());
+		vector<GLuint> fill(adjacency_start.begin(), adjacency_start.end() - 1);
+		for (size_t t = 0; t < triangle_count; t++)
+		{
+			for (int c = 0; c < 3; c++) adjacency[fill[simplified[3 * t + c]]++] = GLuint(t);
+		}
+
+		// Cost both directions of every edge that can move
+		candidates.clear();
+		for (size_t t = 0; t < triangle_count; t++)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				GLuint a = simplified[3 * t + c], b = simplified[3 * t + (c + 1) % 3];
+				for (int dir = 0; dir < 2; dir++)
+				{
+					GLuint from = dir ? b : a, to = dir ? a : b;
+					if (locked[from]) continue;
+
+					vec3 n_from = vertexNormal(vertices[from]), n_to = vertexNormal(vertices[to]);
+					float lengths = length(n_from) * length(n_to);
+					if (lengths > 0.f && dot(n_from, n_to) < min_normal_dot * lengths) continue;
+
+					collapse candidate = { quadrics[from].error(positions[to]), from, to };
+					if (candidate.cost <= max_cost) candidates.push_back(candidate);
+				}
+			}
+		}
+		sort(candidates.begin(), candidates.end());
+
+		for (size_t v = 0; v < vertex_count; v++)
+		{
+			remap[v] = GLuint(v);
+			touched[v] = false;
+		}
+
+		size_t triangles_to_remove = (simplified.size() - target_index_count + 2) / 3;
+		size_t removed = 0;
+		size_t collapses = 0;
+		for (size_t i = 0; i < candidates.size() && removed < triangles_to_remove; i++)
+		{
+			GLuint from = candidates[i].from, to = candidates[i].to;
+			if (touched[from] || touched[to]) continue;
+
+			// Reject the collapse if any triangle that keeps its area would turn over
+			bool flips = false;
+			size_t degenerate = 0;
+			for (GLuint a = adjacency_start[from]; a < adjacency_start[from + 1] && !flips; a++)
+			{
+				const GLuint* tri = &simplified[3 * adjacency[a]];
+				if (tri[0] == to || tri[1] == to || tri[2] == to)
+				{
+					degenerate++;
+					continue;
+				}
+
+				dvec3 p[3], q[3];
+				for (int c = 0; c < 3; c++)
+				{
+					p[c] = positions[tri[c]];
+					q[c] = (tri[c] == from) ? positions[to] : p[c];
+				}
+				dvec3 before = cross(p[1] - p[0], p[2] - p[0]);
+				dvec3 after = cross(q[1] - q[0], q[2] - q[0]);
+				if (dot(before, after) <= 0.25 * length(before) * length(after)) flips = true;
+			}
+			if (flips) continue;
+
+			remap[from] = to;
+			quadrics[to].add(quadrics[from]);
+			largest_cost = std::max(largest_cost, candidates[i].cost);
+			removed += degenerate;
+			collapses++;
+
+			for (GLuint a = adjacency_start[from]; a < adjacency_start[from + 1]; a++)
+			{
+				const GLuint* tri = &simplified[3 * adjacency[a]];
+				for (int c = 0; c < 3; c++) touched[tri[c]] = true;
+			}
+		}
+
+		if (collapses == 0) break;
+
+		// Apply the collapses and drop the triangles that lost their area
+		size_t write = 0;
+		for (size_t t = 0; t < triangle_count; t++)
+		{
+			GLuint a = remap[simplified[3 * t]], b = remap[simplified[3 * t + 1]], c = remap[simplified[3 * t + 2]];
+			if (a == b || b == c || a == c) continue;
+			simplified[write++] = a;
+			simplified[write++] = b;
+			simplified[write++] = c;
+		}
+		simplified.resize(write);
+	}
+
+	return float(sqrt(largest_cost));
+}
+
+
+void buildLodChain(mesh_data& mesh, const vector<float>& ratios)
+{
+	float max_error = simplify_max_error * length(mesh.bounds_max - mesh.bounds_min);
+	size_t submesh_count = mesh.submeshes.size();
+
+	// The triangles of each sub-mesh at the current level
+	vector<vector<GLuint>> level(submesh_count);
+	for (size_t s = 0; s < submesh_count; s++)
+	{
+		const GLuint* first = mesh.indices.data() + mesh.submeshes[s].first_index;
+		level[s].assign(first, first + mesh.submeshes[s].index_count);
+	}
+	vector<vector<GLuint>> simplified(submesh_count);
+	float error = 0.f;
+
+	for (size_t i = 0; i < ratios.size(); i++)
+	{
+		// Each level starts from the one before, so the errors add up
+		float level_error = 0.f;
+		bool changed = false;
+		for (size_t s = 0; s < submesh_count; s++)
+		{
+			size_t target = size_t(mesh.submeshes[s].index_count / 3 * ratios[i]) * 3;
+			float submesh_error = simplifyTriangles(mesh.vertices.data(), mesh.vertices.size(), level[s].data(), level[s].size(),
+				target, std::max(max_error - error, 0.f), simplified[s]);
+			level_error = std::max(level_error, submesh_error);
+			changed = changed || simplified[s].size() != level[s].size();
+		}
+
+		// A level that couldn't remove anything shares the ranges of the one before, which
+		// for the first level are the full detail triangles
+		if (!changed)
+		{
+			mesh_lod lod = { 0, mesh.fullIndexCount(), error };
+			vector<mesh_submesh> previous(mesh.submeshes);
+			if (!mesh.lods.empty())
+			{
+				lod = mesh.lods.back();
+				previous.assign(mesh.lod_submeshes.end() - submesh_count, mesh.lod_submeshes.end());
+			}
+			mesh.lods.push_back(lod);
+			mesh.lod_submeshes.insert(mesh.lod_submeshes.end(), previous.begin(), previous.end());
+			continue;
+		}
+
+		error += level_error;
+
+		mesh_lod lod;
+		lod.first_index = GLuint(mesh.indices.size());
+		lod.error = error;
+		for (size_t s = 0; s < submesh_count; s++)
+		{
+			optimizeTriangleOrder(simplified[s].data(), simplified[s].size(), mesh.vertices.data(), mesh.vertices.size());
+
+			mesh_submesh submesh = mesh.submeshes[s];
+			submesh.first_index = GLuint(mesh.indices.size());
+			submesh.index_count = GLuint(simplified[s].size());
+			mesh.indices.insert(mesh.indices.end(), simplified[s].begin(), simplified[s].end());
+			mesh.lod_submeshes.push_back(submesh);
+
+			level[s].swap(simplified[s]);
+		}
+		lod.index_count = GLuint(mesh.indices.size()) - lod.first_index;
+		mesh.lods.push_back(lod);
+	}
+}
@@ -0,0 +1,35 @@
+/* mesh_simplify.h
+   Level of detail generation by quadric edge collapse (Garland and Heckbert 1997).
+   A vertex is only ever collapsed onto a neighbouring vertex that already exists, so
+   every level uses the full detail vertex buffer and only needs its own index buffer.
+
+   Vertices on a UV or normal seam (where the obj has several vertices at one position)
+   and on open or non-manifold edges are never moved, so seams and the outlines of open
+   parts are kept. Each material's triangles are simplified on their own, so the edges
+   between materials count as open and stay where they are. A collapse is also rejected
+   if it would flip a triangle, or if the two vertices' normals differ by more than
+   simplify_max_normal_angle.
+*/
+
+#pragma once
+
+#include "mesh_cache.h"
+#include <vector>
+
+// Largest angle in degrees between the normals of two vertices that can be collapsed together
+const float simplify_max_normal_angle = 45.f;
+
+// Largest error a level may have, as a fraction of the mesh's bounding box diagonal
+const float simplify_max_error = 0.05f;
+
+// Simplify the triangles towards target_index_count indices, giving the result in simplified.
+// Stops early rather than make a collapse with an error above max_error (in model units).
+// Returns the largest error of the collapses made
+float simplifyTriangles(const mesh_vertex* vertices, size_t vertex_count, const GLuint* indices, size_t index_count,
+	size_t target_index_count, float max_error, std::vector<GLuint>& simplified);
+
+// Add a level to mesh.lods for each ratio of the full detail triangle count, each simplified
+// from the one before and reordered for the vertex cache, with its sub-meshes in
+// mesh.lod_submeshes. A level that can't be simplified further shares the ranges of the
+// level before, or of the full detail triangles. The mesh must not have levels yet
+void buildLodChain(mesh_data& mesh, const std::vector<float>& ratios);
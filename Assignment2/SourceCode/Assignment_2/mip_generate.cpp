@@ -0,0 +1,254 @@
+/* mip_generate.cpp
+   Level 0 is converted once to 16 bit linear values, four channels per texel (RGB images
+   get an opaque alpha), and every level is filtered from the 16 bit level above rather
+   than from the 8 bit result, so the rounding doesn't build up down the chain. Each
+   texel is the average of its column pairs' averages, rounded up, which is what
+   _mm_avg_epu16 does, so the SSE2 and plain paths give the same results.
+
+   The conversions are table lookups whether or not the image is sRGB: 256 entries to
+   16 bits and 65536 back to 8.
+*/
+
+#include "mip_generate.h"
+#include "texture_cache.h"
+#include "thread_pool.h"
+#include "file_utils.h"
+#include "wrapper_glfw.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define MIP_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+/* Conversions between 8 and 16 bits, built the first time they are used */
+struct channel_tables
+{
+	uint16_t to_linear[256];		// sRGB to linear
+	uint16_t to_wide[256];			// Scaled, for channels that aren't sRGB
+	unsigned char to_srgb[65536];	// And back
+	unsigned char to_byte[65536];
+
+	channel_tables()
+	{
+		for (int i = 0; i < 256; i++)
+		{
+			double c = i / 255.0;
+			double linear = (c <= 0.04045) ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+			to_linear[i] = uint16_t(linear * 65535.0 + 0.5);
+			to_wide[i] = uint16_t(i * 257);
+		}
+		for (int i = 0; i < 65536; i++)
+		{
+			double linear = i / 65535.0;
+			double c = (linear <= 0.0031308) ? linear * 12.92 : 1.055 * pow(linear, 1.0 / 2.4) - 0.055;
+			to_srgb[i] = (unsigned char)(c * 255.0 + 0.5);
+			to_byte[i] = (unsigned char)(i / 257.0 + 0.5);
+		}
+	}
+};
+
+static const channel_tables& channelTables()
+{
+	static channel_tables tables;
+	return tables;
+}
+
+
+/* Rows [begin, end) of an 8 bit image into 16 bit linear RGBA */
+static void decodeRows(const unsigned char* source, int width, int channels, bool srgb, uint16_t* target, size_t begin, size_t end)
+{
+	const channel_tables& tables = channelTables();
+	const uint16_t* to_colour = srgb ? tables.to_linear : tables.to_wide;
+	for (size_t y = begin; y < end; y++)
+	{
+		const unsigned char* in = source + y * width * channels;
+		uint16_t* out = target + y * width * 4;
+		for (int x = 0; x < width; x++, in += channels, out += 4)
+		{
+			for (int c = 0; c < 3; c++) out[c] = to_colour[in[c]];
+			out[3] = (channels == 4) ? tables.to_wide[in[3]] : 65535;
+		}
+	}
+}
+
+
+/* Rows [begin, end) of the level below a 16 bit linear level, as 16 bit linear texels */
+static void filterRows(const uint16_t* source, int source_width, int source_height, uint16_t* target, int width,
+	bool simd, size_t begin, size_t end)
+{
+	for (size_t y = begin; y < end; y++)
+	{
+		const uint16_t* row0 = source + size_t(std::min(int(2 * y), source_height - 1)) * source_width * 4;
+		const uint16_t* row1 = source + size_t(std::min(int(2 * y + 1), source_height - 1)) * source_width * 4;
+		uint16_t* out = target + y * width * 4;
+
+		int x = 0;
+#ifdef MIP_SSE2
+		// Two texels of the target from four of each source row
+		if (simd && source_width >= 2)
+		{
+			for (; x + 1 < width; x += 2)
+			{
+				__m128i top0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + 8 * x));
+				__m128i top1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + 8 * x + 8));
+				__m128i bottom0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + 8 * x));
+				__m128i bottom1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + 8 * x + 8));
+				__m128i column0 = _mm_avg_epu16(top0, bottom0);
+				__m128i column1 = _mm_avg_epu16(top1, bottom1);
+				__m128i texels = _mm_avg_epu16(_mm_unpacklo_epi64(column0, column1), _mm_unpackhi_epi64(column0, column1));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4 * x), texels);
+			}
+		}
+#endif
+		for (; x < width; x++)
+		{
+			int x0 = std::min(2 * x, source_width - 1) * 4;
+			int x1 = std::min(2 * x + 1, source_width - 1) * 4;
+			for (int c = 0; c < 4; c++)
+			{
+				unsigned column0 = (row0[x0 + c] + row1[x0 + c] + 1u) >> 1;
+				unsigned column1 = (row0[x1 + c] + row1[x1 + c] + 1u) >> 1;
+				out[4 * x + c] = uint16_t((column0 + column1 + 1u) >> 1);
+			}
+		}
+	}
+}
+
+
+/* Rows [begin, end) of a 16 bit linear level back into 8 bit texels */
+static void encodeRows(const uint16_t* source, int width, int channels, bool srgb, unsigned char* target, size_t begin, size_t end)
+{
+	const channel_tables& tables = channelTables();
+	const unsigned char* to_colour = srgb ? tables.to_srgb : tables.to_byte;
+	for (size_t y = begin; y < end; y++)
+	{
+		const uint16_t* in = source + y * width * 4;
+		unsigned char* out = target + y * width * channels;
+		for (int x = 0; x < width; x++, in += 4, out += channels)
+		{
+			for (int c = 0; c < 3; c++) out[c] = to_colour[in[c]];
+			if (channels == 4) out[3] = tables.to_byte[in[3]];
+		}
+	}
+}
+
+
+/* Run body over the rows of a level, on the worker pool if parallel */
+static void forRows(int rows, int width, bool parallel, const function<void(size_t, size_t)>& body)
+{
+	if (parallel) worker_pool().parallel_for(rows, std::max(1, 16384 / width), body);
+	else body(0, rows);
+}
+
+
+static void buildMipChain(unsigned char* const* levels, int level_count, int width, int height, int channels, bool srgb,
+	bool simd, bool parallel)
+{
+	if (level_count < 2) return;
+
+	vector<uint16_t> current(size_t(width) * height * 4), next;
+	forRows(height, width, parallel, [&](size_t begin, size_t end)
+	{
+		decodeRows(levels[0], width, channels, srgb, current.data(), begin, end);
+	});
+
+	for (int l = 1; l < level_count; l++)
+	{
+		int source_width = std::max(width >> (l - 1), 1), source_height = std::max(height >> (l - 1), 1);
+		int level_width = std::max(width >> l, 1), level_height = std::max(height >> l, 1);
+		next.resize(size_t(level_width) * level_height * 4);
+
+		forRows(level_height, level_width, parallel, [&](size_t begin, size_t end)
+		{
+			filterRows(current.data(), source_width, source_height, next.data(), level_width, simd, begin, end);
+			encodeRows(next.data(), level_width, channels, srgb, levels[l], begin, end);
+		});
+		current.swap(next);
+	}
+}
+
+
+void generateMipChain(unsigned char* const* levels, int level_count, int width, int height, int channels, bool srgb)
+{
+	buildMipChain(levels, level_count, width, height, channels, srgb, true, true);
+}
+
+
+/* Each generator is timed on the whole chain below level 0, best of `repeats`. The GL
+   time includes a glFinish, since the driver can return before the levels are made */
+void benchmarkMipGeneration(const vector<string>& files, int repeats)
+{
+	const char* names[] = { "plain, 1 thread", "SSE2, 1 thread", "SSE2, threads", "SSE2, threads, no sRGB", "glGenerateMipmap" };
+	printf("%-24s %-24s %10s %12s\n", "file", "generator", "ms", "Mtexels/s");
+
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		mapped_file source;
+		decoded_image image;
+		if (!source.open(files[i]) || !decodeImage(source.data(), source.size(), files[i], image)) {
+			cerr << "Cannot open file [" << files[i] << "]" << endl;
+			continue;
+		}
+
+		// Every level of the chain in one buffer
+		int level_count = 1;
+		while ((std::max(image.width, image.height) >> level_count) > 0) level_count++;
+		vector<size_t> offsets(level_count + 1, 0);
+		for (int l = 0; l < level_count; l++)
+		{
+			offsets[l + 1] = offsets[l] + size_t(std::max(image.width >> l, 1)) * std::max(image.height >> l, 1) * image.nrChannels;
+		}
+		vector<unsigned char> chain(offsets[level_count]), reference;
+		vector<unsigned char*> levels(level_count);
+		for (int l = 0; l < level_count; l++) levels[l] = chain.data() + offsets[l];
+		memcpy(levels[0], image.data, offsets[1]);
+		double texels = (offsets[level_count] - offsets[1]) / double(image.nrChannels);
+
+		for (int generator = 0; generator < 5; generator++)
+		{
+			double best = 0;
+			for (int r = 0; r < repeats; r++)
+			{
+				auto start = chrono::high_resolution_clock::now();
+				if (generator < 4)
+				{
+					buildMipChain(levels.data(), level_count, image.width, image.height, image.nrChannels, generator != 3,
+						generator != 0, generator >= 2);
+				}
+				else
+				{
+					GLuint texture;
+					GLenum format = (image.nrChannels == 3) ? GL_RGB : GL_RGBA;
+					glGenTextures(1, &texture);
+					glBindTexture(GL_TEXTURE_2D, texture);
+					glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+					glTexImage2D(GL_TEXTURE_2D, 0, (image.nrChannels == 3) ? GL_RGB8 : GL_RGBA8, image.width, image.height, 0,
+						format, GL_UNSIGNED_BYTE, image.data);
+					glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+					glFinish();
+					start = chrono::high_resolution_clock::now();
+					glGenerateMipmap(GL_TEXTURE_2D);
+					glFinish();
+					glDeleteTextures(1, &texture);
+				}
+				double ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+				if (r == 0 || ms < best) best = ms;
+			}
+
+			printf("%-24s %-24s %10.2f %12.1f\n", files[i].c_str(), names[generator], best, texels / (best * 1000.0));
+
+			// The SSE2 path must match the plain one exactly
+			if (generator == 0) reference = chain;
+			if (generator == 1 && chain != reference) printf("%-24s SSE2 and plain mip chains differ\n", files[i].c_str());
+		}
+	}
+}
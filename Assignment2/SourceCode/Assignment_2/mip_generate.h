@@ -0,0 +1,23 @@
+/* mip_generate.h
+   Mip chains for RGB8 and RGBA8 images built on the CPU, so the baked textures
+   (texture_bake.h) don't depend on the quality or the speed of the driver's
+   glGenerateMipmap.
+
+   Each level is a 2x2 box filter of the level above. With srgb set the colour channels
+   are averaged in linear light, so fine bright detail doesn't darken as it shrinks;
+   alpha is always averaged as it is. The rows of each level are split across the worker
+   pool and, on x86, two texels are filtered at once with SSE2.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Fill in levels 1 to level_count - 1 of a mip chain from level 0. levels[l] points to
+// max(width >> l, 1) by max(height >> l, 1) tightly packed texels of channels (3 or 4) bytes
+void generateMipChain(unsigned char* const* levels, int level_count, int width, int height, int channels, bool srgb);
+
+// Time generateMipChain on each image, with and without SSE2 and threads, against
+// glGenerateMipmap. Needs a current GL context, for -benchmips
+void benchmarkMipGeneration(const std::vector<std::string>& files, int repeats);
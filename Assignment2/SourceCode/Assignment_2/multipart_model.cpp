@@ -0,0 +1,419 @@
+/* multipart_model.cpp
+   The parts' vertices are appended one after another and their indices are rebased
+   onto the combined vertex array, so no base vertex is needed to draw them. Indices
+   are stored as 16 bits if the whole model fits. Each part's simplified levels follow
+   its full detail indices, and every level has its own set of texture batches made
+   from the material ranges of all the parts.
+*/
+
+#include "multipart_model.h"
+#include <glm/gtc/type_ptr.hpp>
+#include <iostream>
+#include <cstddef>
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+using namespace glm;
+
+multipart_model::multipart_model()
+{
+	attribute_v_coord = 0;
+	attribute_v_normal = 1;
+	attribute_v_texcoord = 2;
+
+	vertexBufferObject = 0;
+	elementBufferObject = 0;
+	numVertices = 0;
+	numPIndexes = 0;
+	indexType = GL_UNSIGNED_INT;
+	bounds = boundsFromBox(vec3(0.f), vec3(0.f));
+
+	quantized = false;
+	decode_scale = vec3(1.f);
+	decode_offset = vec3(0.f);
+	error.position = error.normal_degrees = error.texcoord = 0.f;
+
+	TinyObjLoader defaults;
+	lod_ratios = defaults.lod_ratios;
+	stream_parse = defaults.stream_parse;
+	textures = defaults.textures;
+	use_atlas = true;
+}
+
+
+multipart_model::~multipart_model()
+{
+}
+
+
+void multipart_model::addPart(const string& inputfile, GLuint texture)
+{
+	model_part part;
+	part.inputfile = inputfile;
+	part.texture = texture;
+	part.first_vertex = part.vertex_count = 0;
+	part.first_index = part.index_count = 0;
+	part.texture_span = 0;
+	parts.push_back(part);
+}
+
+
+void multipart_model::load()
+{
+	// TinyObjLoader only provides the parsing here, the buffers are created by upload()
+	TinyObjLoader parser;
+	parser.lod_ratios = lod_ratios;
+	parser.stream_parse = stream_parse;
+	vector<parsed_obj> parsed(parts.size());
+	for (size_t i = 0; i < parts.size(); i++)
+	{
+		if (!parser.parse_obj(parts[i].inputfile, parsed[i])) {
+			exit(1);
+		}
+	}
+	prepareAtlas(parsed, textures->compression());
+	upload(parsed);
+}
+
+
+bool multipart_model::prepareAtlas(const vector<parsed_obj>& parsed, bool compress)
+{
+	if (!use_atlas) return false;
+
+	vector<string> files;
+	for (size_t i = 0; i < parsed.size(); i++)
+	{
+		const mesh_material* materials = parsed[i].cache.isOpen() ? parsed[i].cache.materials() : parsed[i].mesh.materials.data();
+		size_t count = parsed[i].cache.isOpen() ? parsed[i].cache.materialCount() : parsed[i].mesh.materials.size();
+		for (size_t m = 0; m < count; m++)
+		{
+			if (materials[m].diffuse_texname[0]) files.push_back(materials[m].diffuse_texname);
+		}
+	}
+
+	// One texture doesn't need an atlas
+	sort(files.begin(), files.end());
+	files.erase(unique(files.begin(), files.end()), files.end());
+	if (files.size() < 2) return false;
+	return atlas.build(files, parsed[0].inputfile + ".atlas.texcache", compress);
+}
+
+
+/* The square root of the ratio of a part's surface area to its texture coordinate area */
+static float textureSpan(const vector<mesh_vertex>& vertices, const vector<GLuint>& indices, GLuint first_index, GLuint index_count)
+{
+	double surface_area = 0, texcoord_area = 0;
+	for (GLuint i = first_index; i + 2 < first_index + index_count; i += 3)
+	{
+		const mesh_vertex& a = vertices[indices[i]];
+		const mesh_vertex& b = vertices[indices[i + 1]];
+		const mesh_vertex& c = vertices[indices[i + 2]];
+		vec3 edge1 = make_vec3(b.position) - make_vec3(a.position);
+		vec3 edge2 = make_vec3(c.position) - make_vec3(a.position);
+		surface_area += 0.5 * length(cross(edge1, edge2));
+		vec2 uv1 = make_vec2(b.texcoord) - make_vec2(a.texcoord);
+		vec2 uv2 = make_vec2(c.texcoord) - make_vec2(a.texcoord);
+		texcoord_area += 0.5 * std::abs(uv1.x * uv2.y - uv1.y * uv2.x);
+	}
+	return (texcoord_area > 0) ? float(sqrt(surface_area / texcoord_area)) : 0.f;
+}
+
+
+/* Move a part's texture coordinates into the atlas. This only works if every material
+   of the part has a diffuse map in the atlas, no vertex is shared by materials with
+   different maps and every coordinate is in [0, 1], as the atlas can't repeat a map */
+bool multipart_model::remapToAtlas(const model_part& part, vector<mesh_vertex>& vertices, const vector<GLuint>& indices) const
+{
+	if (part.submeshes.empty()) return false;
+
+	vector<int> vertex_entry(part.vertex_count, -1);
+	for (size_t s = 0; s < part.submeshes.size(); s++)
+	{
+		const mesh_submesh& submesh = part.submeshes[s];
+		if (submesh.material >= part.materials.size()) return false;
+		int entry = atlas.find(part.materials[submesh.material].diffuse_texname);
+		if (entry < 0) return false;
+
+		for (GLuint i = submesh.first_index; i < submesh.first_index + submesh.index_count; i++)
+		{
+			int& used = vertex_entry[indices[i] - part.first_vertex];
+			if (used >= 0 && used != entry) return false;
+			used = entry;
+		}
+	}
+
+	const GLfloat margin = 1e-4f;
+	for (GLuint v = 0; v < part.vertex_count; v++)
+	{
+		const GLfloat* texcoord = vertices[part.first_vertex + v].texcoord;
+		if (vertex_entry[v] >= 0 && (texcoord[0] < -margin || texcoord[0] > 1.f + margin || texcoord[1] < -margin || texcoord[1] > 1.f + margin)) return false;
+	}
+
+	for (GLuint v = 0; v < part.vertex_count; v++)
+	{
+		if (vertex_entry[v] >= 0) atlas.remap(vertex_entry[v], vertices[part.first_vertex + v].texcoord);
+	}
+	return true;
+}
+
+
+void multipart_model::upload(vector<parsed_obj>& parsed)
+{
+	vector<mesh_vertex> vertices;
+	vector<GLuint> indices;
+	size_t atlas_parts = 0;
+
+	for (size_t i = 0; i < parts.size(); i++)
+	{
+		model_part& part = parts[i];
+		const parsed_obj& obj = parsed[i];
+		part.first_vertex = GLuint(vertices.size());
+		part.first_index = GLuint(indices.size());
+
+		GLuint full_count;
+		if (obj.cache.isOpen())
+		{
+			const mesh_cache_view& cache = obj.cache;
+			vertices.insert(vertices.end(), cache.vertices(), cache.vertices() + cache.vertexCount());
+			if (cache.indexSize() == 2)
+			{
+				const GLushort* cached = static_cast<const GLushort*>(cache.indices());
+				for (GLuint j = 0; j < cache.indexCount(); j++) indices.push_back(part.first_vertex + cached[j]);
+			}
+			else
+			{
+				const GLuint* cached = static_cast<const GLuint*>(cache.indices());
+				for (GLuint j = 0; j < cache.indexCount(); j++) indices.push_back(part.first_vertex + cached[j]);
+			}
+			full_count = cache.fullIndexCount();
+			part.lods.assign(cache.lods(), cache.lods() + cache.lodCount());
+			part.materials.assign(cache.materials(), cache.materials() + cache.materialCount());
+			part.submeshes.assign(cache.submeshes(), cache.submeshes() + cache.submeshCount());
+			part.lod_submeshes.assign(cache.lodSubmeshes(), cache.lodSubmeshes() + cache.lodCount() * cache.submeshCount());
+		}
+		else
+		{
+			const mesh_data& mesh = obj.mesh;
+			vertices.insert(vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+			for (size_t j = 0; j < mesh.indices.size(); j++) indices.push_back(part.first_vertex + mesh.indices[j]);
+			full_count = mesh.fullIndexCount();
+			part.lods = mesh.lods;
+			part.materials = mesh.materials;
+			part.submeshes = mesh.submeshes;
+			part.lod_submeshes = mesh.lod_submeshes;
+		}
+
+		part.vertex_count = GLuint(vertices.size()) - part.first_vertex;
+		part.index_count = full_count;
+		for (size_t l = 0; l < part.lods.size(); l++) part.lods[l].first_index += part.first_index;
+		for (size_t s = 0; s < part.submeshes.size(); s++) part.submeshes[s].first_index += part.first_index;
+		for (size_t s = 0; s < part.lod_submeshes.size(); s++) part.lod_submeshes[s].first_index += part.first_index;
+
+		// The atlas is uploaded by the first part that uses it
+		bool in_atlas = atlas.isBuilt() && remapToAtlas(part, vertices, indices);
+		part.texture_span = textureSpan(vertices, indices, part.first_index, part.index_count);
+		if (in_atlas)
+		{
+			if (!atlas.texture) atlas.upload(*textures);
+			part.material_textures.assign(part.materials.size(), atlas.texture);
+			atlas_parts++;
+			continue;
+		}
+
+		part.material_textures.assign(part.materials.size(), part.texture);
+		for (size_t m = 0; m < part.materials.size(); m++)
+		{
+			GLuint texture = part.materials[m].diffuse_texname[0] ? textures->load(part.materials[m].diffuse_texname) : 0;
+			if (!texture) continue;
+			part.material_textures[m] = texture;
+			cache_textures.push_back(texture);
+		}
+	}
+
+	if (atlas.texture)
+	{
+		cout << "Texture atlas of " << atlas.entries.size() << " maps: " << atlas.width << " x " << atlas.height << ", "
+			<< atlas.levels << " mip levels" << (atlas.from_bake ? " from its bake" : "") << ", used by " << atlas_parts
+			<< " of " << parts.size() << " parts" << endl;
+	}
+
+	bounds = computeBounds(vertices.empty() ? 0 : vertices.data()->position, vertices.size(), sizeof(mesh_vertex) / sizeof(GLfloat));
+
+	numVertices = GLuint(vertices.size());
+	numPIndexes = GLuint(indices.size());
+
+	// The model has the levels every part has, with the largest error of its parts
+	size_t levels = 0;
+	for (size_t i = 0; i < parts.size(); i++)
+	{
+		if (i == 0 || parts[i].lods.size() < levels) levels = parts[i].lods.size();
+	}
+	lod_errors.assign(levels + 1, 0.f);
+	for (size_t i = 0; i < parts.size(); i++)
+	{
+		for (size_t l = 0; l < levels; l++) lod_errors[l + 1] = std::max(lod_errors[l + 1], parts[i].lods[l].error);
+	}
+
+	glGenBuffers(1, &vertexBufferObject);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBufferObject);
+	if (quantized)
+	{
+		vector<quantized_vertex> packed(vertices.size());
+		quantizeVertices(vertices.data(), vertices.size(), bounds.min, bounds.max, packed.data(), decode_scale, decode_offset, error);
+		glBufferData(GL_ARRAY_BUFFER, packed.size() * sizeof(quantized_vertex), packed.data(), GL_STATIC_DRAW);
+
+		cout << "Quantized vertices: " << vertices.size() * sizeof(mesh_vertex) / 1024 << " KB -> "
+			<< packed.size() * sizeof(quantized_vertex) / 1024 << " KB, largest errors: position " << error.position
+			<< ", normal " << error.normal_degrees << " degrees, texcoord " << error.texcoord << endl;
+	}
+	else
+	{
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(mesh_vertex), vertices.data(), GL_STATIC_DRAW);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	// Use 16 bit indices when they fit, halving the index buffer size
+	GLuint indexSize;
+	glGenBuffers(1, &elementBufferObject);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBufferObject);
+	if (useShortIndices(numVertices))
+	{
+		vector<GLushort> shortIndices(indices.begin(), indices.end());
+		indexType = GL_UNSIGNED_SHORT;
+		indexSize = sizeof(GLushort);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, shortIndices.size() * indexSize, shortIndices.data(), GL_STATIC_DRAW);
+	}
+	else
+	{
+		indexType = GL_UNSIGNED_INT;
+		indexSize = sizeof(GLuint);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * indexSize, indices.data(), GL_STATIC_DRAW);
+	}
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	// Group the parts' material ranges by texture, keeping the order the textures are first used in
+	batches.assign(levels + 1, vector<draw_batch>());
+	size_t ranges = 0;
+	for (size_t l = 0; l <= levels; l++)
+	{
+		for (size_t i = 0; i < parts.size(); i++)
+		{
+			const model_part& part = parts[i];
+			size_t submesh_count = part.submeshes.size();
+			const mesh_submesh* level = (l == 0) ? part.submeshes.data() : part.lod_submeshes.data() + (l - 1) * submesh_count;
+			for (size_t s = 0; s < submesh_count; s++)
+			{
+				GLuint texture = (level[s].material < part.material_textures.size()) ? part.material_textures[level[s].material] : part.texture;
+				addDrawRange(batches[l], texture, level[s].first_index, level[s].index_count, indexSize);
+			}
+			if (l == 0) ranges += submesh_count;
+		}
+	}
+
+	cout << "Model of " << parts.size() << " parts: " << numVertices << " vertices, " << numPIndexes << " indices, "
+		<< ranges << " material ranges in " << batches[0].size() << " draw calls" << endl;
+	for (int l = 0; l <= lodCount(); l++)
+	{
+		cout << "  LOD " << l << ": " << triangleCount(l) << " triangles, error " << lod_errors[l] << endl;
+	}
+}
+
+
+int multipart_model::selectLod(float pixels_per_unit, float max_pixel_error) const
+{
+	for (int l = lodCount(); l > 0; l--)
+	{
+		if (lod_errors[l] * pixels_per_unit <= max_pixel_error) return l;
+	}
+	return 0;
+}
+
+
+void multipart_model::requestTextures(float pixels_per_unit) const
+{
+	for (size_t i = 0; i < parts.size(); i++)
+	{
+		float screen_size = parts[i].texture_span * pixels_per_unit;
+		for (size_t m = 0; m < parts[i].material_textures.size(); m++)
+		{
+			if (parts[i].material_textures[m]) textures->request(parts[i].material_textures[m], screen_size);
+		}
+	}
+}
+
+
+GLuint multipart_model::triangleCount(int lod) const
+{
+	GLuint count = 0;
+	for (size_t i = 0; i < parts.size(); i++)
+	{
+		count += (lod == 0) ? parts[i].index_count : parts[i].lods[lod - 1].index_count;
+	}
+	return count / 3;
+}
+
+
+void multipart_model::drawObject(int drawmode, int lod)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBufferObject);
+	if (quantized)
+	{
+		// Positions and normals are normalised, object_quantized.vert decodes them
+		GLsizei stride = sizeof(quantized_vertex);
+		glVertexAttribPointer(attribute_v_coord, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)offsetof(quantized_vertex, position));
+		glVertexAttribPointer(attribute_v_normal, 2, GL_BYTE, GL_TRUE, stride, (void*)offsetof(quantized_vertex, normal));
+		glVertexAttribPointer(attribute_v_texcoord, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void*)offsetof(quantized_vertex, texcoord));
+	}
+	else
+	{
+		GLsizei stride = sizeof(mesh_vertex);
+		glVertexAttribPointer(attribute_v_coord, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(mesh_vertex, position));
+		glVertexAttribPointer(attribute_v_normal, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(mesh_vertex, normal));
+		glVertexAttribPointer(attribute_v_texcoord, 2, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(mesh_vertex, texcoord));
+	}
+	glEnableVertexAttribArray(attribute_v_coord);
+	glEnableVertexAttribArray(attribute_v_normal);
+	glEnableVertexAttribArray(attribute_v_texcoord);
+
+	glPointSize(3.f);
+
+	// Enable this line to show model in wireframe
+	if (drawmode == 1)
+		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+	else
+		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+	if (drawmode == 2)
+	{
+		// Each part's vertices are a contiguous range of the vertex buffer
+		for (size_t i = 0; i < parts.size(); i++)
+		{
+			GLuint texture = parts[i].material_textures.empty() ? parts[i].texture : parts[i].material_textures[0];
+			if (texture) glBindTexture(GL_TEXTURE_2D, texture);
+			glDrawArrays(GL_POINTS, parts[i].first_vertex, parts[i].vertex_count);
+		}
+	}
+	else
+	{
+		if (lod < 0 || lod > lodCount()) lod = 0;
+		const vector<draw_batch>& level = batches[lod];
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBufferObject);
+		for (size_t b = 0; b < level.size(); b++)
+		{
+			if (level[b].texture) glBindTexture(GL_TEXTURE_2D, level[b].texture);
+			glMultiDrawElements(GL_TRIANGLES, level[b].counts.data(), indexType,
+				level[b].offsets.data(), GLsizei(level[b].counts.size()));
+		}
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+}
+
+
+void multipart_model::releaseTextures()
+{
+	for (size_t i = 0; i < cache_textures.size(); i++) textures->release(cache_textures[i]);
+	cache_textures.clear();
+	atlas.release(*textures);
+}
@@ -0,0 +1,122 @@
+/* multipart_model.h
+   A model made of several obj files (parts) that share one interleaved vertex buffer
+   and one index buffer. Each part's materials are textured with the diffuse maps from
+   its .mtl files, or with the part's own texture for materials without one. The whole
+   model is drawn with one set of buffer binds and one draw call per texture (a
+   glMultiDrawElements over the material ranges that use it), so the caller only sends
+   the model uniforms once and each texture is only bound once.
+
+   With use_atlas set (the default), the diffuse maps are packed into one texture atlas
+   (texture_atlas.h) while the parts are parsed, baked to <first part>.atlas.texcache,
+   and the texture coordinates of every part that can be are moved into it, so a model
+   whose parts all fit is drawn with one texture and one draw call.
+
+   Parts are added with addPart() and then loaded together, either with load() or
+   concurrently through asset_loader::loadModel().
+
+   If quantized is set before loading, the vertices are stored in the 12 byte format of
+   mesh_quantize.h and the model must be drawn with object_quantized.vert, passing
+   decode_scale and decode_offset as pos_scale and pos_offset.
+
+   Every part carries the simplified levels built by the obj loader, and the model can be
+   drawn at any level all its parts have. selectLod() picks the coarsest level whose
+   error stays under a pixel on screen, and requestTextures() asks the texture cache for
+   the mip levels its textures need at that size.
+*/
+
+#pragma once
+
+#include "wrapper_glfw.h"
+#include "tiny_loader_texture.h"
+#include "mesh_quantize.h"
+#include "texture_atlas.h"
+#include <vector>
+#include <string>
+#include <glm/glm.hpp>
+
+// One obj file of the model and its range of the shared buffers
+struct model_part
+{
+	std::string inputfile;
+	GLuint texture;		// For the materials that have no diffuse map, 0 to use the caller's
+	GLuint first_vertex;
+	GLuint vertex_count;
+	GLuint first_index;
+	GLuint index_count;
+	std::vector<mesh_lod> lods;	// The part's simplified levels, in the shared index buffer
+	std::vector<mesh_material> materials;
+	std::vector<GLuint> material_textures;		// The texture each material is drawn with
+	std::vector<mesh_submesh> submeshes;		// The material ranges, in the shared index buffer
+	std::vector<mesh_submesh> lod_submeshes;	// The material ranges of each level in turn
+	float texture_span;		// Model units a whole texture covers on the part's surface, on average
+};
+
+class multipart_model
+{
+public:
+	multipart_model();
+	~multipart_model();
+
+	// Add an obj file to the model. Materials without a diffuse map are drawn with texture
+	void addPart(const std::string& inputfile, GLuint texture = 0);
+
+	// Parse every part and upload, exits if a part can't be loaded
+	void load();
+
+	// Build the atlas of the parsed parts' diffuse maps, if use_atlas is set, or load it
+	// from its bake next to the first part. compress is textures->compression(), read on
+	// the GL thread. Can be run on any thread, before upload(). False if there is no atlas
+	bool prepareAtlas(const std::vector<parsed_obj>& parsed, bool compress);
+
+	// Pack the parsed parts (in the order they were added) into the shared buffers.
+	// Must be called on the GL thread
+	void upload(std::vector<parsed_obj>& parsed);
+
+	// Draw at full detail (lod 0) or one of the simplified levels (1 to lodCount())
+	void drawObject(int drawmode, int lod = 0);
+
+	// Give the material textures back to the cache, while the GL context still exists.
+	// The model can't be drawn afterwards
+	void releaseTextures();
+
+	// The coarsest level whose error is at most max_pixel_error pixels, given how many
+	// pixels one model unit covers where the model is drawn
+	int selectLod(float pixels_per_unit, float max_pixel_error = 1.f) const;
+
+	// Request the mip levels of the model's textures for this frame from the cache, given
+	// how many pixels one model unit covers where the model is drawn
+	void requestTextures(float pixels_per_unit) const;
+
+	int lodCount() const { return int(lod_errors.size()) - 1; }
+	GLuint triangleCount(int lod) const;
+
+	std::vector<model_part> parts;
+	bounding_volume bounds;			// Of all the parts, set by upload
+	std::vector<float> lod_ratios;	// Passed to the obj loader for each part
+	bool stream_parse;				// Parse the parts with the obj loader's low memory streaming parser
+	std::vector<float> lod_errors;	// Largest error of any part at each level, in model units
+	texture_cache* textures;		// Where the diffuse maps are loaded, shared_textures() by default
+	bool use_atlas;					// Draw the parts from one atlas of their diffuse maps
+	texture_atlas atlas;
+
+	bool quantized;				// Store the vertices in the quantized format
+	glm::vec3 decode_scale;		// position * decode_scale + decode_offset for quantized vertices
+	glm::vec3 decode_offset;
+	quantization_error error;	// The largest quantization errors, measured at upload
+
+private:
+	bool remapToAtlas(const model_part& part, std::vector<mesh_vertex>& vertices, const std::vector<GLuint>& indices) const;
+
+	GLuint vertexBufferObject;
+	GLuint elementBufferObject;
+
+	GLuint attribute_v_coord;
+	GLuint attribute_v_normal;
+	GLuint attribute_v_texcoord;
+
+	GLuint numVertices;
+	GLuint numPIndexes;
+	GLenum indexType;
+	std::vector<std::vector<draw_batch>> batches;	// The batches of each level
+	std::vector<GLuint> cache_textures;				// The textures loaded for the materials, one per load
+};
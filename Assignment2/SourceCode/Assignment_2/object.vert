@@ -1,6 +1,7 @@
 // Vertex shader with Gouraud shading lighting (lighting calculated per vertex)
 // Designed to texture an object with lighting
-// No colour data as colour data assumed to be taked from texture
+// Colour is taken from the texture, multiplied by an optional per vertex colour
+// Positions can be stored in a packed format and rebuilt with pos_scale and pos_offset
 
 #version 420
 
@@ -8,9 +9,13 @@
 layout(location = 0) in vec3 position;
 layout(location = 1) in vec3 normal;
 layout(location = 2) in vec2 texcoord;
+layout(location = 3) in vec4 colour;
 // Uniform variables are passed in from the application
 uniform mat4 model, view, projection;
 uniform uint colourmode;
+uniform vec3 pos_scale = vec3(1.0);
+uniform vec3 pos_offset = vec3(0.0);
+uniform float fade_distance = 0.0;		// Fade out towards this distance from the origin, if not 0
 
 // Output the vertex colour - to be rasterized into pixel fragments
 out vec4 fcolour;
@@ -24,7 +29,7 @@ void main()
 {
 	vec4 specular_colour = vec4(1.0,1.0,1.0,1.0);
 	vec4 diffuse_colour = vec4(0.5,0.5,0,1.0);
-	vec4 position_h = vec4(position, 1.0);
+	vec4 position_h = vec4(position * pos_scale + pos_offset, 1.0);
 	float shininess = 8.0;
 	
 	diffuse_colour = vec4(1.0, 1.0, 1.0, 1.0);
@@ -44,7 +49,8 @@ void main()
 	vec4 specular = pow(max(dot(N, half_vec), 0.0), shininess) * specular_colour;
 
 	// Define the vertex colour
-	fcolour = vec4(diffuse, 1.0) + ambient + specular;
+	fcolour = (vec4(diffuse, 1.0) + ambient + specular) * colour;
+	if (fade_distance > 0.0) fcolour.a *= clamp(1.0 - length(position_h.xyz) / fade_distance, 0.0, 1.0);
 
 	// Define the vertex position
 	gl_Position = projection * view * model * position_h;
@@ -0,0 +1,74 @@
+// Vertex shader with Gouraud shading lighting (lighting calculated per vertex)
+// Designed to texture an object with lighting
+// Colour is taken from the texture, multiplied by an optional per vertex colour
+// Variant of object.vert for quantized meshes (see mesh_quantize.h): positions are 16 bit
+// unsigned normalised values rebuilt with pos_scale and pos_offset, normals are octahedral
+// encoded in two signed normalised bytes and texture coordinates are half floats
+
+#version 420
+
+// These are the vertex attributes
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec2 normal_oct;
+layout(location = 2) in vec2 texcoord;
+layout(location = 3) in vec4 colour;
+// Uniform variables are passed in from the application
+uniform mat4 model, view, projection;
+uniform uint colourmode;
+uniform vec3 pos_scale = vec3(1.0);
+uniform vec3 pos_offset = vec3(0.0);
+
+// Output the vertex colour - to be rasterized into pixel fragments
+out vec4 fcolour;
+
+// Output the  texture coordinate - just pass it through
+out vec2 ftexcoord;
+vec4 ambient = vec4(0.2, 0.2,0.2,1.0);
+vec3 light_dir = vec3(0.0, 0.0, 10.0);
+
+// Unfold the octahedron back onto the unit sphere
+vec3 octDecode(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0)
+	{
+		vec2 signs = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+		n.xy = (1.0 - abs(n.yx)) * signs;
+	}
+	return normalize(n);
+}
+
+void main()
+{
+	vec4 specular_colour = vec4(1.0,1.0,1.0,1.0);
+	vec4 diffuse_colour = vec4(0.5,0.5,0,1.0);
+	vec4 position_h = vec4(position * pos_scale + pos_offset, 1.0);
+	vec3 normal = octDecode(normal_oct);
+	float shininess = 8.0;
+	
+	diffuse_colour = vec4(1.0, 1.0, 1.0, 1.0);
+
+	ambient = diffuse_colour * 0.2;
+
+	mat4 mv_matrix = view * model;
+	mat3 normalmatrix = mat3(mv_matrix);
+	vec3 N = mat3(mv_matrix) * normal;
+	N = normalize(N);
+	light_dir = normalize(light_dir);
+
+	vec3 diffuse = max(dot(N, light_dir), 0.0) * diffuse_colour.xyz;
+
+	vec4 P = position_h * mv_matrix;
+	vec3 half_vec = normalize(light_dir + P.xyz);
+	vec4 specular = pow(max(dot(N, half_vec), 0.0), shininess) * specular_colour;
+
+	// Define the vertex colour
+	fcolour = (vec4(diffuse, 1.0) + ambient + specular) * colour;
+
+	// Define the vertex position
+	gl_Position = projection * view * model * position_h;
+
+	// Pass through the texture coordinate
+	ftexcoord = texcoord;
+}
+
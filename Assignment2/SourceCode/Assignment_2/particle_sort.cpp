@@ -0,0 +1,174 @@
+/* particle_sort.cpp
+   LSD radix sort of particle view depths, 8 bits per pass.
+   Each pass is split into chunks: every chunk counts its digits, a prefix sum over
+   (digit, chunk) gives each chunk its output offsets, then every chunk scatters its
+   own range. Scattering in chunk order keeps each pass stable, which LSD relies on.
+*/
+
+#include "particle_sort.h"
+#include "thread_pool.h"
+#include <cstring>
+#include <cfloat>
+#include <algorithm>
+
+using namespace std;
+using namespace glm;
+
+// Particles per chunk below which it isn't worth splitting the work
+static const size_t sort_min_chunk = 4096;
+
+particle_sorter::particle_sorter()
+{
+	key_bits = 32;
+}
+
+
+/* Map a float to an unsigned int with the same ordering */
+static inline GLuint sortableFloat(GLfloat f)
+{
+	GLuint u;
+	memcpy(&u, &f, sizeof(u));
+	return (u & 0x80000000u) ? ~u : (u | 0x80000000u);
+}
+
+
+/* Calculate a key per particle that sorts ascending from the farthest particle */
+void particle_sorter::makeKeys(const vec3* positions, GLuint count, const mat4& modelview)
+{
+	thread_pool& pool = worker_pool();
+
+	keys.resize(count);
+	keys_swap.resize(count);
+
+	// Only the view space z is needed, distance in front of the camera is -z
+	vec4 zrow(modelview[0][2], modelview[1][2], modelview[2][2], modelview[3][2]);
+
+	if (key_bits > 16)
+	{
+		pool.parallel_for(count, sort_min_chunk, [&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				GLfloat depth = -dot(zrow, vec4(positions[i], 1.f));
+				keys[i] = ~sortableFloat(depth);
+			}
+		});
+		return;
+	}
+
+	// For 16 bit keys find the depth range first then quantize within it
+	size_t num_chunks = pool.numChunks(count, sort_min_chunk);
+	vector<vec2> ranges(num_chunks, vec2(FLT_MAX, -FLT_MAX));
+	depths.resize(count);
+
+	pool.parallel_for(num_chunks, 1, [&](size_t cbegin, size_t cend)
+	{
+		for (size_t c = cbegin; c < cend; c++)
+		{
+			vec2 range = ranges[c];
+			for (size_t i = count * c / num_chunks; i < count * (c + 1) / num_chunks; i++)
+			{
+				GLfloat depth = -dot(zrow, vec4(positions[i], 1.f));
+				depths[i] = depth;
+				range.x = std::min(range.x, depth);
+				range.y = std::max(range.y, depth);
+			}
+			ranges[c] = range;
+		}
+	});
+
+	GLfloat dmin = FLT_MAX, dmax = -FLT_MAX;
+	for (size_t c = 0; c < num_chunks; c++)
+	{
+		dmin = std::min(dmin, ranges[c].x);
+		dmax = std::max(dmax, ranges[c].y);
+	}
+	GLfloat quantize = (dmax > dmin) ? 65535.f / (dmax - dmin) : 0.f;
+
+	pool.parallel_for(count, sort_min_chunk, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			keys[i] = 65535u - GLuint((depths[i] - dmin) * quantize);
+		}
+	});
+}
+
+
+void particle_sorter::radixSort(GLuint count, GLuint* indices)
+{
+	thread_pool& pool = worker_pool();
+
+	size_t num_chunks = pool.numChunks(count, sort_min_chunk);
+	histograms.resize(num_chunks * 256);
+	indices_swap.resize(count);
+
+	GLuint passes = (key_bits > 16) ? 4 : 2;
+
+	GLuint* src_keys = &keys[0];
+	GLuint* dst_keys = &keys_swap[0];
+	GLuint* src_indices = 0;	// The first pass reads the identity order
+
+	for (GLuint pass = 0; pass < passes; pass++)
+	{
+		GLuint shift = pass * 8;
+
+		// Alternate the index output so the last pass writes to the caller's array
+		GLuint* dst_indices = ((passes - 1 - pass) % 2 == 0) ? indices : &indices_swap[0];
+
+		// Count the digits in each chunk
+		pool.parallel_for(num_chunks, 1, [&](size_t cbegin, size_t cend)
+		{
+			for (size_t c = cbegin; c < cend; c++)
+			{
+				GLuint* hist = &histograms[c * 256];
+				memset(hist, 0, 256 * sizeof(GLuint));
+				for (size_t i = count * c / num_chunks; i < count * (c + 1) / num_chunks; i++)
+				{
+					hist[(src_keys[i] >> shift) & 0xFF]++;
+				}
+			}
+		});
+
+		// Turn the counts into output offsets, ordered by digit then chunk
+		GLuint offset = 0;
+		for (GLuint digit = 0; digit < 256; digit++)
+		{
+			for (size_t c = 0; c < num_chunks; c++)
+			{
+				GLuint n = histograms[c * 256 + digit];
+				histograms[c * 256 + digit] = offset;
+				offset += n;
+			}
+		}
+
+		// Scatter each chunk into its reserved slots
+		bool write_keys = (pass + 1 < passes);
+		pool.parallel_for(num_chunks, 1, [&](size_t cbegin, size_t cend)
+		{
+			for (size_t c = cbegin; c < cend; c++)
+			{
+				GLuint* hist = &histograms[c * 256];
+				for (size_t i = count * c / num_chunks; i < count * (c + 1) / num_chunks; i++)
+				{
+					GLuint key = src_keys[i];
+					GLuint pos = hist[(key >> shift) & 0xFF]++;
+					if (write_keys) dst_keys[pos] = key;
+					dst_indices[pos] = src_indices ? src_indices[i] : GLuint(i);
+				}
+			}
+		});
+
+		swap(src_keys, dst_keys);
+		src_indices = dst_indices;
+	}
+}
+
+
+void particle_sorter::sortBackToFront(const vec3* positions, GLuint count, const mat4& modelview, GLuint* indices)
+{
+	if (count == 0) return;
+
+	makeKeys(positions, count, modelview);
+	radixSort(count, indices);
+}
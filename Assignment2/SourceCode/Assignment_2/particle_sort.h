@@ -0,0 +1,35 @@
+/* particle_sort.h
+   Sorts particles back to front by view depth so that alpha blended sprites
+   composite in the correct order.
+
+   The sort doesn't move the particle data, it writes an index array (for use
+   as an element buffer) using a multi-threaded LSD radix sort on 16 or 32 bit keys.
+   16 bit keys quantize the depth range of the current frame and need half the passes.
+*/
+
+#pragma once
+
+#include "wrapper_glfw.h"
+#include <vector>
+#include <glm/glm.hpp>
+
+class particle_sorter
+{
+public:
+	particle_sorter();
+
+	// Write the indices of positions[0..count) into indices, farthest from the viewer first
+	void sortBackToFront(const glm::vec3* positions, GLuint count, const glm::mat4& modelview, GLuint* indices);
+
+	GLuint key_bits;		// 16 or 32
+
+private:
+	void makeKeys(const glm::vec3* positions, GLuint count, const glm::mat4& modelview);
+	void radixSort(GLuint count, GLuint* indices);
+
+	std::vector<GLuint> keys;
+	std::vector<GLuint> keys_swap;
+	std::vector<GLuint> indices_swap;
+	std::vector<GLfloat> depths;
+	std::vector<GLuint> histograms;		// 256 counters per chunk
+};
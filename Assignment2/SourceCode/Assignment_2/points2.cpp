@@ -4,16 +4,72 @@ Iain Martin
 November 2018
 */
 #include "points2.h"
-#include "glm/gtc/random.hpp"
+#include "terrain_object.h"
+#include "thread_pool.h"
+#include <cstring>
+#include <cstddef>
+#include <cmath>
 
 using namespace glm;
 
+// Particles per chunk of the parallel update
+static const size_t particle_min_chunk = 2048;
+
+/* Small xorshift generator so that each chunk of the parallel update has its own
+   random sequence, glm's random functions all share the rand() state */
+static inline GLuint nextRandom(GLuint& state)
+{
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+static inline GLfloat randRange(GLuint& state, GLfloat min, GLfloat max)
+{
+	return min + (max - min) * GLfloat(nextRandom(state) >> 8) * (1.f / 16777216.f);
+}
+
+// Uniform random point in a ball, as glm::ballRand
+static inline vec3 randBall(GLuint& state, GLfloat radius)
+{
+	vec3 p;
+	do
+	{
+		p = vec3(randRange(state, -radius, radius), randRange(state, -radius, radius), randRange(state, -radius, radius));
+	} while (dot(p, p) > radius * radius);
+	return p;
+}
+
+static inline GLuint seedRandom(GLuint a, GLuint b)
+{
+	GLuint s = a * 0x9E3779B9u + b * 0x85EBCA6Bu;
+	s ^= s >> 16;
+	s *= 0x7FEB352Du;
+	s ^= s >> 15;
+	return s ? s : 1;
+}
+
 /* Constructor, set initial parameters*/
 points2::points2(GLuint number, GLfloat dist, GLfloat sp)
 {
 	numpoints = number;
 	maxdist = dist;
 	speed = sp;
+	depth_sort = true;
+	additive = false;
+	collision = COLLIDE_NONE;
+	collision_terrain = 0;
+	local_to_world = mat4(1.f);
+	restitution = 0.4f;
+	repulsion = 0.f;
+	repulsion_radius = 0.02f;
+	max_neighbours = 16;
+	packed_vertices = false;
+	packed = 0;
+	updateBounds();
+	rng_state = seedRandom(number, 1);
+	step_count = 0;
 }
 
 
@@ -21,12 +77,31 @@ points2::~points2()
 {
 	delete [] colours;
 	delete[] vertices;
+	delete[] velocity;
+	delete[] prev_vertices;
+	delete[] draw_vertices;
+	delete[] sorted_indices;
+	delete[] ground_positions;
+	delete[] ground_heights;
+	delete[] ground_normals;
+	delete[] packed;
 }
 
 void points2::updateParams(GLfloat dist, GLfloat sp)
 {
 	maxdist = dist;
 	speed = sp;
+	updateBounds();
+}
+
+/* Bounds of the packed positions. Particles are killed close to maxdist from the emitter
+   so allow some overshoot, anything outside is clamped to the edge */
+void points2::updateBounds()
+{
+	GLfloat bound = maxdist * 1.5f;
+	decode_scale = vec3(2.f * bound);
+	decode_offset = vec3(-bound);
+	bounds = boundsFromBox(vec3(-bound), vec3(bound));
 }
 
 
@@ -35,6 +110,12 @@ void  points2::create()
 	vertices = new vec3[numpoints];
 	colours = new vec3[numpoints];
 	velocity = new vec3[numpoints];
+	prev_vertices = new vec3[numpoints];
+	draw_vertices = new vec3[numpoints];
+	sorted_indices = new GLuint[numpoints];
+	ground_positions = new vec2[numpoints];
+	ground_heights = new GLfloat[numpoints];
+	ground_normals = new vec3[numpoints];
 
 	/* Define random colour and vertical velocity + small random variation */
 	for (int i = 0; i < numpoints; i++)
@@ -47,68 +128,250 @@ void  points2::create()
 	/* and the vertex buffer positions */
 	glGenBuffers(1, &vertex_buffer);
 	glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
-	glBufferData(GL_ARRAY_BUFFER, numpoints * sizeof(vec3), vertices, GL_DYNAMIC_DRAW);
+	if (packed_vertices)
+	{
+		// The positions are filled in draw(), the colours are set once as RGBA8 so both
+		// strides are a multiple of 4 bytes
+		packed = new packed_particle[numpoints];
+		for (GLuint i = 0; i < numpoints; i++) packed[i].position[3] = 0;
+		glBufferData(GL_ARRAY_BUFFER, numpoints * sizeof(packed_particle), 0, GL_STREAM_DRAW);
 
-	glGenBuffers(1, &colour_buffer);
-	glBindBuffer(GL_ARRAY_BUFFER, colour_buffer);
-	glBufferData(GL_ARRAY_BUFFER, numpoints * sizeof(vec3), colours, GL_STATIC_DRAW);
+		GLubyte* packed_colours = new GLubyte[numpoints * 4];
+		for (GLuint i = 0; i < numpoints; i++)
+		{
+			vec3 c = colours[i] * 255.f + 0.5f;
+			packed_colours[i * 4] = GLubyte(c.r);
+			packed_colours[i * 4 + 1] = GLubyte(c.g);
+			packed_colours[i * 4 + 2] = GLubyte(c.b);
+			packed_colours[i * 4 + 3] = 255;
+		}
+		glGenBuffers(1, &colour_buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, colour_buffer);
+		glBufferData(GL_ARRAY_BUFFER, numpoints * 4, packed_colours, GL_STATIC_DRAW);
+		delete[] packed_colours;
+	}
+	else
+	{
+		glBufferData(GL_ARRAY_BUFFER, numpoints * sizeof(vec3), vertices, GL_DYNAMIC_DRAW);
+
+		glGenBuffers(1, &colour_buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, colour_buffer);
+		glBufferData(GL_ARRAY_BUFFER, numpoints * sizeof(vec3), colours, GL_STATIC_DRAW);
+	}
+
+	/* Element buffer for the depth sorted draw order */
+	glGenBuffers(1, &index_buffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, numpoints * sizeof(GLuint), 0, GL_STREAM_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 
 
-void points2::draw()
+/* Draw the particles, alpha is the fraction of a simulation step that has elapsed since
+   the last call to animate() and is used to interpolate between the last two steps.
+   modelview is only needed when depth sorting */
+void points2::draw(GLfloat alpha, const mat4& modelview)
 {
+	vec3 encode_scale = 65535.f / decode_scale;
+
+	worker_pool().parallel_for(numpoints, particle_min_chunk, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			vec3 p = mix(prev_vertices[i], vertices[i], alpha);
+			draw_vertices[i] = p;
+
+			if (packed_vertices)
+			{
+				vec3 q = clamp((p - decode_offset) * encode_scale, vec3(0.f), vec3(65535.f)) + 0.5f;
+				packed[i].position[0] = GLushort(q.x);
+				packed[i].position[1] = GLushort(q.y);
+				packed[i].position[2] = GLushort(q.z);
+			}
+		}
+	});
+
 	/* Bind  vertices. Note that this is in attribute index 0 */
-	glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	/* The colours are in attribute index 1, which the object shader uses as a normal for
+	   the lighting, as it always has for the particles. Index 3 stays disabled so they
+	   keep the constant white colour */
+	if (packed_vertices)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+		glBufferData(GL_ARRAY_BUFFER, numpoints * sizeof(packed_particle), packed, GL_STREAM_DRAW);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(packed_particle), (void*)offsetof(packed_particle, position));
 
-	/* Bind cube colours. Note that this is in attribute index 1 */
-	glBindBuffer(GL_ARRAY_BUFFER, colour_buffer);
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
+		glBindBuffer(GL_ARRAY_BUFFER, colour_buffer);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_UNSIGNED_BYTE, GL_TRUE, 4, 0);
+	}
+	else
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+		glBufferData(GL_ARRAY_BUFFER, numpoints * sizeof(vec3), draw_vertices, GL_DYNAMIC_DRAW);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+		glBindBuffer(GL_ARRAY_BUFFER, colour_buffer);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	}
 
 	/* Draw our points*/
-	glDrawArrays(GL_POINTS, 0, numpoints);
+	if (depth_sort && !additive)
+	{
+		// Sort an index buffer rather than moving the particle data
+		sorter.sortBackToFront(draw_vertices, numpoints, modelview, sorted_indices);
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, numpoints * sizeof(GLuint), sorted_indices, GL_STREAM_DRAW);
+		glDrawElements(GL_POINTS, numpoints, GL_UNSIGNED_INT, 0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+	else
+	{
+		glDrawArrays(GL_POINTS, 0, numpoints);
+	}
 }
 
 
-void points2::animate()
+/* Advance the simulation by one fixed step of timestep seconds. The particle parameters
+   were tuned at 60 steps per second so the motion is scaled relative to that rate.
+   The particles are updated in chunks on the worker threads */
+void points2::animate(GLfloat timestep)
 {
-	for (int i = 0; i < numpoints; i++)
-	{
-		// Shift vertex position by velocity vector
-		vertices[i] += velocity[i];
+	GLfloat step_scale = timestep * 60.f;
+	GLfloat jitter_scale = sqrt(step_scale);
+	GLuint step = ++step_count;
+
+	bool colliding = (collision != COLLIDE_NONE) && collision_terrain;
+	mat4 world_to_local = colliding ? inverse(local_to_world) : mat4(1.f);
 
-		// Add a small random value to the velocity
-		velocity[i] += vec3(ballRand(linearRand(0.f, speed/40.f)));
+	// Keep the positions at the start of the step, these are also what the neighbour
+	// queries read so the result doesn't depend on the order the chunks run in
+	memcpy(prev_vertices, vertices, numpoints * sizeof(vec3));
 
-		// Calculate distance to the origin
-		GLfloat dist = length(vertices[i]);
+	bool repelling = (repulsion > 0.f);
+	if (repelling)
+	{
+		grid.build(prev_vertices, numpoints, repulsion_radius);
+	}
 
-		// If we are too far away then kill the particle by starting at the origin again
-		if (dist > (maxdist - linearRand(0.f, 0.5f)))
+	worker_pool().parallel_for(numpoints, particle_min_chunk, [&](size_t begin, size_t end)
+	{
+		GLuint rng = seedRandom(step, GLuint(begin));
+
+		for (size_t i = begin; i < end; i++)
 		{
-			// restart thee particle at the initial position
-			initpoint(i);
+			// Push away from nearby particles, more strongly the closer they are
+			if (repelling)
+			{
+				vec3 push(0);
+				grid.forEachNeighbour(prev_vertices[i], repulsion_radius, max_neighbours, [&](GLuint j, const vec3& offset)
+				{
+					GLfloat d = length(offset);
+					if (j != i && d > 0.f)
+					{
+						push += offset * ((1.f - d / repulsion_radius) / d);
+					}
+					return true;
+				});
+				velocity[i] += push * (repulsion * step_scale);
+			}
+
+			// Shift vertex position by velocity vector
+			vertices[i] += velocity[i] * step_scale;
+
+			// Add a small random value to the velocity. The kicks add up as a random walk, so
+			// they scale with the square root of the step for the same spread at any rate
+			velocity[i] += randBall(rng, randRange(rng, 0.f, speed / 40.f * jitter_scale));
+
+			// Calculate distance to the origin
+			GLfloat dist = length(vertices[i]);
+
+			// If we are too far away then kill the particle by starting at the origin again.
+			// The chance rises over the last 0.5 before maxdist and is per 60th of a second,
+			// so the lifetimes don't depend on the step size
+			GLfloat death = clamp((dist - (maxdist - 0.5f)) * 2.f, 0.f, 1.f);
+			if (death >= 1.f || randRange(rng, 0.f, 1.f) < 1.f - pow(1.f - death, step_scale))
+			{
+				// restart thee particle at the initial position
+				initpoint(int(i), rng);
+			}
+			else
+			{
+				// Add a gravity effect
+				velocity[i].y += 0.00001f * step_scale;
+			}
 		}
-		else
+
+		if (colliding)
 		{
-			// Add a gravity effect
-			velocity[i].y += 0.00001f;
+			collideChunk(GLuint(begin), GLuint(end), rng, world_to_local);
 		}
+	});
+}
+
+
+/* Collide a chunk of particles with the terrain. The ground under every particle in the
+   chunk is found with a single batched height query, then particles below it are
+   moved back onto the surface and bounced, slid along it or killed */
+void points2::collideChunk(GLuint begin, GLuint end, GLuint& rng, const mat4& world_to_local)
+{
+	for (GLuint i = begin; i < end; i++)
+	{
+		vec4 world = local_to_world * vec4(vertices[i], 1.f);
+		ground_positions[i] = vec2(world.x, world.z);
 	}
 
-	// Update the vertex buffer data
-	glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
-	glBufferData(GL_ARRAY_BUFFER, numpoints * sizeof(vec3), vertices, GL_DYNAMIC_DRAW);
+	// Normals are only needed to respond to a collision, not to kill the particle
+	collision_terrain->heightsAtPositions(&ground_positions[begin], &ground_heights[begin],
+		(collision == COLLIDE_KILL) ? 0 : &ground_normals[begin], end - begin);
+
+	mat3 velocity_to_world = mat3(local_to_world);
+	mat3 velocity_to_local = mat3(world_to_local);
+	GLfloat bounce = (collision == COLLIDE_BOUNCE) ? 1.f + restitution : 1.f;
+
+	for (GLuint i = begin; i < end; i++)
+	{
+		vec4 world = local_to_world * vec4(vertices[i], 1.f);
+		if (world.y >= ground_heights[i]) continue;
+
+		if (collision == COLLIDE_KILL)
+		{
+			initpoint(int(i), rng);
+			continue;
+		}
+
+		// Remove (slide) or reflect (bounce) the velocity into the surface
+		vec3 n = ground_normals[i];
+		vec3 v = velocity_to_world * velocity[i];
+		GLfloat vn = dot(v, n);
+		if (vn < 0.f)
+		{
+			v -= bounce * vn * n;
+			velocity[i] = velocity_to_local * v;
+		}
+
+		// Put the particle back on the surface
+		world.y = ground_heights[i];
+		vertices[i] = vec3(world_to_local * world);
+	}
 }
 
 
 // Set the initial particle conditions
 void points2::initpoint(int i)
+{
+	initpoint(i, rng_state);
+}
+
+void points2::initpoint(int i, GLuint& rng)
 {
 	vertices[i] = vec3(0);// vec3((linearRand(0.f, speed*4.f), linearRand(0.f, speed * 2), linearRand(0.f, speed*4.f)));
-	colours[i] = vec3(linearRand(0.2f, 0.3f), linearRand(0.4f, 0.5f), linearRand(0.8f, 1.0f));
-	velocity[i] = vec3(0, 0.05, 0) + vec3(ballRand(linearRand(0.f, speed)));
+	prev_vertices[i] = vertices[i];	// don't interpolate from where the particle died
+	colours[i] = vec3(randRange(rng, 0.2f, 0.3f), randRange(rng, 0.4f, 0.5f), randRange(rng, 0.8f, 1.0f));
+	velocity[i] = vec3(0, 0.05, 0) + randBall(rng, randRange(rng, 0.f, speed));
 	velocity[i] = normalize(velocity[i]) / 500.f;
 }
\ No newline at end of file
@@ -7,6 +7,11 @@ October 2016
 
 #include <glm/glm.hpp>
 #include "wrapper_glfw.h"
+#include "particle_sort.h"
+#include "spatial_grid.h"
+#include "bounds.h"
+
+class terrain_object;
 
 class points2
 {
@@ -15,23 +20,81 @@ public:
 	~points2();
 
 	void create();
-	void draw();
-	void animate();
+	void draw(GLfloat alpha = 1.f, const glm::mat4& modelview = glm::mat4(1.f));
+	void animate(GLfloat timestep = 1.f / 60.f);
 	void updateParams(GLfloat dist, GLfloat sp);
 	void initpoint(int i);
+	void initpoint(int i, GLuint& rng);
 
 	glm::vec3 *vertices;
 	glm::vec3 *colours;
 	glm::vec3 *velocity;
 
+	// Positions at the previous simulation step and the interpolated positions
+	// uploaded for drawing, so rendering can run at a different rate to animate()
+	glm::vec3 *prev_vertices;
+	glm::vec3 *draw_vertices;
+
+	// Optional compact vertex format: 16 bit normalized positions within the emitter
+	// bounds, padded to the only 8 bytes uploaded each frame, and RGBA8 colours in a static
+	// buffer like the float colours. Set before create(). The shader rebuilds the position as
+	// position * decode_scale + decode_offset, and fades the particles out towards
+	// maxdist if given it as fade_distance
+	struct packed_particle
+	{
+		GLushort position[4];	// The last is padding, so each particle is 4 byte aligned
+	};
+	bool packed_vertices;
+	packed_particle *packed;
+	glm::vec3 decode_scale;
+	glm::vec3 decode_offset;
+
+	// Box around the emitter that the particles stay inside, the same as the packing bounds
+	bounding_volume bounds;
+
 	GLuint numpoints;		// Number of particles
 	GLuint vertex_buffer;
 	GLuint colour_buffer;
+	GLuint index_buffer;	// Draw order when depth sorting
+
+	// Sort the particles back to front before drawing so alpha blending composites correctly.
+	// Sorting is skipped for additive emitters because additive blending is order independent
+	bool depth_sort;
+	bool additive;
+	GLuint *sorted_indices;
+	particle_sorter sorter;
+
+	// Optional collision with a heightfield. local_to_world takes the particle positions
+	// into the terrain's space, set it before each animate() as the emitter moves with the ship
+	enum collision_response { COLLIDE_NONE, COLLIDE_BOUNCE, COLLIDE_SLIDE, COLLIDE_KILL };
+	collision_response collision;
+	terrain_object* collision_terrain;
+	glm::mat4 local_to_world;
+	GLfloat restitution;		// Fraction of the velocity into the surface kept after a bounce
+
+	// World (x, z) positions and ground heights/normals, filled a chunk at a time
+	glm::vec2 *ground_positions;
+	GLfloat *ground_heights;
+	glm::vec3 *ground_normals;
+
+	// Optional repulsion between nearby particles (e.g. to spread out smoke), found with a
+	// spatial grid rebuilt every step. Off when repulsion is zero
+	GLfloat repulsion;
+	GLfloat repulsion_radius;
+	GLuint max_neighbours;		// Caps the work per particle where many particles overlap
+	spatial_grid grid;
 
 	// Particle speed
 	GLfloat speed;		
 
 	// Particle max distance fomr the origin before we change direction back to the centre
 	GLfloat maxdist;	
+
+private:
+	void updateBounds();
+	void collideChunk(GLuint begin, GLuint end, GLuint& rng, const glm::mat4& world_to_local);
+
+	GLuint rng_state;		// Random sequence for particles created outside animate()
+	GLuint step_count;		// Seeds the random sequences of the parallel update
 };
 
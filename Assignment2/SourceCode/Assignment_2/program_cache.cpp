@@ -0,0 +1,344 @@
+/* program_cache.cpp
+   The shaders are compiled and linked here rather than by GLWrapper, which asks for each
+   status straight away, and so that GL_PROGRAM_BINARY_RETRIEVABLE_HINT can be set before
+   linking. The build time is stored with the binary, so a run that only loads binaries
+   can still say how long building would have taken. When programs are built together
+   it is the time until each was seen to finish.
+*/
+
+#include "program_cache.h"
+#include "file_utils.h"
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+
+using namespace std;
+
+// From KHR_parallel_shader_compile, which the GL 4.0 headers don't include
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+static const char program_cache_magic[4] = { 'G', 'P', 'R', 'G' };
+static const uint32_t program_cache_version = 1;
+
+struct program_cache_header
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t key;			// Hash of the sources, the defines and the driver's strings
+	uint32_t binary_format;
+	uint32_t binary_size;
+	double build_ms;		// How long the program took to build from source
+};
+
+static program_cache_stats cache_stats = { 0, 0, 0.0, 0.0, 0.0, false };
+
+
+const program_cache_stats& programCacheStats()
+{
+	return cache_stats;
+}
+
+
+/* Drivers can support the extension and still offer no binary formats */
+static bool binariesSupported()
+{
+	static int supported = -1;
+	if (supported < 0)
+	{
+		GLint formats = 0;
+		if ((glext_ARB_get_program_binary || ogl_IsVersionGEQ(4, 1)) && glGetProgramBinary && glProgramBinary)
+		{
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		}
+		supported = (formats > 0) ? 1 : 0;
+	}
+	return supported == 1;
+}
+
+
+/* Put the defines on the line after #version, which must come first */
+static string addDefines(const string& source, const string& defines)
+{
+	if (defines.empty()) return source;
+	size_t version = source.find("#version");
+	size_t line_end = (version == string::npos) ? string::npos : source.find('\n', version);
+	if (line_end == string::npos) return defines + "\n" + source;
+	return source.substr(0, line_end + 1) + defines + "\n" + source.substr(line_end + 1);
+}
+
+
+static uint64_t hashString(const char* text, uint64_t seed)
+{
+	// Include the terminator, so the strings can't run into each other
+	if (!text) text = "";
+	return hashBytes(text, strlen(text) + 1, seed);
+}
+
+
+static uint64_t programKey(const string& vertex_source, const string& fragment_source, const string& defines)
+{
+	uint64_t key = hashBytes(vertex_source.c_str(), vertex_source.size() + 1);
+	key = hashString(fragment_source.c_str(), key);
+	key = hashString(defines.c_str(), key);
+	key = hashString(reinterpret_cast<const char*>(glGetString(GL_VENDOR)), key);
+	key = hashString(reinterpret_cast<const char*>(glGetString(GL_RENDERER)), key);
+	key = hashString(reinterpret_cast<const char*>(glGetString(GL_VERSION)), key);
+	return key;
+}
+
+
+/* A program from a saved binary, or 0 if there isn't one for this key or the driver rejects it */
+static GLuint loadBinary(const string& cache_path, uint64_t key, double& build_ms)
+{
+	mapped_file file;
+	if (!file.open(cache_path) || file.size() < sizeof(program_cache_header)) return 0;
+
+	const program_cache_header* header = reinterpret_cast<const program_cache_header*>(file.data());
+	if (memcmp(header->magic, program_cache_magic, sizeof(header->magic)) != 0 ||
+		header->version != program_cache_version || header->key != key ||
+		sizeof(program_cache_header) + header->binary_size > file.size())
+	{
+		return 0;
+	}
+
+	GLuint program = glCreateProgram();
+	glProgramBinary(program, header->binary_format, file.data() + sizeof(program_cache_header), GLsizei(header->binary_size));
+
+	GLint status = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (status == GL_FALSE)
+	{
+		cout << "Program binary " << cache_path << " was rejected by the driver, building from source" << endl;
+		glDeleteProgram(program);
+		return 0;
+	}
+
+	build_ms = header->build_ms;
+	return program;
+}
+
+
+static void saveBinary(GLuint program, const string& cache_path, uint64_t key, double build_ms)
+{
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0) return;
+
+	vector<char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(program, length, &length, &format, binary.data());
+
+	program_cache_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, program_cache_magic, sizeof(header.magic));
+	header.version = program_cache_version;
+	header.key = key;
+	header.binary_format = format;
+	header.binary_size = uint32_t(length);
+	header.build_ms = build_ms;
+
+	file_block blocks[] =
+	{
+		{ 0, &header, sizeof(header) },
+		{ sizeof(header), binary.data(), size_t(length) },
+	};
+	writeFileAtomic(cache_path, blocks, 2);
+}
+
+
+/* The names the extension can go by, ARB_parallel_shader_compile being the same thing */
+static bool parallelCompileSupported()
+{
+	static int supported = -1;
+	if (supported < 0)
+	{
+		typedef void (APIENTRY *max_compiler_threads_proc)(GLuint count);
+		max_compiler_threads_proc max_threads = 0;
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+		for (GLint i = 0; i < count && !max_threads; i++)
+		{
+			const char* name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, GLuint(i)));
+			if (!name) continue;
+			if (strcmp(name, "GL_KHR_parallel_shader_compile") == 0)
+			{
+				max_threads = reinterpret_cast<max_compiler_threads_proc>(glfwGetProcAddress("glMaxShaderCompilerThreadsKHR"));
+			}
+			else if (strcmp(name, "GL_ARB_parallel_shader_compile") == 0)
+			{
+				max_threads = reinterpret_cast<max_compiler_threads_proc>(glfwGetProcAddress("glMaxShaderCompilerThreadsARB"));
+			}
+		}
+
+		// Let the driver use as many threads as it likes
+		if (max_threads) max_threads(0xFFFFFFFF);
+		supported = max_threads ? 1 : 0;
+	}
+	return supported == 1;
+}
+
+
+/* Start compiling a shader without waiting to hear how it went */
+static GLuint startShader(GLenum type, const string& source)
+{
+	GLuint shader = glCreateShader(type);
+	const char* text = source.c_str();
+	glShaderSource(shader, 1, &text, NULL);
+	glCompileShader(shader);
+	return shader;
+}
+
+
+/* Print a shader's errors the way GLWrapper::BuildShader does, false if it didn't compile */
+static bool shaderCompiled(GLuint shader, const char* type, const char* path)
+{
+	GLint status;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if (status == GL_TRUE) return true;
+
+	GLint infoLogLength;
+	glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &infoLogLength);
+	vector<GLchar> infoLog((infoLogLength > 1) ? infoLogLength : 1);
+	glGetShaderInfoLog(shader, GLsizei(infoLog.size()), NULL, infoLog.data());
+	cerr << "Compile error in " << type << " shader " << path << "\n\t" << infoLog.data() << endl;
+	return false;
+}
+
+
+// A program loadPrograms() is building
+struct program_build
+{
+	program_request* request;
+	string vertex_source;
+	string fragment_source;
+	string cache_path;
+	uint64_t key;
+	GLuint vertex_shader;
+	GLuint fragment_shader;
+	double build_ms;		// From the start of the builds until this one was seen to finish
+	bool finished;
+};
+
+
+void loadPrograms(GLWrapper* glw, program_request* requests, size_t count)
+{
+	bool binaries = binariesSupported();
+	cache_stats.parallel = parallelCompileSupported();
+
+	vector<program_build> builds;
+	for (size_t i = 0; i < count; i++)
+	{
+		auto start = chrono::high_resolution_clock::now();
+		program_build build;
+		build.request = &requests[i];
+		build.vertex_source = addDefines(glw->readFile(requests[i].vertex_path), requests[i].defines);
+		build.fragment_source = addDefines(glw->readFile(requests[i].fragment_path), requests[i].defines);
+
+		// Named by both shaders, as a fragment shader can be shared by several programs
+		string fragment_name = requests[i].fragment_path;
+		size_t slash = fragment_name.find_last_of("/\\");
+		if (slash != string::npos) fragment_name = fragment_name.substr(slash + 1);
+		build.cache_path = string(requests[i].vertex_path) + "+" + fragment_name + ".progcache";
+
+		build.key = binaries ? programKey(build.vertex_source, build.fragment_source, requests[i].defines) : 0;
+		double recorded_build_ms = 0;
+		requests[i].program = binaries ? loadBinary(build.cache_path, build.key, recorded_build_ms) : 0;
+		if (requests[i].program)
+		{
+			double ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+			cache_stats.loaded++;
+			cache_stats.load_ms += ms;
+			cache_stats.saved_ms += recorded_build_ms - ms;
+			continue;
+		}
+		builds.push_back(build);
+	}
+	if (builds.empty()) return;
+
+	// Start every compile and link before asking for any result
+	auto start = chrono::high_resolution_clock::now();
+	for (size_t i = 0; i < builds.size(); i++)
+	{
+		program_build& build = builds[i];
+		build.vertex_shader = startShader(GL_VERTEX_SHADER, build.vertex_source);
+		build.fragment_shader = startShader(GL_FRAGMENT_SHADER, build.fragment_source);
+
+		GLuint program = glCreateProgram();
+		if (binaries) glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glAttachShader(program, build.vertex_shader);
+		glAttachShader(program, build.fragment_shader);
+		glLinkProgram(program);
+		build.request->program = program;
+		build.finished = false;
+	}
+
+	// Leave the driver's threads to it, noting when each program is done
+	size_t remaining = cache_stats.parallel ? builds.size() : 0;
+	while (remaining > 0)
+	{
+		for (size_t i = 0; i < builds.size(); i++)
+		{
+			if (builds[i].finished) continue;
+			GLint complete = GL_FALSE;
+			glGetProgramiv(builds[i].request->program, GL_COMPLETION_STATUS_KHR, &complete);
+			if (complete == GL_FALSE) continue;
+			builds[i].finished = true;
+			builds[i].build_ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+			remaining--;
+		}
+		if (remaining > 0) this_thread::yield();
+	}
+
+	// Only now read the results, which without the extension waits for each in turn
+	size_t failed = 0;
+	for (size_t i = 0; i < builds.size(); i++)
+	{
+		program_build& build = builds[i];
+		GLuint program = build.request->program;
+		bool compiled = shaderCompiled(build.vertex_shader, "vertex", build.request->vertex_path);
+		compiled = shaderCompiled(build.fragment_shader, "fragment", build.request->fragment_path) && compiled;
+
+		GLint status;
+		glGetProgramiv(program, GL_LINK_STATUS, &status);
+		if (!build.finished) build.build_ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+		glDeleteShader(build.vertex_shader);
+		glDeleteShader(build.fragment_shader);
+
+		if (compiled && status == GL_FALSE)
+		{
+			GLint infoLogLength;
+			glGetProgramiv(program, GL_INFO_LOG_LENGTH, &infoLogLength);
+			vector<GLchar> infoLog((infoLogLength > 1) ? infoLogLength : 1);
+			glGetProgramInfoLog(program, GLsizei(infoLog.size()), NULL, infoLog.data());
+			cerr << "Linker error in " << build.request->vertex_path << " + " << build.request->fragment_path << ": " << infoLog.data() << endl;
+		}
+		if (!compiled || status == GL_FALSE)
+		{
+			glDeleteProgram(program);
+			build.request->program = 0;
+			failed++;
+			continue;
+		}
+
+		cache_stats.built++;
+		if (binaries) saveBinary(program, build.cache_path, build.key, build.build_ms);
+	}
+	cache_stats.build_ms += chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+
+	if (failed > 0) throw runtime_error("Shader programs could not be built.");
+}
+
+
+GLuint loadProgram(GLWrapper* glw, const char* vertex_path, const char* fragment_path, const string& defines)
+{
+	program_request request = { vertex_path, fragment_path, defines, 0 };
+	loadPrograms(glw, &request, 1);
+	return request.program;
+}
@@ -0,0 +1,51 @@
+/* program_cache.h
+   Linked shader programs saved with glGetProgramBinary, so later runs load them with
+   glProgramBinary instead of compiling and linking the GLSL again. Each program is
+   written next to its vertex shader as <vertex shader>+<fragment shader>.progcache.
+
+   A binary is only used if it was saved from the same vertex and fragment source and
+   defines, by a driver reporting the same GL_VENDOR, GL_RENDERER and GL_VERSION. The
+   driver can still reject it, say after an update that kept its version string, and
+   then the program is built from source and its binary saved again.
+
+   Programs that have to be built are built together by loadPrograms(): every shader is
+   compiled and every program linked before any status is asked for, since asking waits
+   for the driver to finish. With KHR_parallel_shader_compile the driver builds them on
+   its own threads while GL_COMPLETION_STATUS_KHR is polled; without it the driver can
+   still overlap what it defers, and the statuses and logs are read once at the end.
+*/
+
+#pragma once
+
+#include "wrapper_glfw.h"
+#include <string>
+
+// What the programs loaded so far took, and what their binaries saved
+struct program_cache_stats
+{
+	unsigned loaded;		// Programs made from their binaries
+	unsigned built;			// Programs compiled and linked from source
+	double load_ms;			// Spent loading binaries
+	double build_ms;		// Spent compiling and linking
+	double saved_ms;		// The build times recorded with the binaries that were loaded, less load_ms
+	bool parallel;			// The driver has KHR_parallel_shader_compile
+};
+
+// One program for loadPrograms() to make
+struct program_request
+{
+	const char* vertex_path;
+	const char* fragment_path;
+	std::string defines;	// Inserted after each shader's #version line
+	GLuint program;			// Set by loadPrograms()
+};
+
+// Load each program from its binary if an up to date one was saved, and build the rest
+// together, saving their binaries. Throws, like GLWrapper::BuildShaderProgram, if any
+// program can't be built, once the errors of every program that failed are printed
+void loadPrograms(GLWrapper* glw, program_request* requests, size_t count);
+
+// loadPrograms() for a single program
+GLuint loadProgram(GLWrapper* glw, const char* vertex_path, const char* fragment_path, const std::string& defines = "");
+
+const program_cache_stats& programCacheStats();
@@ -0,0 +1,94 @@
+/* spatial_grid.cpp
+   Parallel counting sort of particles into hash cells. Each chunk counts the
+   particles per cell, a prefix sum over (cell, chunk) gives every chunk its
+   output offsets within each cell, then the chunks scatter their indices.
+*/
+
+#include "spatial_grid.h"
+#include "thread_pool.h"
+#include <cstring>
+
+using namespace std;
+using namespace glm;
+
+// Particles per chunk below which it isn't worth splitting the work
+static const size_t grid_min_chunk = 4096;
+
+spatial_grid::spatial_grid()
+{
+	cell_size = 1.f;
+	table_size = 0;
+	count = 0;
+}
+
+
+void spatial_grid::build(const vec3* positions, GLuint n, GLfloat size)
+{
+	thread_pool& pool = worker_pool();
+
+	count = n;
+	cell_size = size;
+
+	// Roughly one cell per particle keeps hash collisions down
+	GLuint new_table_size = 1024;
+	while (new_table_size < count) new_table_size *= 2;
+	table_size = new_table_size;
+
+	size_t num_chunks = pool.numChunks(count, grid_min_chunk);
+	if (num_chunks == 0) num_chunks = 1;
+
+	cell_start.resize(table_size + 1);
+	sorted.resize(count);
+	sorted_positions.resize(count);
+	particle_cell.resize(count);
+	chunk_counts.resize(num_chunks * table_size);
+
+	GLfloat inv_cell = 1.f / cell_size;
+
+	// Hash each particle and count the particles per cell in each chunk
+	pool.parallel_for(num_chunks, 1, [&](size_t cbegin, size_t cend)
+	{
+		for (size_t c = cbegin; c < cend; c++)
+		{
+			GLuint* counts = &chunk_counts[c * table_size];
+			memset(counts, 0, table_size * sizeof(GLuint));
+
+			for (size_t i = count * c / num_chunks; i < count * (c + 1) / num_chunks; i++)
+			{
+				GLuint h = hashCell(int(floor(positions[i].x * inv_cell)),
+									int(floor(positions[i].y * inv_cell)),
+									int(floor(positions[i].z * inv_cell)));
+				particle_cell[i] = h;
+				counts[h]++;
+			}
+		}
+	});
+
+	// Cell start offsets, and each chunk's write position within the cell
+	GLuint offset = 0;
+	for (GLuint h = 0; h < table_size; h++)
+	{
+		cell_start[h] = offset;
+		for (size_t c = 0; c < num_chunks; c++)
+		{
+			GLuint n = chunk_counts[c * table_size + h];
+			chunk_counts[c * table_size + h] = offset;
+			offset += n;
+		}
+	}
+	cell_start[table_size] = offset;
+
+	pool.parallel_for(num_chunks, 1, [&](size_t cbegin, size_t cend)
+	{
+		for (size_t c = cbegin; c < cend; c++)
+		{
+			GLuint* counts = &chunk_counts[c * table_size];
+			for (size_t i = count * c / num_chunks; i < count * (c + 1) / num_chunks; i++)
+			{
+				GLuint s = counts[particle_cell[i]]++;
+				sorted[s] = GLuint(i);
+				sorted_positions[s] = positions[i];
+			}
+		}
+	});
+}
@@ -0,0 +1,85 @@
+/* spatial_grid.h
+   Uniform spatial hash grid for finding the particles near a point.
+
+   build() hashes every position into a table of cells and counting-sorts the
+   particle indices, and a copy of the positions, so that each cell's particles
+   are contiguous in memory. It runs in parallel and is rebuilt every frame.
+   forEachNeighbour() then only touches the cells that overlap the search radius.
+   Both are linear in the number of particles as long as the number of
+   neighbours visited per query is capped.
+*/
+
+#pragma once
+
+#include "wrapper_glfw.h"
+#include <vector>
+#include <cmath>
+#include <glm/glm.hpp>
+
+class spatial_grid
+{
+public:
+	spatial_grid();
+
+	void build(const glm::vec3* positions, GLuint count, GLfloat cell_size);
+
+	// Call visit(index, offset) for every particle within radius of p, where offset is
+	// p minus the particle position. Stops early if visit returns false or after
+	// max_visits particles. radius should be no larger than the cell size
+	template <typename F>
+	void forEachNeighbour(const glm::vec3& p, GLfloat radius, GLuint max_visits, F visit) const;
+
+	GLfloat cell_size;
+	GLuint table_size;					// Number of hash cells, a power of two
+	std::vector<GLuint> cell_start;		// Start of each cell in sorted, plus an end marker
+	std::vector<GLuint> sorted;			// Particle indices ordered by cell
+	std::vector<glm::vec3> sorted_positions;	// Positions in the same order
+	std::vector<GLuint> particle_cell;	// Hash cell of each particle
+
+private:
+	GLuint hashCell(int x, int y, int z) const
+	{
+		return (GLuint(x) * 73856093u ^ GLuint(y) * 19349663u ^ GLuint(z) * 83492791u) & (table_size - 1);
+	}
+
+	GLuint count;
+	std::vector<GLuint> chunk_counts;	// table_size counters per chunk
+};
+
+
+template <typename F>
+void spatial_grid::forEachNeighbour(const glm::vec3& p, GLfloat radius, GLuint max_visits, F visit) const
+{
+	if (count == 0) return;
+
+	GLfloat inv_cell = 1.f / cell_size;
+	int x0 = int(std::floor((p.x - radius) * inv_cell)), x1 = int(std::floor((p.x + radius) * inv_cell));
+	int y0 = int(std::floor((p.y - radius) * inv_cell)), y1 = int(std::floor((p.y + radius) * inv_cell));
+	int z0 = int(std::floor((p.z - radius) * inv_cell)), z1 = int(std::floor((p.z + radius) * inv_cell));
+
+	// Different cells can share a hash bucket, only visit each bucket once
+	GLuint buckets[27];
+	GLuint num_buckets = 0;
+	GLuint visits = 0;
+	GLfloat radius2 = radius * radius;
+
+	for (int x = x0; x <= x1; x++)
+	for (int y = y0; y <= y1; y++)
+	for (int z = z0; z <= z1; z++)
+	{
+		GLuint h = hashCell(x, y, z);
+
+		bool seen = false;
+		for (GLuint b = 0; b < num_buckets; b++) seen = seen || (buckets[b] == h);
+		if (seen) continue;
+		if (num_buckets < 27) buckets[num_buckets++] = h;
+
+		for (GLuint s = cell_start[h]; s < cell_start[h + 1]; s++)
+		{
+			glm::vec3 offset = p - sorted_positions[s];
+			if (glm::dot(offset, offset) > radius2) continue;
+
+			if (!visit(sorted[s], offset) || ++visits >= max_visits) return;
+		}
+	}
+}
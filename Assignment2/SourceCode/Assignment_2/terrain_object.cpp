@@ -4,6 +4,7 @@
 
    vec2 terrain_object::getGridPos(GLfloat x, GLfloat z)
    float terrain_object::heightAtPosition(GLfloat x, GLfloat z)
+   void terrain_object::heightsAtPositions(const vec2* positions, GLfloat* heights, vec3* surface_normals, GLuint count)
 
    Iain Martin November 2018
 */
@@ -13,6 +14,7 @@
 #include "glm/gtc/random.hpp"
 #include <stdio.h>
 #include <iostream>
+#include <algorithm>
 
 using namespace std;
 using namespace glm;
@@ -46,6 +48,8 @@ terrain_object::~terrain_object()
 /* Copy the vertices, normals and element indices into vertex buffers */
 void terrain_object::createObject()
 {
+	bounds = computeBounds(&vertices[0].x, xsize * zsize);
+
 	/* Generate the vertex buffer object */
 	glGenBuffers(1, &vbo_mesh_vertices);
 	glBindBuffer(GL_ARRAY_BUFFER, vbo_mesh_vertices);
@@ -426,6 +430,38 @@ vec2 terrain_object::getGridPos(GLfloat x, GLfloat z)
 	return vec2(Xgrid, Zgrid);
 }
 
+// Get bilinearly interpolated heights (and optionally normals) for a batch of
+// world (x, z) positions. Positions outside the terrain are clamped to the edge.
+// Like getGridPos this assumes the terrain object hasn't been scaled or shifted
+void terrain_object::heightsAtPositions(const vec2* positions, GLfloat* heights, vec3* surface_normals, GLuint count)
+{
+	GLfloat xscale = float(xsize) / width;
+	GLfloat zscale = float(zsize) / height;
+	GLfloat xmax = float(xsize - 1);
+	GLfloat zmax = float(zsize - 1);
+
+	for (GLuint i = 0; i < count; i++)
+	{
+		// Floating point grid position, clamped to the grid
+		GLfloat gx = glm::clamp((positions[i].x + (width / 2.f)) * xscale, 0.f, xmax);
+		GLfloat gz = glm::clamp((positions[i].y + (height / 2.f)) * zscale, 0.f, zmax);
+
+		// Lower grid corner and the fractional position within the grid cell
+		GLuint x0 = std::min(GLuint(gx), xsize - 2);
+		GLuint z0 = std::min(GLuint(gz), zsize - 2);
+		GLfloat fx = gx - float(x0);
+		GLfloat fz = gz - float(z0);
 
+		GLuint v00 = x0 * xsize + z0;
+		GLuint v10 = v00 + xsize;
 
+		heights[i] = mix(mix(vertices[v00].y, vertices[v00 + 1].y, fz),
+						 mix(vertices[v10].y, vertices[v10 + 1].y, fz), fx);
 
+		if (surface_normals)
+		{
+			surface_normals[i] = normalize(mix(mix(normals[v00], normals[v00 + 1], fz),
+											   mix(normals[v10], normals[v10 + 1], fz), fx));
+		}
+	}
+}
@@ -7,6 +7,7 @@
 #pragma once
 
 #include "wrapper_glfw.h"
+#include "bounds.h"
 #include <vector>
 #include <glm/glm.hpp>
 
@@ -25,6 +26,7 @@ public:
 	void defineSeaLevel(GLfloat s);
 	float heightAtPosition(GLfloat x, GLfloat z);
 	glm::vec2 getGridPos(GLfloat x, GLfloat z);
+	void heightsAtPositions(const glm::vec2* positions, GLfloat* heights, glm::vec3* surface_normals, GLuint count);
 
 
 	void createObject();
@@ -46,6 +48,7 @@ public:
 
 	GLuint xsize;
 	GLuint zsize;
+	bounding_volume bounds;		// Of the vertices as they were when createObject uploaded them
 	GLfloat width;
 	GLfloat height;
 	GLuint perlin_octaves;
@@ -0,0 +1,277 @@
+/* texture_atlas.cpp
+   The atlas is as narrow as it can be while staying no taller than it is wide: widths
+   are tried from the square root of the images' total area upwards. Images are packed
+   tallest first, which suits a skyline packer best.
+
+   The bake's key has the total size and chained content hash of the images in place of
+   a single source file's, and no modification time since the contents decide it.
+*/
+
+#include "texture_atlas.h"
+#include "texture_bake.h"
+#include "mip_generate.h"
+#include "file_utils.h"
+#include "stb_image.h"
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <memory>
+
+using namespace std;
+
+
+skyline_packer::skyline_packer(int width, int height) : width(width), height(height)
+{
+	segment floor = { 0, 0, width };
+	skyline.push_back(floor);
+}
+
+
+bool skyline_packer::insert(int rect_width, int rect_height, int& x, int& y)
+{
+	int best = -1, best_x = 0, best_y = 0;
+	for (size_t i = 0; i < skyline.size(); i++)
+	{
+		// The rectangle rests on the highest segment it spans
+		int left = skyline[i].x;
+		if (left + rect_width > width) break;
+		int top = 0;
+		for (size_t j = i; j < skyline.size() && skyline[j].x < left + rect_width; j++) top = std::max(top, skyline[j].y);
+		if (top + rect_height > height) continue;
+
+		if (best < 0 || top < best_y || (top == best_y && left < best_x))
+		{
+			best = int(i);
+			best_x = left;
+			best_y = top;
+		}
+	}
+	if (best < 0) return false;
+
+	// Raise the skyline under the rectangle, cutting back the segments it covers
+	segment placed = { best_x, best_y + rect_height, rect_width };
+	size_t i = size_t(best);
+	while (i < skyline.size() && skyline[i].x < best_x + rect_width)
+	{
+		int right = skyline[i].x + skyline[i].width;
+		if (right <= best_x + rect_width)
+		{
+			skyline.erase(skyline.begin() + i);
+		}
+		else
+		{
+			skyline[i].width = right - (best_x + rect_width);
+			skyline[i].x = best_x + rect_width;
+			break;
+		}
+	}
+	skyline.insert(skyline.begin() + best, placed);
+
+	// Join neighbours at the same height
+	for (size_t j = 0; j + 1 < skyline.size();)
+	{
+		if (skyline[j].y == skyline[j + 1].y)
+		{
+			skyline[j].width += skyline[j + 1].width;
+			skyline.erase(skyline.begin() + j + 1);
+		}
+		else
+		{
+			j++;
+		}
+	}
+
+	x = best_x;
+	y = best_y;
+	return true;
+}
+
+
+int skyline_packer::usedHeight() const
+{
+	int used = 0;
+	for (size_t i = 0; i < skyline.size(); i++) used = std::max(used, skyline[i].y);
+	return used;
+}
+
+
+texture_atlas::texture_atlas()
+{
+	width = height = 0;
+	channels = 3;
+	levels = 0;
+	from_bake = false;
+	texture = 0;
+}
+
+
+bool texture_atlas::build(const vector<string>& files, const string& bake_path, bool compress, int gutter, int max_size)
+{
+	entries.clear();
+	bake.reset();
+	from_bake = false;
+
+	vector<string> unique_files;
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		if (std::find(unique_files.begin(), unique_files.end(), files[i]) == unique_files.end()) unique_files.push_back(files[i]);
+	}
+	if (unique_files.empty()) return false;
+
+	// The packing only needs each image's size, from its header. The key covers every
+	// image's contents, in order, and the options
+	vector<unique_ptr<mapped_file>> sources;
+	vector<int> image_width(unique_files.size()), image_height(unique_files.size());
+	texture_bake_key key = { 0, 0, 14695981039346656037ull, (compress ? 1u : 0u) | (uint64_t(gutter) << 1) | (uint64_t(max_size) << 32) };
+	channels = 3;
+	for (size_t i = 0; i < unique_files.size(); i++)
+	{
+		sources.push_back(unique_ptr<mapped_file>(new mapped_file()));
+		mapped_file& source = *sources.back();
+		int file_channels = 0;
+		if (!source.open(unique_files[i]) || source.size() == 0 ||
+			!stbi_info_from_memory(source.data(), int(source.size()), &image_width[i], &image_height[i], &file_channels))
+		{
+			printf("texture_atlas: can't read %s\n", unique_files[i].c_str());
+			return false;
+		}
+		if (file_channels == 2 || file_channels == 4) channels = 4;
+		key.source_size += source.size();
+		key.source_hash = hashBytes(source.data(), source.size(), key.source_hash);
+	}
+
+	// Pack in cells of gutter x gutter texels, each image with a gutter all round
+	vector<int> cell_width(unique_files.size()), cell_height(unique_files.size());
+	vector<size_t> order(unique_files.size());
+	int area = 0, widest = 0;
+	for (size_t i = 0; i < unique_files.size(); i++)
+	{
+		cell_width[i] = (image_width[i] + 2 * gutter + gutter - 1) / gutter;
+		cell_height[i] = (image_height[i] + 2 * gutter + gutter - 1) / gutter;
+		area += cell_width[i] * cell_height[i];
+		widest = std::max(widest, cell_width[i]);
+		order[i] = i;
+	}
+	stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return cell_height[a] > cell_height[b]; });
+
+	int max_cells = max_size / gutter;
+	vector<int> cell_x(unique_files.size()), cell_y(unique_files.size());
+	bool packed = false;
+	for (int cells = std::max(widest, int(ceil(sqrt(double(area))))); cells <= max_cells && !packed; cells++)
+	{
+		skyline_packer packer(cells, max_cells);
+		packed = true;
+		for (size_t i = 0; i < order.size() && packed; i++)
+		{
+			packed = packer.insert(cell_width[order[i]], cell_height[order[i]], cell_x[order[i]], cell_y[order[i]]);
+		}
+		if (packed && packer.usedHeight() > cells) packed = false;
+		if (packed)
+		{
+			width = cells * gutter;
+			height = packer.usedHeight() * gutter;
+		}
+	}
+	if (!packed)
+	{
+		printf("texture_atlas: %zu images don't fit in %d x %d\n", unique_files.size(), max_size, max_size);
+		return false;
+	}
+
+	// Only the levels where the gutters are at least a texel wide
+	levels = 1;
+	while ((gutter >> levels) > 0 && (std::max(width, height) >> levels) > 0) levels++;
+
+	for (size_t i = 0; i < unique_files.size(); i++)
+	{
+		atlas_entry entry = { unique_files[i], cell_x[i] * gutter + gutter, cell_y[i] * gutter + gutter, image_width[i], image_height[i] };
+		entries.push_back(entry);
+	}
+
+	bake = make_shared<baked_texture>();
+	if (bake->open(bake_path, key) && int(bake->levels.size()) == levels &&
+		bake->levels[0].width == width && bake->levels[0].height == height)
+	{
+		from_bake = true;
+		return true;
+	}
+
+	vector<size_t> level_offsets(levels + 1, 0);
+	for (int l = 0; l < levels; l++)
+	{
+		level_offsets[l + 1] = level_offsets[l] + size_t(std::max(width >> l, 1)) * std::max(height >> l, 1) * channels;
+	}
+	vector<unsigned char> texels(level_offsets[levels], 0);
+
+	// Fill each cell with its image, the gutter and the rest of the cell repeating its edges
+	for (size_t i = 0; i < unique_files.size(); i++)
+	{
+		decoded_image image;
+		if (!decodeImage(sources[i]->data(), sources[i]->size(), unique_files[i], image))
+		{
+			entries.clear();
+			bake.reset();
+			return false;
+		}
+
+		const atlas_entry& entry = entries[i];
+		for (int y = cell_y[i] * gutter; y < (cell_y[i] + cell_height[i]) * gutter; y++)
+		{
+			int source_y = std::min(std::max(y - entry.y, 0), image.height - 1);
+			unsigned char* out = texels.data() + (size_t(y) * width + cell_x[i] * gutter) * channels;
+			for (int x = cell_x[i] * gutter; x < (cell_x[i] + cell_width[i]) * gutter; x++, out += channels)
+			{
+				int source_x = std::min(std::max(x - entry.x, 0), image.width - 1);
+				const unsigned char* in = image.data + (size_t(source_y) * image.width + source_x) * image.nrChannels;
+				for (int c = 0; c < channels; c++) out[c] = (c < image.nrChannels) ? in[c] : 255;
+			}
+		}
+	}
+
+	vector<unsigned char*> level_texels(levels);
+	for (int l = 0; l < levels; l++) level_texels[l] = texels.data() + level_offsets[l];
+	generateMipChain(level_texels.data(), levels, width, height, channels, true);
+	bake->adopt(texels, level_offsets, width, height, channels, compress);
+
+	// The bake is only an optimisation, so carry on with the atlas in memory if it can't be written
+	bake->write(bake_path, key);
+	return true;
+}
+
+
+GLuint texture_atlas::upload(texture_cache& cache)
+{
+	texture = cache.add(bake);
+	bake.reset();
+
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	return texture;
+}
+
+
+void texture_atlas::release(texture_cache& cache)
+{
+	if (texture) cache.release(texture);
+	texture = 0;
+}
+
+
+int texture_atlas::find(const string& file) const
+{
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		if (entries[i].file == file) return int(i);
+	}
+	return -1;
+}
+
+
+void texture_atlas::remap(int entry, GLfloat texcoord[2]) const
+{
+	const atlas_entry& e = entries[entry];
+	texcoord[0] = (e.x + texcoord[0] * e.width) / GLfloat(width);
+	texcoord[1] = (e.y + texcoord[1] * e.height) / GLfloat(height);
+}
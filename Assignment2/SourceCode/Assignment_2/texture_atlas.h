@@ -0,0 +1,99 @@
+/* texture_atlas.h
+   Packs several images into one texture, so a model whose materials use different
+   images can be drawn without changing textures in between.
+
+   The images are placed with a skyline bottom-left packer. Each is surrounded by a
+   gutter of copies of its own edge texels, and the packer works on a grid as coarse as
+   the gutter, so every image starts on a multiple of it. Down to the level where the
+   gutter is one texel wide, every mip texel then comes from a single image and
+   bilinear filtering only reaches into the image's own gutter, so the atlas only has
+   those levels.
+
+   The atlas is baked like any other texture (texture_bake.h): its levels are compressed
+   to BC1/BC3 unless compression is off, and written to a bake keyed by the images'
+   contents and the packing options. The packing only needs the images' sizes, which
+   are read from their headers, so a later run with the same images maps the bake and
+   decodes nothing. At the last two levels the 4x4 blocks can take in texels of a
+   neighbouring image's gutter, which only costs the block some precision.
+
+   The texture coordinates of a model must be remapped into its image's rectangle, and
+   only coordinates inside [0, 1] can be, since the atlas can't repeat an image.
+*/
+
+#pragma once
+
+#include "wrapper_glfw.h"
+#include "texture_cache.h"
+#include <string>
+#include <vector>
+#include <memory>
+
+// Bottom-left skyline packing of rectangles into a width x height area
+class skyline_packer
+{
+public:
+	skyline_packer(int width, int height);
+
+	// Place a rectangle as low as it will go, then as far left. False if it doesn't fit
+	bool insert(int width, int height, int& x, int& y);
+
+	// The height of the highest rectangle placed so far
+	int usedHeight() const;
+
+private:
+	struct segment
+	{
+		int x, y, width;
+	};
+
+	std::vector<segment> skyline;
+	int width, height;
+};
+
+// Where an image is in the atlas, in texels of level 0
+struct atlas_entry
+{
+	std::string file;
+	int x, y, width, height;
+};
+
+class texture_atlas
+{
+public:
+	texture_atlas();
+
+	// Pack the images and load the atlas from the bake at bake_path, or decode the images
+	// and build the atlas with its mip levels, writing the bake for next time. Can be run
+	// on any thread. Returns false, printing why, if an image can't be read or the images
+	// don't fit in max_size x max_size. gutter must be a power of two
+	bool build(const std::vector<std::string>& files, const std::string& bake_path, bool compress,
+		int gutter = 16, int max_size = 4096);
+
+	// Hand the built atlas to a texture cache, which streams its levels in like the
+	// loaded textures. On the GL thread
+	GLuint upload(texture_cache& cache);
+
+	// Give the texture back to the cache it was uploaded to
+	void release(texture_cache& cache);
+
+	bool isBuilt() const { return !entries.empty(); }
+
+	// The entry of an image file, or -1 if it isn't in the atlas
+	int find(const std::string& file) const;
+
+	// Move a texture coordinate in [0, 1] of an entry's image to where it is in the atlas
+	void remap(int entry, GLfloat texcoord[2]) const;
+
+	std::vector<atlas_entry> entries;
+	int width, height;
+	int channels;		// 4 if any image has alpha, 3 otherwise
+	int levels;
+	bool from_bake;		// Loaded from its bake rather than built
+	GLuint texture;		// Set by upload(), owned by the cache
+
+private:
+	texture_atlas(const texture_atlas&);
+	texture_atlas& operator=(const texture_atlas&);
+
+	std::shared_ptr<baked_texture> bake;	// The levels, until uploaded
+};
@@ -0,0 +1,483 @@
+/* texture_bake.cpp
+   File layout: a fixed size header followed by the mip levels, level 0 first, each
+   starting on a 16 byte boundary. All offsets are from the start of the file and
+   everything is stored in the native byte order.
+
+   The mip chain comes from generateMipChain, filtered in linear light. The BC1/BC3
+   encoder is the simple bounding box one (van Waveren, "Real-Time DXT Compression"):
+   the endpoints are the corners of the block's colour bounding box pulled in by a
+   sixteenth, and each texel takes the nearest of the four palette colours. It is fast
+   rather than the best quality.
+*/
+
+#include "texture_bake.h"
+#include "texture_cache.h"
+#include "mip_generate.h"
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+
+static const char texture_bake_magic[4] = { 'G', 'T', 'E', 'X' };
+// 2: the mip levels are filtered in linear light
+static const uint32_t texture_bake_version = 2;
+static const int max_bake_levels = 16;
+
+struct texture_bake_header
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t source_size;
+	uint64_t source_mtime;
+	uint64_t source_hash;
+	uint64_t build_options;
+	uint32_t internal_format;
+	uint32_t pixel_format;
+	uint32_t width;
+	uint32_t height;
+	uint32_t level_count;
+	uint32_t padding;
+	uint64_t level_offset[max_bake_levels];
+	uint64_t level_size[max_bake_levels];
+};
+
+static int levelCount(int width, int height)
+{
+	int levels = 1;
+	while ((std::max(width, height) >> levels) > 0) levels++;
+	return levels;
+}
+
+
+static size_t levelBytes(int width, int height, int texel_bytes, bool compressed)
+{
+	if (compressed) return size_t((width + 3) / 4) * ((height + 3) / 4) * (texel_bytes == 3 ? 8 : 16);
+	return size_t(width) * height * texel_bytes;
+}
+
+
+size_t bakedTextureBytes(int width, int height, int channels, bool compress, bool mipmaps)
+{
+	int texel_bytes = (channels == 1 || channels == 3) ? 3 : 4;
+	int levels = mipmaps ? levelCount(width, height) : 1;
+	size_t bytes = 0;
+	for (int l = 0; l < levels; l++)
+	{
+		bytes += levelBytes(std::max(width >> l, 1), std::max(height >> l, 1), texel_bytes, compress);
+	}
+	return bytes;
+}
+
+
+bool makeTextureBakeKey(const string& source_path, const mapped_file& source, bool compress, texture_bake_key& key)
+{
+	if (!fileStat(source_path, key.source_size, key.source_mtime)) return false;
+
+	key.source_hash = hashBytes(source.data(), source.size());
+	key.build_options = compress ? 1 : 0;
+	return true;
+}
+
+
+static unsigned short packColour(const int rgb[3])
+{
+	return (unsigned short)(((rgb[0] >> 3) << 11) | ((rgb[1] >> 2) << 5) | (rgb[2] >> 3));
+}
+
+
+static void unpackColour(unsigned short packed, int rgb[3])
+{
+	int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+	rgb[0] = (r << 3) | (r >> 2);
+	rgb[1] = (g << 2) | (g >> 4);
+	rgb[2] = (b << 3) | (b >> 2);
+}
+
+
+/* The colour half of a BC1 or BC3 block, always in the four colour mode */
+static void encodeColourBlock(const unsigned char texels[16][4], unsigned char* out)
+{
+	int low[3] = { 255, 255, 255 }, high[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; i++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			low[c] = std::min(low[c], int(texels[i][c]));
+			high[c] = std::max(high[c], int(texels[i][c]));
+		}
+	}
+	for (int c = 0; c < 3; c++)
+	{
+		int inset = (high[c] - low[c]) >> 4;
+		low[c] += inset;
+		high[c] -= inset;
+	}
+
+	unsigned short colour0 = packColour(high), colour1 = packColour(low);
+	if (colour0 < colour1) std::swap(colour0, colour1);
+
+	unsigned int indices = 0;
+	if (colour0 != colour1)
+	{
+		int palette[4][3];
+		unpackColour(colour0, palette[0]);
+		unpackColour(colour1, palette[1]);
+		for (int c = 0; c < 3; c++)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0, best_distance = 0x7fffffff;
+			for (int p = 0; p < 4; p++)
+			{
+				int distance = 0;
+				for (int c = 0; c < 3; c++)
+				{
+					int d = int(texels[i][c]) - palette[p][c];
+					distance += d * d;
+				}
+				if (distance < best_distance)
+				{
+					best = p;
+					best_distance = distance;
+				}
+			}
+			indices |= unsigned(best) << (2 * i);
+		}
+	}
+
+	out[0] = colour0 & 0xff;
+	out[1] = colour0 >> 8;
+	out[2] = colour1 & 0xff;
+	out[3] = colour1 >> 8;
+	for (int b = 0; b < 4; b++) out[4 + b] = (indices >> (8 * b)) & 0xff;
+}
+
+
+/* The alpha half of a BC3 block, in the eight value mode */
+static void encodeAlphaBlock(const unsigned char texels[16][4], unsigned char* out)
+{
+	int alpha0 = 0, alpha1 = 255;
+	for (int i = 0; i < 16; i++)
+	{
+		alpha0 = std::max(alpha0, int(texels[i][3]));
+		alpha1 = std::min(alpha1, int(texels[i][3]));
+	}
+
+	uint64_t indices = 0;
+	if (alpha0 != alpha1)
+	{
+		int palette[8] = { alpha0, alpha1 };
+		for (int p = 1; p < 7; p++) palette[p + 1] = ((7 - p) * alpha0 + p * alpha1) / 7;
+
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0, best_distance = 256;
+			for (int p = 0; p < 8; p++)
+			{
+				int distance = abs(int(texels[i][3]) - palette[p]);
+				if (distance < best_distance)
+				{
+					best = p;
+					best_distance = distance;
+				}
+			}
+			indices |= uint64_t(best) << (3 * i);
+		}
+	}
+
+	out[0] = (unsigned char)alpha0;
+	out[1] = (unsigned char)alpha1;
+	for (int b = 0; b < 6; b++) out[2 + b] = (indices >> (8 * b)) & 0xff;
+}
+
+
+/* Compress one level to BC1 (3 channels) or BC3 (4 channels). Blocks hanging over the
+   edge repeat the last row or column */
+static void encodeLevel(const unsigned char* texels, int width, int height, int channels, unsigned char* out)
+{
+	unsigned char block[16][4];
+	for (int by = 0; by < height; by += 4)
+	{
+		for (int bx = 0; bx < width; bx += 4)
+		{
+			for (int i = 0; i < 16; i++)
+			{
+				int x = std::min(bx + (i & 3), width - 1);
+				int y = std::min(by + (i >> 2), height - 1);
+				const unsigned char* texel = texels + (size_t(y) * width + x) * channels;
+				for (int c = 0; c < 4; c++) block[i][c] = (c < channels) ? texel[c] : 255;
+			}
+
+			if (channels == 4)
+			{
+				encodeAlphaBlock(block, out);
+				out += 8;
+			}
+			encodeColourBlock(block, out);
+			out += 8;
+		}
+	}
+}
+
+
+baked_texture::baked_texture()
+{
+	internal_format = 0;
+	pixel_format = 0;
+}
+
+
+size_t baked_texture::size() const
+{
+	size_t bytes = 0;
+	for (size_t l = 0; l < levels.size(); l++) bytes += levels[l].size;
+	return bytes;
+}
+
+
+void baked_texture::build(const decoded_image& image, bool compress)
+{
+	int channels = image.nrChannels;
+	int level_count = std::min(levelCount(image.width, image.height), max_bake_levels);
+	if (compress)
+	{
+		internal_format = (channels == 3) ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		pixel_format = 0;
+	}
+	else
+	{
+		internal_format = (channels == 3) ? GL_RGB8 : GL_RGBA8;
+		pixel_format = (channels == 3) ? GL_RGB : GL_RGBA;
+	}
+
+	levels.resize(level_count);
+	size_t total = 0;
+	for (int l = 0; l < level_count; l++)
+	{
+		levels[l].width = std::max(image.width >> l, 1);
+		levels[l].height = std::max(image.height >> l, 1);
+		levels[l].size = levelBytes(levels[l].width, levels[l].height, channels, compress);
+		total += levels[l].size;
+	}
+	storage.resize(total);
+	vector<unsigned char*> stored(level_count);
+	size_t offset = 0;
+	for (int l = 0; l < level_count; l++)
+	{
+		stored[l] = storage.data() + offset;
+		levels[l].data = stored[l];
+		offset += levels[l].size;
+	}
+
+	// Uncompressed chains are built in place, compressed ones in a scratch buffer first
+	vector<unsigned char> scratch;
+	vector<unsigned char*> texels = stored;
+	if (compress)
+	{
+		vector<size_t> scratch_offsets(level_count + 1, 0);
+		for (int l = 0; l < level_count; l++)
+		{
+			scratch_offsets[l + 1] = scratch_offsets[l] + levelBytes(levels[l].width, levels[l].height, channels, false);
+		}
+		scratch.resize(scratch_offsets[level_count]);
+		for (int l = 0; l < level_count; l++) texels[l] = scratch.data() + scratch_offsets[l];
+	}
+
+	memcpy(texels[0], image.data, size_t(image.width) * image.height * channels);
+	generateMipChain(texels.data(), level_count, image.width, image.height, channels, true);
+
+	if (compress)
+	{
+		for (int l = 0; l < level_count; l++) encodeLevel(texels[l], levels[l].width, levels[l].height, channels, stored[l]);
+	}
+}
+
+
+void baked_texture::adopt(vector<unsigned char>& texels, const vector<size_t>& level_offsets, int width, int height, int channels,
+	bool compress)
+{
+	levels.resize(level_offsets.size() - 1);
+	if (!compress)
+	{
+		internal_format = (channels == 3) ? GL_RGB8 : GL_RGBA8;
+		pixel_format = (channels == 3) ? GL_RGB : GL_RGBA;
+		storage.swap(texels);
+		texels.clear();
+
+		for (size_t l = 0; l < levels.size(); l++)
+		{
+			levels[l].data = storage.data() + level_offsets[l];
+			levels[l].size = level_offsets[l + 1] - level_offsets[l];
+			levels[l].width = std::max(width >> l, 1);
+			levels[l].height = std::max(height >> l, 1);
+		}
+		return;
+	}
+
+	internal_format = (channels == 3) ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	pixel_format = 0;
+	size_t total = 0;
+	for (size_t l = 0; l < levels.size(); l++)
+	{
+		levels[l].width = std::max(width >> l, 1);
+		levels[l].height = std::max(height >> l, 1);
+		levels[l].size = levelBytes(levels[l].width, levels[l].height, channels, true);
+		total += levels[l].size;
+	}
+	storage.resize(total);
+	size_t offset = 0;
+	for (size_t l = 0; l < levels.size(); l++)
+	{
+		levels[l].data = storage.data() + offset;
+		encodeLevel(texels.data() + level_offsets[l], levels[l].width, levels[l].height, channels, storage.data() + offset);
+		offset += levels[l].size;
+	}
+	vector<unsigned char>().swap(texels);
+}
+
+
+bool baked_texture::write(const string& bake_path, const texture_bake_key& key) const
+{
+	texture_bake_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, texture_bake_magic, sizeof(header.magic));
+	header.version = texture_bake_version;
+	header.source_size = key.source_size;
+	header.source_mtime = key.source_mtime;
+	header.source_hash = key.source_hash;
+	header.build_options = key.build_options;
+	header.internal_format = internal_format;
+	header.pixel_format = pixel_format;
+	header.width = levels.empty() ? 0 : levels[0].width;
+	header.height = levels.empty() ? 0 : levels[0].height;
+	header.level_count = uint32_t(levels.size());
+
+	uint64_t offset = sizeof(header);
+	for (size_t l = 0; l < levels.size(); l++)
+	{
+		header.level_offset[l] = alignOffset(offset);
+		header.level_size[l] = levels[l].size;
+		offset = header.level_offset[l] + levels[l].size;
+	}
+
+	file_block first = { 0, &header, sizeof(header) };
+	vector<file_block> blocks(1, first);
+	for (size_t l = 0; l < levels.size(); l++)
+	{
+		file_block block = { header.level_offset[l], levels[l].data, levels[l].size };
+		blocks.push_back(block);
+	}
+	return writeFileAtomic(bake_path, blocks.data(), blocks.size());
+}
+
+
+bool baked_texture::open(const string& bake_path, const texture_bake_key& key)
+{
+	levels.clear();
+	storage.clear();
+	file.close();
+	if (!file.open(bake_path)) return false;
+
+	if (file.size() < sizeof(texture_bake_header))
+	{
+		file.close();
+		return false;
+	}
+
+	const texture_bake_header* h = reinterpret_cast<const texture_bake_header*>(file.data());
+
+	// Reject bakes from another format version or another version of the source file
+	bool valid = memcmp(h->magic, texture_bake_magic, sizeof(h->magic)) == 0 &&
+		h->version == texture_bake_version &&
+		h->source_size == key.source_size &&
+		h->source_mtime == key.source_mtime &&
+		h->source_hash == key.source_hash &&
+		h->build_options == key.build_options &&
+		h->level_count > 0 && h->level_count <= uint32_t(max_bake_levels);
+
+	// And any that are truncated
+	for (uint32_t l = 0; valid && l < h->level_count; l++)
+	{
+		valid = h->level_offset[l] + h->level_size[l] <= file.size();
+	}
+
+	if (!valid)
+	{
+		file.close();
+		return false;
+	}
+
+	internal_format = h->internal_format;
+	pixel_format = h->pixel_format;
+	levels.resize(h->level_count);
+	for (uint32_t l = 0; l < h->level_count; l++)
+	{
+		levels[l].data = file.data() + h->level_offset[l];
+		levels[l].size = size_t(h->level_size[l]);
+		levels[l].width = std::max(int(h->width) >> l, 1);
+		levels[l].height = std::max(int(h->height) >> l, 1);
+	}
+	return true;
+}
+
+
+bool bakeTexture(const string& filename, const mapped_file& source, bool compress, baked_texture& baked)
+{
+	string bake_path = filename + ".texcache";
+	texture_bake_key key;
+	bool have_key = makeTextureBakeKey(filename, source, compress, key);
+	if (have_key && baked.open(bake_path, key)) return true;
+
+	decoded_image image;
+	if (!decodeImage(source.data(), source.size(), filename, image)) return false;
+	baked.build(image, compress);
+
+	// The bake is only an optimisation, so carry on with the one in memory if it can't be written
+	if (have_key) baked.write(bake_path, key);
+	return true;
+}
+
+
+/* Each image is baked from scratch, then its bake is loaded back. The sizes are of
+   every level, against the RGBA8 mip chain glGenerateMipmap would have made */
+void bakeTextures(const vector<string>& files, bool compress)
+{
+	printf("%-24s %10s %8s %10s %10s %10s %10s\n", "file", "size", "format", "bake ms", "load ms", "KB", "RGBA8 KB");
+
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		mapped_file source;
+		if (!source.open(files[i])) {
+			cerr << "Cannot open file [" << files[i] << "]" << endl;
+			continue;
+		}
+		remove((files[i] + ".texcache").c_str());
+
+		baked_texture baked;
+		auto start = chrono::high_resolution_clock::now();
+		if (!bakeTexture(files[i], source, compress, baked)) continue;
+		double bake_ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+
+		baked_texture loaded;
+		texture_bake_key key;
+		start = chrono::high_resolution_clock::now();
+		bool reloaded = makeTextureBakeKey(files[i], source, compress, key) && loaded.open(files[i] + ".texcache", key);
+		double load_ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+		if (!reloaded) cerr << "Cannot write the bake of [" << files[i] << "]" << endl;
+
+		const char* format = baked.isCompressed() ? (baked.internal_format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ? "BC1" : "BC3") :
+			(baked.pixel_format == GL_RGB ? "RGB8" : "RGBA8");
+		char size[32];
+		snprintf(size, sizeof(size), "%dx%d", baked.levels[0].width, baked.levels[0].height);
+		printf("%-24s %10s %8s %10.2f %10.2f %10.1f %10.1f\n", files[i].c_str(), size, format, bake_ms,
+			load_ms, baked.size() / 1024.0,
+			bakedTextureBytes(baked.levels[0].width, baked.levels[0].height, 4, false, true) / 1024.0);
+	}
+}
@@ -0,0 +1,98 @@
+/* texture_bake.h
+   Baked textures, written next to the image as <image>.texcache the first time it is
+   loaded. A bake holds the image's whole mip chain, built on the CPU by mip_generate.h,
+   already in the format the texture has on the GPU: BC1 (DXT1) for opaque images and
+   BC3 (DXT5) for images with alpha, or RGB8/RGBA8 if compression is turned off. Later
+   loads memory map the bake and upload its levels as they are, without decoding the
+   image or running glGenerateMipmap.
+
+   Like the mesh cache, a bake is only used if it was made from a source file with the
+   same size, modification time and content hash, with the same options, by the same
+   version of the format.
+*/
+
+#pragma once
+
+#include "wrapper_glfw.h"
+#include "file_utils.h"
+#include <string>
+#include <vector>
+
+// From EXT_texture_compression_s3tc, which the GL 4.0 headers don't include
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+struct decoded_image;
+
+// Identifies the exact source image a bake was made from
+struct texture_bake_key
+{
+	uint64_t source_size;
+	uint64_t source_mtime;
+	uint64_t source_hash;
+	uint64_t build_options;		// Whether the levels are compressed
+};
+
+bool makeTextureBakeKey(const std::string& source_path, const mapped_file& source, bool compress, texture_bake_key& key);
+
+// One mip level, pointing into the bake
+struct texture_level
+{
+	const unsigned char* data;
+	size_t size;
+	int width, height;
+};
+
+struct texture_bake_header;
+
+/* The mip chain of a texture, either memory mapped from a bake file or built from a
+   decoded image. The level pointers are valid while the bake is open */
+class baked_texture
+{
+public:
+	baked_texture();
+
+	// Map a bake file, false if it doesn't exist or wasn't made from this source
+	bool open(const std::string& bake_path, const texture_bake_key& key);
+
+	// Build the mip chain of an image in memory, compressing it if asked to
+	void build(const decoded_image& image, bool compress);
+
+	// Take over a mip chain of RGB8 or RGBA8 levels built elsewhere, such as an atlas,
+	// compressing it if asked to. level_offsets has one more entry than there are levels,
+	// the last being the size
+	void adopt(std::vector<unsigned char>& texels, const std::vector<size_t>& level_offsets, int width, int height, int channels,
+		bool compress);
+
+	bool write(const std::string& bake_path, const texture_bake_key& key) const;
+
+	bool isOpen() const { return !levels.empty(); }
+	bool isCompressed() const { return pixel_format == 0; }
+	size_t size() const;	// Bytes of every level
+
+	GLenum internal_format;		// For glTexImage2D or glCompressedTexImage2D
+	GLenum pixel_format;		// GL_RGB or GL_RGBA for uncompressed levels, 0 if compressed
+	std::vector<texture_level> levels;	// Level 0 first
+
+private:
+	baked_texture(const baked_texture&);
+	baked_texture& operator=(const baked_texture&);
+
+	mapped_file file;
+	std::vector<unsigned char> storage;		// The levels, when built in memory
+};
+
+// Load the bake of an image file, or decode the image and bake it if there isn't an up
+// to date one, writing the bake for next time. False if the image can't be read
+bool bakeTexture(const std::string& filename, const mapped_file& source, bool compress, baked_texture& baked);
+
+// The bytes a baked texture of a width x height image will have, with its mip chain
+// or just level 0. channels is the number of channels the image file has
+size_t bakedTextureBytes(int width, int height, int channels, bool compress, bool mipmaps);
+
+// Bake each image file and report the time taken and the sizes, for -baketextures
+void bakeTextures(const std::vector<std::string>& files, bool compress);
@@ -0,0 +1,625 @@
+/* texture_cache.cpp
+   load() maps and hashes a file the first time its path is asked for, on the GL thread,
+   which for images of a few hundred KB costs well under a millisecond. The decode job
+   then reads the same mapping, so the file is only read from disk once. Later requests
+   for the same path reuse its hash without touching the file, so an image edited while
+   the program runs isn't seen until clear().
+
+   The placeholder is a 1x1 level 0. An upload first sets GL_TEXTURE_MAX_LEVEL to the
+   smallest level it will send, then after each level moves GL_TEXTURE_BASE_LEVEL down to
+   it, so the texture is always complete and only samples levels that have arrived. The
+   real level 0, once it's wanted, replaces the placeholder last. Textures that aren't
+   mipmapped only get level 0 of their bake.
+
+   A level that fits in what is left of the budget is defined and filled in one call.
+   A larger one has its storage defined first, without texels, then is filled in bands
+   of whole rows (rows of 4x4 blocks if compressed) with glTexSubImage2D or
+   glCompressedTexSubImage2D. BASE_LEVEL only moves once the last band is in, so a
+   mipmapped texture never samples a part filled level. A texture without mipmaps has
+   nothing else to sample, so while a level 0 larger than the budget is filled it shows
+   the undefined texels of the bands still to come.
+
+   Each band orphans the pixel buffer before mapping it, so writing a band never waits
+   for the GPU to finish reading the one before.
+*/
+
+#include "texture_cache.h"
+#include "texture_bake.h"
+#include "thread_pool.h"
+#include "file_utils.h"
+#include "stb_image.h"
+#include <stdio.h>
+#include <cstring>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+decoded_image::~decoded_image()
+{
+	if (data) stbi_image_free(data);
+}
+
+
+bool decodeImage(const unsigned char* bytes, size_t size, const string& filename, decoded_image& image)
+{
+	/* decode an image file using stb_image, as RGB if it has no alpha and RGBA otherwise
+	   so that grey images don't need formats of their own */
+	int channels = 0;
+	stbi_info_from_memory(bytes, int(size), &image.width, &image.height, &channels);
+	int wanted = (channels == 1 || channels == 3) ? 3 : 4;
+	if (size > 0) image.data = stbi_load_from_memory(bytes, int(size), &image.width, &image.height, &channels, wanted);
+	image.nrChannels = wanted;
+	if (!image.data)
+	{
+		printf("stb_image  loading error: filename=%s\n", filename.c_str());
+		return false;
+	}
+	return true;
+}
+
+
+/* Images the decode jobs have finished with, waiting for update() to pick them up */
+struct texture_cache::decode_queue
+{
+	struct decoded_texture
+	{
+		GLuint texture;
+		unsigned ticket;
+		shared_ptr<baked_texture> baked;	// Not open if the file couldn't be decoded
+	};
+
+	mutex lock;
+	vector<decoded_texture> done;
+};
+
+
+static const GLubyte placeholder_texel[4] = { 128, 128, 128, 255 };
+
+
+bool texture_cache::texture_key::operator<(const texture_key& other) const
+{
+	if (hash != other.hash) return hash < other.hash;
+	if (size != other.size) return size < other.size;
+	return mipmaps < other.mipmaps;
+}
+
+
+/* Whether the driver has EXT_texture_compression_s3tc, which BC1/BC3 levels need.
+   Asked once, on the GL thread */
+static bool s3tcSupported()
+{
+	static int supported = -1;
+	if (supported < 0)
+	{
+		supported = 0;
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+		for (GLint i = 0; i < count && !supported; i++)
+		{
+			const char* name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, GLuint(i)));
+			if (name && strcmp(name, "GL_EXT_texture_compression_s3tc") == 0) supported = 1;
+		}
+	}
+	return supported == 1;
+}
+
+
+/* The memory the texture of the image in a file will take once it's resident. Just
+   the placeholder if the file isn't an image stb_image knows */
+static size_t textureBytes(const mapped_file& file, bool compress, bool mipmaps)
+{
+	int width, height, channels;
+	if (file.size() == 0 || !stbi_info_from_memory(file.data(), int(file.size()), &width, &height, &channels)) return 4;
+	return bakedTextureBytes(width, height, channels, compress, mipmaps);
+}
+
+
+texture_cache::texture_cache() : decoded(make_shared<decode_queue>())
+{
+	pixel_buffer = 0;
+	outstanding = 0;
+	next_ticket = 0;
+	frame = 0;
+	compress = true;
+	memory_budget = size_t(256) * 1024 * 1024;
+	counters.requests = counters.hits = counters.content_hits = counters.bytes_saved = 0;
+	residency_counters.resident_bytes = residency_counters.requested_bytes = 0;
+	residency_counters.uploaded_bytes = residency_counters.evicted_bytes = 0;
+}
+
+
+/* The shared cache outlives the GL context, so the textures are only deleted by clear() */
+texture_cache::~texture_cache()
+{
+}
+
+
+/* A placeholder texture and its entry, waiting for its levels */
+texture_cache::texture_entry& texture_cache::addEntry(GLuint texture, const texture_key& key, size_t bytes)
+{
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder_texel);
+
+	texture_entry& entry = entries[texture];
+	entry.key = key;
+	entry.refs = 1;
+	entry.bytes = bytes;
+	entry.ticket = next_ticket++;
+	entry.decoding = true;
+	entry.pending = true;
+	entry.held = false;
+	entry.baked.reset();
+	entry.level_count = 0;
+	entry.resident_level = 0;
+	entry.next_row = 0;
+	entry.wanted_level = 0;
+	entry.requested_size = -1.f;
+	entry.last_request = 0;
+	outstanding++;
+	return entry;
+}
+
+
+/* Without S3TC the compressed bakes couldn't be uploaded, so bake uncompressed instead */
+bool texture_cache::compression()
+{
+	if (compress && !s3tcSupported())
+	{
+		printf("texture_cache: GL_EXT_texture_compression_s3tc isn't supported, textures won't be compressed\n");
+		compress = false;
+	}
+	return compress;
+}
+
+
+GLuint texture_cache::load(const string& filename, bool mipmaps)
+{
+	compression();
+
+	// Hash the file the first time its path is seen
+	shared_ptr<mapped_file> source;
+	texture_key key;
+	unordered_map<string, texture_key>::const_iterator file = files.find(filename);
+	if (file != files.end())
+	{
+		key = file->second;
+	}
+	else
+	{
+		source = make_shared<mapped_file>();
+		if (!source->open(filename))
+		{
+			printf("texture_cache: can't open %s\n", filename.c_str());
+			return 0;
+		}
+		key.hash = hashBytes(source->data(), source->size());
+		key.size = source->size();
+		key.mipmaps = false;
+		files[filename] = key;
+	}
+	key.mipmaps = mipmaps;
+	counters.requests++;
+
+	map<texture_key, GLuint>::const_iterator found = by_content.find(key);
+	if (found != by_content.end())
+	{
+		texture_entry& entry = entries[found->second];
+		entry.refs++;
+		counters.hits++;
+		if (source) counters.content_hits++;
+		counters.bytes_saved += entry.bytes;
+		return found->second;
+	}
+
+	// Only seen before with the other mipmapping, so it hasn't been kept open
+	if (!source)
+	{
+		source = make_shared<mapped_file>();
+		if (!source->open(filename))
+		{
+			counters.requests--;
+			printf("texture_cache: can't open %s\n", filename.c_str());
+			return 0;
+		}
+	}
+
+	// A 1x1 texture until the image has been decoded and its storage made
+	GLuint texture;
+	glGenTextures(1, &texture);
+	texture_entry& entry = addEntry(texture, key, textureBytes(*source, compress, mipmaps));
+	by_content[key] = texture;
+
+	// If mipmaps are not used then ensure that the min filter is defined
+	if (!mipmaps) glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+	shared_ptr<decode_queue> queue = decoded;
+	unsigned ticket = entry.ticket;
+	bool compress_bake = compress;
+	worker_pool().submit([queue, source, filename, texture, ticket, compress_bake]()
+	{
+		decode_queue::decoded_texture result = { texture, ticket, make_shared<baked_texture>() };
+		bakeTexture(filename, *source, compress_bake, *result.baked);
+
+		lock_guard<mutex> lock(queue->lock);
+		queue->done.push_back(result);
+	});
+	return texture;
+}
+
+
+GLuint texture_cache::add(shared_ptr<baked_texture> baked)
+{
+	GLuint texture;
+	glGenTextures(1, &texture);
+	texture_key key = { 0, 0, true };
+	texture_entry& entry = addEntry(texture, key, baked->size());
+	startStreaming(entry, texture, baked);
+	return texture;
+}
+
+
+void texture_cache::release(GLuint texture)
+{
+	unordered_map<GLuint, texture_entry>::iterator entry = entries.find(texture);
+	if (entry == entries.end()) return;
+	if (--entry->second.refs > 0) return;
+
+	if (entry->second.pending) outstanding--;
+	residency_counters.resident_bytes -= residentBytes(entry->second);
+
+	// Textures made by add() aren't in by_content
+	map<texture_key, GLuint>::iterator found = by_content.find(entry->second.key);
+	if (found != by_content.end() && found->second == texture) by_content.erase(found);
+	entries.erase(entry);
+	glDeleteTextures(1, &texture);
+}
+
+
+GLuint texture_cache::find(const string& filename, bool mipmaps) const
+{
+	unordered_map<string, texture_key>::const_iterator file = files.find(filename);
+	if (file == files.end()) return 0;
+
+	texture_key key = file->second;
+	key.mipmaps = mipmaps;
+	map<texture_key, GLuint>::const_iterator found = by_content.find(key);
+	return (found != by_content.end()) ? found->second : 0;
+}
+
+
+void texture_cache::request(GLuint texture, float screen_size)
+{
+	unordered_map<GLuint, texture_entry>::iterator entry = entries.find(texture);
+	if (entry == entries.end()) return;
+	entry->second.requested_size = std::max(entry->second.requested_size, std::max(screen_size, 0.f));
+	entry->second.last_request = frame;
+}
+
+
+/* Only sample the placeholder until the first level arrives, and then only the levels sent */
+void texture_cache::startStreaming(texture_entry& entry, GLuint texture, const shared_ptr<baked_texture>& baked)
+{
+	entry.baked = baked;
+	entry.decoding = false;
+	entry.level_count = entry.key.mipmaps ? int(baked->levels.size()) : 1;
+	entry.resident_level = entry.level_count;
+	entry.next_row = 0;
+	entry.wanted_level = std::min(entry.wanted_level, entry.level_count - 1);
+
+	entry.bytes = 0;
+	for (int l = 0; l < entry.level_count; l++) entry.bytes += baked->levels[l].size;
+
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, entry.level_count - 1);
+}
+
+
+/* Define one level of the texture from the bound pixel buffer, or from pixels if it isn't bound.
+   With no buffer bound and no pixels, only its storage is defined */
+void texture_cache::uploadLevel(const baked_texture& baked, int level, const void* pixels)
+{
+	const texture_level& source = baked.levels[level];
+	if (baked.isCompressed())
+	{
+		glCompressedTexImage2D(GL_TEXTURE_2D, level, baked.internal_format, source.width, source.height, 0,
+			GLsizei(source.size), pixels);
+	}
+	else
+	{
+		glTexImage2D(GL_TEXTURE_2D, level, baked.internal_format, source.width, source.height, 0,
+			baked.pixel_format, GL_UNSIGNED_BYTE, pixels);
+	}
+}
+
+
+/* Fill rows [first_row, first_row + rows) of a level whose storage has been defined, from
+   the bound pixel buffer or from pixels. first_row is a multiple of 4 if it's compressed */
+void texture_cache::uploadRows(const baked_texture& baked, int level, int first_row, int rows, size_t bytes, const void* pixels)
+{
+	const texture_level& source = baked.levels[level];
+	if (baked.isCompressed())
+	{
+		glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, first_row, source.width, rows, baked.internal_format,
+			GLsizei(bytes), pixels);
+	}
+	else
+	{
+		glTexSubImage2D(GL_TEXTURE_2D, level, 0, first_row, source.width, rows, baked.pixel_format, GL_UNSIGNED_BYTE, pixels);
+	}
+}
+
+
+size_t texture_cache::residentBytes(const texture_entry& entry) const
+{
+	size_t bytes = 0;
+	for (int l = entry.resident_level; l < entry.level_count; l++) bytes += entry.baked->levels[l].size;
+	if (entry.next_row > 0) bytes += entry.baked->levels[entry.resident_level - 1].size;
+	return bytes;
+}
+
+
+/* Free the level a texture is part way through filling, if it has one */
+void texture_cache::dropPartialLevel(texture_entry& entry, GLuint texture)
+{
+	if (entry.next_row == 0) return;
+
+	int level = entry.resident_level - 1;
+	size_t bytes = entry.baked->levels[level].size;
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	entry.next_row = 0;
+	residency_counters.resident_bytes -= bytes;
+	residency_counters.evicted_bytes += bytes;
+}
+
+
+/* Free the finest resident level of a texture, and the level it was filling above it */
+void texture_cache::evictLevel(texture_entry& entry, GLuint texture)
+{
+	dropPartialLevel(entry, texture);
+
+	size_t bytes = entry.baked->levels[entry.resident_level].size;
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, entry.resident_level + 1);
+	glTexImage2D(GL_TEXTURE_2D, entry.resident_level, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	entry.resident_level++;
+
+	// Until the texture is requested again, or it would be streamed straight back in
+	entry.wanted_level = std::max(entry.wanted_level, entry.resident_level);
+	residency_counters.resident_bytes -= bytes;
+	residency_counters.evicted_bytes += bytes;
+}
+
+
+/* Evict levels of other textures until bytes more fit in the budget. Levels that aren't
+   wanted go first, then the finest of the textures requested longest ago, but never a
+   level of a texture requested as recently as the one that needs the room */
+bool texture_cache::makeRoom(size_t bytes, GLuint texture)
+{
+	unsigned needed_by = entries[texture].last_request;
+	while (residency_counters.resident_bytes + bytes > memory_budget)
+	{
+		unordered_map<GLuint, texture_entry>::iterator victim = entries.end();
+		for (unordered_map<GLuint, texture_entry>::iterator i = entries.begin(); i != entries.end(); ++i)
+		{
+			const texture_entry& entry = i->second;
+			if (i->first == texture || !entry.baked || entry.resident_level + 1 >= entry.level_count) continue;
+			bool unwanted = entry.resident_level < entry.wanted_level;
+			if (!unwanted && entry.last_request >= needed_by) continue;
+			if (victim == entries.end())
+			{
+				victim = i;
+				continue;
+			}
+
+			const texture_entry& best = victim->second;
+			bool best_unwanted = best.resident_level < best.wanted_level;
+			if (unwanted != best_unwanted)
+			{
+				if (unwanted) victim = i;
+			}
+			else if (entry.last_request != best.last_request)
+			{
+				if (entry.last_request < best.last_request) victim = i;
+			}
+			else if (entry.baked->levels[entry.resident_level].size > best.baked->levels[best.resident_level].size)
+			{
+				victim = i;
+			}
+		}
+		if (victim == entries.end()) return false;
+		evictLevel(victim->second, victim->first);
+	}
+	return true;
+}
+
+
+size_t texture_cache::update(size_t budget_bytes)
+{
+	frame++;
+
+	vector<decode_queue::decoded_texture> done;
+	{
+		lock_guard<mutex> lock(decoded->lock);
+		done.swap(decoded->done);
+	}
+
+	for (size_t i = 0; i < done.size(); i++)
+	{
+		// Skip textures released or cleared while their image was being baked
+		unordered_map<GLuint, texture_entry>::iterator entry = entries.find(done[i].texture);
+		if (entry == entries.end() || entry->second.ticket != done[i].ticket) continue;
+		if (!done[i].baked->isOpen())
+		{
+			entry->second.decoding = false;
+			continue;
+		}
+		startStreaming(entry->second, done[i].texture, done[i].baked);
+	}
+
+	// Each requested texture wants the coarsest level still as large as it is drawn
+	for (unordered_map<GLuint, texture_entry>::iterator i = entries.begin(); i != entries.end(); ++i)
+	{
+		texture_entry& entry = i->second;
+		entry.held = false;
+		if (!entry.baked || entry.requested_size < 0.f) continue;
+
+		const texture_level* levels = entry.baked->levels.data();
+		int level = 0;
+		while (level + 1 < entry.level_count && std::max(levels[level + 1].width, levels[level + 1].height) >= entry.requested_size) level++;
+		entry.wanted_level = level;
+		entry.requested_size = -1.f;
+
+		// A level being filled that is no longer wanted gives its memory back
+		if (entry.next_row > 0 && entry.resident_level - 1 < entry.wanted_level) dropPartialLevel(entry, i->first);
+	}
+
+	size_t reached = 0;
+	size_t sent = 0;
+	bool bound = false;
+	while (budget_bytes > 0 && sent < budget_bytes)
+	{
+		// The smallest level any texture is waiting for, of the most recently requested
+		unordered_map<GLuint, texture_entry>::iterator next = entries.end();
+		for (unordered_map<GLuint, texture_entry>::iterator i = entries.begin(); i != entries.end(); ++i)
+		{
+			const texture_entry& entry = i->second;
+			if (!entry.baked || entry.held || entry.resident_level <= entry.wanted_level) continue;
+			if (next == entries.end())
+			{
+				next = i;
+				continue;
+			}
+
+			size_t size = entry.baked->levels[entry.resident_level - 1].size;
+			size_t best = next->second.baked->levels[next->second.resident_level - 1].size;
+			if (size < best || (size == best && entry.last_request > next->second.last_request)) next = i;
+		}
+		if (next == entries.end()) break;
+
+		texture_entry& entry = next->second;
+		int level_index = entry.resident_level - 1;
+		const texture_level& level = entry.baked->levels[level_index];
+
+		// The next band of rows, as many as are left of the budget allows but at least one.
+		// Compressed levels are split between rows of blocks
+		int row_unit = entry.baked->isCompressed() ? 4 : 1;
+		size_t unit_bytes = level.size / ((level.height + row_unit - 1) / row_unit);
+		int first_row = entry.next_row;
+		size_t units = std::max((budget_bytes - sent) / unit_bytes, size_t(1));
+		int rows = int(std::min(size_t(level.height - first_row), units * row_unit));
+		size_t bytes = std::min(size_t((rows + row_unit - 1) / row_unit) * unit_bytes, level.size);
+		bool whole = (first_row == 0 && rows == level.height);
+
+		// The level's memory is taken when its storage is defined
+		if (first_row == 0)
+		{
+			if (!makeRoom(level.size, next->first))
+			{
+				entry.held = true;
+				continue;
+			}
+			residency_counters.resident_bytes += level.size;
+		}
+
+		if (!bound)
+		{
+			if (!pixel_buffer) glGenBuffers(1, &pixel_buffer);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			bound = true;
+		}
+
+		glBindTexture(GL_TEXTURE_2D, next->first);
+		if (first_row == 0 && !whole)
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			uploadLevel(*entry.baked, level_index, 0);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer);
+		}
+
+		const unsigned char* band = level.data + size_t(first_row / row_unit) * unit_bytes;
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, 0, GL_STREAM_DRAW);
+		void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		const void* pixels = 0;
+		if (mapped)
+		{
+			memcpy(mapped, band, bytes);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		}
+		else
+		{
+			// Couldn't map the buffer, so send the band straight from the bake
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			pixels = band;
+		}
+		if (whole) uploadLevel(*entry.baked, level_index, pixels);
+		else uploadRows(*entry.baked, level_index, first_row, rows, bytes, pixels);
+		if (!mapped) glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer);
+
+		sent += bytes;
+		residency_counters.uploaded_bytes += bytes;
+		entry.next_row = first_row + rows;
+		if (entry.next_row < level.height) continue;
+
+		// Only sample the level once it's all there
+		entry.next_row = 0;
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level_index);
+		entry.resident_level = level_index;
+		if (entry.resident_level == entry.wanted_level) reached++;
+	}
+
+	if (bound)
+	{
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+
+	// Textures still to come, and what the requests need
+	outstanding = 0;
+	residency_counters.requested_bytes = 0;
+	for (unordered_map<GLuint, texture_entry>::iterator i = entries.begin(); i != entries.end(); ++i)
+	{
+		texture_entry& entry = i->second;
+		entry.pending = entry.decoding || (entry.baked && !entry.held && entry.resident_level > entry.wanted_level);
+		if (entry.pending) outstanding++;
+
+		if (!entry.baked)
+		{
+			if (entry.decoding) residency_counters.requested_bytes += entry.bytes;
+			continue;
+		}
+		for (int l = entry.wanted_level; l < entry.level_count; l++) residency_counters.requested_bytes += entry.baked->levels[l].size;
+	}
+	return reached;
+}
+
+
+void texture_cache::clear()
+{
+	for (unordered_map<GLuint, texture_entry>::iterator i = entries.begin(); i != entries.end(); ++i)
+	{
+		glDeleteTextures(1, &i->first);
+	}
+	entries.clear();
+	by_content.clear();
+	files.clear();
+	outstanding = 0;
+	residency_counters.resident_bytes = residency_counters.requested_bytes = 0;
+	{
+		lock_guard<mutex> lock(decoded->lock);
+		decoded->done.clear();
+	}
+
+	if (pixel_buffer) glDeleteBuffers(1, &pixel_buffer);
+	pixel_buffer = 0;
+}
+
+
+texture_cache& shared_textures()
+{
+	static texture_cache cache;
+	return cache;
+}
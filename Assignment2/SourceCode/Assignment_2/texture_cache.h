@@ -0,0 +1,186 @@
+/* texture_cache.h
+   One texture per image file, shared by every model whose materials use it. The obj
+   loader asks the cache for each material's diffuse map, so an image used by several
+   materials or several models is only decoded and uploaded once.
+
+   Textures are streamed in. load() returns a texture name straight away that can be
+   bound at once and shows a grey placeholder. A worker thread loads the image's bake
+   (texture_bake.h), baking it first if need be, then update(), called once a frame,
+   uploads its mip levels through a pixel buffer object, smallest first, until a byte
+   budget is used up. A level larger than what is left of the budget is sent in bands
+   of rows over several frames. The texture sharpens as the levels arrive, and only
+   whole levels are ever sampled.
+
+   Which levels are resident is driven by how large each texture is drawn. Models
+   request() their textures every frame with the size they cover on screen, and a
+   texture only streams in down to the coarsest level that is at least that size. A
+   texture that has never been requested streams in every level. Levels that are no
+   longer wanted stay resident until memory_budget is reached; then uploads take the
+   memory of unwanted levels first and of the textures requested longest ago after, a
+   level at a time from the finest. The coarsest level of a texture is never evicted.
+   Each evicted level is redefined as 0x0, which frees it, below GL_TEXTURE_BASE_LEVEL
+   where it doesn't affect the texture's completeness. The bakes stay mapped so evicted
+   levels can be streamed in again.
+
+   Textures are keyed by a hash of the image file's contents and whether they are
+   mipmapped, so identical images in different files also share one texture. Every
+   load() takes a reference to the texture it returns, and the texture is deleted when
+   the last reference is given back with release().
+
+   The cache must only be used on the GL thread.
+*/
+
+#pragma once
+
+#include "wrapper_glfw.h"
+#include <string>
+#include <unordered_map>
+#include <map>
+#include <memory>
+#include <cstdint>
+
+class baked_texture;
+
+/* An image decoded by stb_image, freed when the upload is done with it */
+struct decoded_image
+{
+	int width, height, nrChannels;
+	unsigned char* data;
+
+	decoded_image() { data = 0; }
+	~decoded_image();
+};
+
+// Decode an image file held in memory into 3 channels if it has no alpha and 4 if it
+// has, printing an error naming the file and leaving image.data null if it can't be read
+bool decodeImage(const unsigned char* bytes, size_t size, const std::string& filename, decoded_image& image);
+
+// How much the cache has been able to share
+struct texture_cache_stats
+{
+	size_t requests;		// Calls to load() that returned a texture
+	size_t hits;			// Requests given a texture that already existed
+	size_t content_hits;	// Hits from a file the cache hadn't seen, with the same image as another
+	size_t bytes_saved;		// Texture memory the hits didn't allocate
+};
+
+// Texture memory against what the textures have been requested at
+struct texture_residency_stats
+{
+	size_t resident_bytes;		// Of the levels uploaded
+	size_t requested_bytes;		// Of the levels down to each texture's wanted level, as of the last update()
+	size_t uploaded_bytes;		// Since the cache was made, including levels uploaded again after eviction
+	size_t evicted_bytes;
+};
+
+class texture_cache
+{
+public:
+	texture_cache();
+	~texture_cache();
+
+	// Take a reference to the texture of an image file, requesting it if no file with the
+	// same contents has been loaded with the same mipmapping. The name is valid straight
+	// away and shows the placeholder until the image is resident. Returns 0 and prints an
+	// error if the file can't be opened
+	GLuint load(const std::string& filename, bool mipmaps = true);
+
+	// Give back a reference taken by load(), deleting the texture if it was the last
+	void release(GLuint texture);
+
+	// Stream a mip chain baked elsewhere, such as an atlas, like the loaded textures.
+	// Returns the texture with one reference. It is never shared with load()
+	GLuint add(std::shared_ptr<baked_texture> baked);
+
+	// The texture of a file that has already been loaded, or 0. Doesn't take a reference
+	GLuint find(const std::string& filename, bool mipmaps = true) const;
+
+	// Ask for a texture to be resident for drawing this frame with its level 0 covering
+	// screen_size pixels across. The largest size asked for since the last update() is used
+	void request(GLuint texture, float screen_size);
+
+	// Start the uploads of any images that have been baked, then upload mip levels,
+	// smallest first across every texture, towards the level each was last requested at
+	// until budget_bytes have been sent (at least one band of rows, if the budget isn't 0).
+	// Called once a frame. Returns the number of textures that reached their level
+	size_t update(size_t budget_bytes);
+
+	// Textures still decoding or with levels to come. A file that fails to load keeps its
+	// placeholder and stops counting here, as does a texture whose next level doesn't fit
+	// in memory_budget
+	size_t pending() const { return outstanding; }
+
+	// The number of textures that haven't been released
+	size_t size() const { return entries.size(); }
+
+	const texture_cache_stats& stats() const { return counters; }
+	const texture_residency_stats& residency() const { return residency_counters; }
+
+	// Delete every texture whatever its references, must be called while the GL context
+	// still exists. Images still being decoded are dropped when they finish
+	void clear();
+
+	// Whether textures are baked compressed: compress, turned off the first time if the
+	// driver doesn't have S3TC. Read it here on the GL thread before baking elsewhere
+	bool compression();
+
+	bool compress;			// Bake the textures as BC1/BC3 rather than RGB8/RGBA8, true by default
+	size_t memory_budget;	// Bytes of resident levels to evict down to, 256 MB by default
+
+private:
+	texture_cache(const texture_cache&);
+	texture_cache& operator=(const texture_cache&);
+
+	struct decode_queue;
+
+	// What makes two loads the same texture
+	struct texture_key
+	{
+		uint64_t hash;		// Of the file's contents
+		uint64_t size;
+		bool mipmaps;
+
+		bool operator<(const texture_key& other) const;
+	};
+
+	struct texture_entry
+	{
+		texture_key key;
+		unsigned refs;
+		size_t bytes;		// Of the texture once it's resident, including any mip chain
+		unsigned ticket;	// Matches the texture's decode job, names can be reused once deleted
+		bool decoding;		// Waiting for the decode job
+		bool pending;		// Counted by pending()
+		bool held;			// The next level didn't fit in the memory budget this update
+		std::shared_ptr<baked_texture> baked;	// The levels, once decoded
+		int level_count;		// Of the bake that are used, 1 if not mipmapped
+		int resident_level;		// The finest level uploaded, level_count if none
+		int next_row;			// Rows of the level above resident_level sent so far, 0 if none
+		int wanted_level;		// The finest level to stream in, 0 until requested
+		float requested_size;	// The largest request since the last update, negative if none
+		unsigned last_request;	// The update the texture was last requested in
+	};
+
+	texture_entry& addEntry(GLuint texture, const texture_key& key, size_t bytes);
+	void startStreaming(texture_entry& entry, GLuint texture, const std::shared_ptr<baked_texture>& baked);
+	void uploadLevel(const baked_texture& baked, int level, const void* pixels);
+	void uploadRows(const baked_texture& baked, int level, int first_row, int rows, size_t bytes, const void* pixels);
+	bool makeRoom(size_t bytes, GLuint texture);
+	void dropPartialLevel(texture_entry& entry, GLuint texture);
+	void evictLevel(texture_entry& entry, GLuint texture);
+	size_t residentBytes(const texture_entry& entry) const;
+
+	std::unordered_map<GLuint, texture_entry> entries;
+	std::map<texture_key, GLuint> by_content;
+	std::unordered_map<std::string, texture_key> files;	// The contents of each file that has been read, mipmaps unset
+	std::shared_ptr<decode_queue> decoded;		// Shared with the decode jobs, which may outlive the cache
+	GLuint pixel_buffer;
+	size_t outstanding;
+	unsigned next_ticket;
+	unsigned frame;			// Counts the calls to update()
+	texture_cache_stats counters;
+	texture_residency_stats residency_counters;
+};
+
+// The cache the models use unless they are given another
+texture_cache& shared_textures();
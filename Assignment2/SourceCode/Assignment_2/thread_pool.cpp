@@ -0,0 +1,152 @@
+/* thread_pool.cpp
+   Worker threads wait on a job queue. parallel_for() queues one helper job per
+   extra chunk, then all participants take chunk numbers from a shared counter
+   until none are left. Helper jobs that start after the work has been taken
+   simply return, so the caller only waits for chunks, never for queue slots.
+*/
+
+#include "thread_pool.h"
+#include <atomic>
+#include <algorithm>
+
+using namespace std;
+
+/* Start numthreads workers, or one less than the number of hardware threads
+   since the calling thread also works on parallel_for ranges */
+thread_pool::thread_pool(unsigned numthreads)
+{
+	stopping = false;
+
+	if (numthreads == 0)
+	{
+		unsigned hw = thread::hardware_concurrency();
+		numthreads = (hw > 1) ? hw - 1 : 1;
+	}
+
+	for (unsigned i = 0; i < numthreads; i++)
+	{
+		workers.push_back(thread(&thread_pool::workerLoop, this));
+	}
+}
+
+
+thread_pool::~thread_pool()
+{
+	{
+		lock_guard<mutex> lock(jobs_mutex);
+		stopping = true;
+	}
+	jobs_available.notify_all();
+
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		workers[i].join();
+	}
+}
+
+
+void thread_pool::enqueue(function<void()> job)
+{
+	{
+		lock_guard<mutex> lock(jobs_mutex);
+		jobs.push_back(move(job));
+	}
+	jobs_available.notify_one();
+}
+
+
+void thread_pool::workerLoop()
+{
+	for (;;)
+	{
+		function<void()> job;
+		{
+			unique_lock<mutex> lock(jobs_mutex);
+			jobs_available.wait(lock, [this]() { return stopping || !jobs.empty(); });
+			if (stopping && jobs.empty()) return;
+
+			job = move(jobs.front());
+			jobs.pop_front();
+		}
+		job();
+	}
+}
+
+
+size_t thread_pool::numChunks(size_t count, size_t min_chunk) const
+{
+	if (count == 0) return 0;
+	if (min_chunk == 0) min_chunk = 1;
+
+	size_t max_chunks = (count + min_chunk - 1) / min_chunk;
+	return min(max_chunks, size_t(concurrency()));
+}
+
+
+/* State shared between the caller and the helper jobs of one parallel_for */
+struct parallel_for_state
+{
+	const function<void(size_t, size_t)>* body;
+	size_t count;
+	size_t num_chunks;
+	atomic<size_t> next_chunk;
+	atomic<size_t> chunks_done;
+	mutex done_mutex;
+	condition_variable done;
+
+	// Run chunks until there are none left
+	void work()
+	{
+		size_t chunk;
+		while ((chunk = next_chunk.fetch_add(1)) < num_chunks)
+		{
+			size_t begin = count * chunk / num_chunks;
+			size_t end = count * (chunk + 1) / num_chunks;
+			(*body)(begin, end);
+
+			if (chunks_done.fetch_add(1) + 1 == num_chunks)
+			{
+				lock_guard<mutex> lock(done_mutex);
+				done.notify_all();
+			}
+		}
+	}
+};
+
+
+void thread_pool::parallel_for(size_t count, size_t min_chunk, const function<void(size_t, size_t)>& body)
+{
+	size_t num_chunks = numChunks(count, min_chunk);
+	if (num_chunks == 0) return;
+
+	// Not worth waking the workers for a single chunk
+	if (num_chunks == 1)
+	{
+		body(0, count);
+		return;
+	}
+
+	shared_ptr<parallel_for_state> state = make_shared<parallel_for_state>();
+	state->body = &body;
+	state->count = count;
+	state->num_chunks = num_chunks;
+	state->next_chunk = 0;
+	state->chunks_done = 0;
+
+	for (size_t i = 1; i < num_chunks; i++)
+	{
+		enqueue([state]() { state->work(); });
+	}
+
+	state->work();
+
+	unique_lock<mutex> lock(state->done_mutex);
+	state->done.wait(lock, [&state]() { return state->chunks_done == state->num_chunks; });
+}
+
+
+thread_pool& worker_pool()
+{
+	static thread_pool pool;
+	return pool;
+}
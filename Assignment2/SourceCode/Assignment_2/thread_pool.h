@@ -0,0 +1,58 @@
+/* thread_pool.h
+   A small pool of persistent worker threads used to split per-frame work
+   (particle sorting and updates) and background jobs across the CPU cores.
+
+   parallel_for() splits a range into chunks and blocks until every chunk has run.
+   The calling thread takes chunks as well, so it is safe to call from a worker.
+*/
+
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+
+class thread_pool
+{
+public:
+	thread_pool(unsigned numthreads = 0);
+	~thread_pool();
+
+	// Number of threads that can work on a parallel_for, including the caller
+	unsigned concurrency() const { return unsigned(workers.size()) + 1; }
+
+	// Run body(begin, end) over [0, count) in chunks of at least min_chunk items
+	void parallel_for(size_t count, size_t min_chunk, const std::function<void(size_t, size_t)>& body);
+
+	// Split count items into the chunk ranges parallel_for() would use
+	size_t numChunks(size_t count, size_t min_chunk) const;
+
+	// Queue a job to run on a worker thread, the future holds its result
+	template <typename F>
+	auto submit(F job) -> std::future<decltype(job())>
+	{
+		typedef decltype(job()) result_type;
+		auto task = std::make_shared<std::packaged_task<result_type()>>(job);
+		std::future<result_type> result = task->get_future();
+		enqueue([task]() { (*task)(); });
+		return result;
+	}
+
+private:
+	void enqueue(std::function<void()> job);
+	void workerLoop();
+
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> jobs;
+	std::mutex jobs_mutex;
+	std::condition_variable jobs_available;
+	bool stopping;
+};
+
+// Shared pool created on first use, sized to the hardware thread count
+thread_pool& worker_pool();
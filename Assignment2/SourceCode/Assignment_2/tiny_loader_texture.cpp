@@ -2,6 +2,23 @@
 Example class to demonstrate the use of TinyObjectLoader to load an obj (WaveFront)
 object file with normals and texture coordinates, and copy the data into vertex, normal texture coordinate buffers.
 A colour buffer is not included as it is expected that the colour be taken form the texture.
+Face corners that share the same position, normal and texture coordinate are merged into one
+vertex and the object is drawn from an index buffer.
+The vertices are interleaved in one buffer and the result is cached in <file>.obj.meshcache,
+so later runs skip parsing the obj file and upload from the memory mapped cache instead.
+Before caching, the mesh is reordered for the vertex cache, overdraw and vertex fetch (mesh_optimize.h)
+and a chain of simplified index buffers is built for drawing at lower detail (mesh_simplify.h).
+The faces are grouped by the material they use, and each material's diffuse map is
+loaded through a texture_cache so models that share an image share its texture. The
+object is drawn with one glMultiDrawElements per texture rather than per material.
+.mtl files and the images they name are found relative to the obj file.
+When the obj file is parsed, it is memory mapped and parsed in parallel chunks by
+tinyobj::LoadObjParallel, unless parallel_parse is turned off.
+With stream_parse, the mapped file is instead read once by tinyobj::LoadObjWithCallback
+and each face goes straight into the mesh's vertices and indices. That never holds the
+tinyobj shapes, so the peak memory of a load is a fraction of the other parsers'.
+load_obj is parse_obj, which makes no GL calls and can run on a worker thread (see asset_loader),
+followed by upload_obj on the GL thread.
 Please be careful to match the vertex attribute indices in your shaders. See code in the
 constructor:
 
@@ -13,8 +30,19 @@ Iain Martin November 2018
 */
 
 #include "tiny_loader_texture.h"
+#include "thread_pool.h"
+#include "alloc_counter.h"
+#include "mesh_optimize.h"
+#include "mesh_simplify.h"
 #include <iostream>
 #include <stdio.h>
+#include <cstddef>
+#include <chrono>
+#include <unordered_map>
+#include <cstring>
+#include <algorithm>
+#include <streambuf>
+#include <istream>
 
 //Tinyobjloader library used to import models
 #ifndef TINYOBJLOADER_IMPLEMENTATION
@@ -30,6 +58,32 @@ static  void PrintInfo(const tinyobj::attrib_t& attrib,
 	const vector<tinyobj::shape_t>& shapes,
 	const vector<tinyobj::material_t>& materials); 
 
+static void BuildMesh(const tinyobj::attrib_t& attrib, const vector<tinyobj::shape_t>& shapes, mesh_data& mesh);
+static bool StreamMesh(const mapped_file& source, const string& basedir, mesh_data& mesh, string& warn, string& err);
+static void CopyMaterials(const tinyobj::material_t* materials, size_t count, const string& basedir, mesh_data& mesh, string& warn);
+
+// A unique vertex is a unique combination of position, normal and texcoord indices
+struct VertexKey
+{
+	int vertex_index, normal_index, texcoord_index;
+
+	bool operator==(const VertexKey& k) const
+	{
+		return vertex_index == k.vertex_index && normal_index == k.normal_index && texcoord_index == k.texcoord_index;
+	}
+};
+
+struct VertexKeyHash
+{
+	size_t operator()(const VertexKey& k) const
+	{
+		size_t h = size_t(k.vertex_index) * 73856093u;
+		h ^= size_t(k.normal_index) * 19349663u;
+		h ^= size_t(k.texcoord_index) * 83492791u;
+		return h;
+	}
+};
+
 TinyObjLoader::TinyObjLoader()
 {
 	attribute_v_coord = 0;
@@ -39,6 +93,16 @@ TinyObjLoader::TinyObjLoader()
 	numVertices = 0;
 	numNormals = 0;
 	numTexCoords = 0;
+	numPIndexes = 0;
+	indexType = GL_UNSIGNED_INT;
+
+	parallel_parse = true;
+	stream_parse = false;
+	textures = &shared_textures();
+
+	lod_ratios.push_back(0.5f);
+	lod_ratios.push_back(0.25f);
+	lod_ratios.push_back(0.1f);
 }
 
 TinyObjLoader::~TinyObjLoader()
@@ -48,40 +112,210 @@ TinyObjLoader::~TinyObjLoader()
 
 void TinyObjLoader::load_obj(string inputfile, bool debugPrint)
 {
+	parsed_obj parsed;
+	if (!parse_obj(inputfile, parsed)) {
+		exit(1);
+	}
+	upload_obj(parsed);
+}
+
+
+/* The directory part of a path, including the last separator */
+static string DirectoryOf(const string& path)
+{
+	size_t separator = path.find_last_of("/\\");
+	return (separator == string::npos) ? string() : path.substr(0, separator + 1);
+}
+
+
+/* Runs LoadObjParallel's chunks on the worker pool, which is safe from a worker and
+   doesn't start threads of its own */
+static const tinyobj::ParallelFor pool_parallel_for = [](size_t count, const function<void(size_t)>& work)
+{
+	worker_pool().parallel_for(count, 1, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++) work(i);
+	});
+};
+
+
+/* Map the obj file and either open its mesh cache or parse it into parsed.mesh.
+   No GL calls are made here, so several files can be parsed at once on worker threads */
+bool TinyObjLoader::parse_obj(const string& inputfile, parsed_obj& parsed) const
+{
+	parsed.inputfile = inputfile;
+
+	// The obj file is memory mapped, both for hashing and for the parallel parser
+	mapped_file source;
+	if (!source.open(inputfile)) {
+		cerr << "Cannot open file [" << inputfile << "]" << endl;
+		return false;
+	}
+
+	// Use the binary cache next to the obj file if it was built from this version of the file
+	string cachefile = inputfile + ".meshcache";
+	parsed.haveKey = makeMeshCacheKey(inputfile, source, parsed.key);
+	parsed.key.build_options = hashBytes(lod_ratios.data(), lod_ratios.size() * sizeof(float));
+
+	if (parsed.haveKey && parsed.cache.open(cachefile, parsed.key))
+	{
+		return true;
+	}
+
 	tinyobj::attrib_t attrib;
 	vector<tinyobj::shape_t> shapes;
 	vector<tinyobj::material_t> materials;
 
 
+	// Material files are found relative to the obj file
+	string basedir = DirectoryOf(inputfile);
+
 	string err, warn;
-	bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err, &warn, inputfile.c_str());
+	bool ret;
+	if (stream_parse) {
+		ret = StreamMesh(source, basedir, parsed.mesh, warn, err);
+	}
+	else if (parallel_parse) {
+		tinyobj::MaterialFileReader materialReader(basedir);
+		ret = tinyobj::LoadObjParallel(&attrib, &shapes, &materials, &warn, &err,
+			reinterpret_cast<const char*>(source.data()), source.size(), &materialReader,
+			true, true, worker_pool().concurrency(), &pool_parallel_for);
+	}
+	else {
+		ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, inputfile.c_str(), basedir.c_str());
+	}
+
+	if (ret && !stream_parse) {
+		BuildMesh(attrib, shapes, parsed.mesh);
+		CopyMaterials(materials.data(), materials.size(), basedir, parsed.mesh, warn);
+	}
 
 	if (!err.empty()) { // `err` may contain error messages.
 		cerr << err << endl;
 	}
 	
-	if (!err.empty()) { // `warn` may contain warning messages.
-		cerr << err << endl;
+	if (!warn.empty()) { // `warn` may contain warning messages.
+		cerr << warn << endl;
 	}
 
 	if (!ret) {
-		exit(1);
+		return false;
 	}
 
-	// Calculate the number of vertices from the shapes
-	numVertices = 0;
+	// Reorder for the vertex cache, overdraw and vertex fetch. This is only paid on a cache miss
+	vertex_cache_stats before, after;
+	optimizeMesh(parsed.mesh, before, after);
+	printf("%s: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", inputfile.c_str(), before.acmr, after.acmr, before.atvr, after.atvr);
+
+	buildLodChain(parsed.mesh, lod_ratios);
+	for (size_t i = 0; i < parsed.mesh.lods.size(); i++) {
+		const mesh_lod& lod = parsed.mesh.lods[i];
+		printf("%s: LOD %d %u triangles, error %g\n", inputfile.c_str(), int(i + 1), lod.index_count / 3, lod.error);
+	}
+
+	if (parsed.haveKey && !writeMeshCache(cachefile, parsed.key, parsed.mesh)) {
+		cerr << "Could not write mesh cache " << cachefile << endl;
+	}
+	return true;
+}
+
+
+/* Create the GL buffers from a parse_obj result, must be called on the GL thread */
+void TinyObjLoader::upload_obj(parsed_obj& parsed)
+{
+	const string& inputfile = parsed.inputfile;
+	string cachefile = inputfile + ".meshcache";
+
+	const mesh_cache_view& cache = parsed.cache;
+	if (cache.isOpen())
+	{
+		// Upload straight from the mapped file
+		numVertices = numNormals = numTexCoords = cache.vertexCount();
+		numPIndexes = cache.fullIndexCount();
+		indexType = cache.indexType();
+		bounds = computeBounds(cache.vertexCount() ? cache.vertices()->position : 0, cache.vertexCount(), sizeof(mesh_vertex) / sizeof(GLfloat));
+		materials.assign(cache.materials(), cache.materials() + cache.materialCount());
+		submeshes.assign(cache.submeshes(), cache.submeshes() + cache.submeshCount());
+		lods.assign(cache.lods(), cache.lods() + cache.lodCount());
+		lod_submeshes.assign(cache.lodSubmeshes(), cache.lodSubmeshes() + cache.lodCount() * cache.submeshCount());
+		upload(cache.vertices(), cache.indices(), cache.indexCount(), cache.indexSize());
+
+		cout << inputfile << ": loaded " << numVertices << " vertices, " << numPIndexes << " indices from " << cachefile << endl;
+		return;
+	}
+
+	const mesh_data& mesh = parsed.mesh;
+	GLuint numCorners = mesh.fullIndexCount();
+	numVertices = numNormals = numTexCoords = GLuint(mesh.vertices.size());
+	numPIndexes = mesh.fullIndexCount();
+	bounds = computeBounds(mesh.vertices.empty() ? 0 : mesh.vertices.data()->position, mesh.vertices.size(), sizeof(mesh_vertex) / sizeof(GLfloat));
+	materials = mesh.materials;
+	submeshes = mesh.submeshes;
+	lods = mesh.lods;
+	lod_submeshes = mesh.lod_submeshes;
+
+	cout << inputfile << ": " << numCorners << " face corners -> " << numVertices << " unique vertices ("
+		<< (numCorners ? 100 - 100 * numVertices / numCorners : 0) << "% fewer)" << endl;
+
+	// Use 16 bit indices when they fit, halving the index buffer size
+	if (useShortIndices(numVertices))
+	{
+		std::vector<GLushort> shortIndices(mesh.indices.begin(), mesh.indices.end());
+		indexType = GL_UNSIGNED_SHORT;
+		upload(mesh.vertices.data(), shortIndices.data(), GLuint(shortIndices.size()), sizeof(GLushort));
+	}
+	else
+	{
+		indexType = GL_UNSIGNED_INT;
+		upload(mesh.vertices.data(), mesh.indices.data(), GLuint(mesh.indices.size()), sizeof(GLuint));
+	}
+}
+
+
+/* Build the interleaved vertices and index buffer from the tinyobj shapes */
+static void BuildMesh(const tinyobj::attrib_t& attrib, const vector<tinyobj::shape_t>& shapes, mesh_data& mesh)
+{
+	// Calculate the number of face corners (3 for each triangulated face) from the shapes
+	size_t numCorners = 0;
+	for (size_t s = 0; s < shapes.size(); s++) {
+		numCorners += shapes[s].mesh.num_face_vertices.size() * 3;
+	}
+
+	// Each material's faces go in one range of the index buffer, in material order with
+	// the faces that have no material last. Count the corners of each to place the ranges
+	int numMaterials = 0;
 	for (size_t s = 0; s < shapes.size(); s++) {
-		numVertices += shapes[s].mesh.num_face_vertices.size() * 3;//3 vertexes for each face
+		for (size_t f = 0; f < shapes[s].mesh.material_ids.size(); f++) {
+			numMaterials = std::max(numMaterials, shapes[s].mesh.material_ids[f] + 1);
+		}
 	}
+	auto slotOf = [&](const tinyobj::mesh_t& m, size_t f) {
+		int id = (f < m.material_ids.size()) ? m.material_ids[f] : -1;
+		return (id >= 0) ? size_t(id) : size_t(numMaterials);
+	};
 
-	numNormals = numTexCoords = numVertices;
+	vector<size_t> slotStart(numMaterials + 2, 0);
+	for (size_t s = 0; s < shapes.size(); s++) {
+		for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
+			slotStart[slotOf(shapes[s].mesh, f) + 1] += shapes[s].mesh.num_face_vertices[f];
+		}
+	}
+	for (int m = 0; m <= numMaterials; m++) {
+		slotStart[m + 1] += slotStart[m];
+	}
+
+	// A texture coordinate or normal can differ between faces that share a position,
+	// so vertices are made unique on the whole (position, normal, texcoord) combination
+	mesh.vertices.clear();
+	mesh.indices.clear();
+	mesh.submeshes.clear();
+	mesh.vertices.reserve(attrib.vertices.size() / 3);
+	mesh.indices.resize(slotStart[numMaterials + 1]);
 
-	//have to duplicate vertices (glDrawElements not possible) because of texture
-	std::vector<tinyobj::real_t> pVertices(numVertices * 3);
-	std::vector<tinyobj::real_t> pTextureCoords(numVertices * 2);
-	std::vector<tinyobj::real_t> pNormals(numVertices * 3);
+	unordered_map<VertexKey, GLuint, VertexKeyHash> uniqueVertices;
+	uniqueVertices.reserve(numCorners);
 
-	GLuint ind = 0;
+	vector<size_t> slotEnd(slotStart.begin(), slotStart.end() - 1);
 	for (size_t s = 0; s < shapes.size(); s++) {
 
 		// Loop over faces(polygon)
@@ -91,6 +325,7 @@ void TinyObjLoader::load_obj(string inputfile, bool debugPrint)
 		for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) 
 		{
 			int fv = shapes[s].mesh.num_face_vertices[f];//number of vertices per face (3)
+			size_t& write = slotEnd[slotOf(shapes[s].mesh, f)];
 
 			// Loop over vertices in the face.
 			for (size_t v = 0; v < fv; v++) 
@@ -98,58 +333,394 @@ void TinyObjLoader::load_obj(string inputfile, bool debugPrint)
 				// access to vertex
 				tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
 
-				pVertices[ind * 3 + 0] = attrib.vertices[3 * idx.vertex_index + 0];
-				pVertices[ind * 3 + 1] = attrib.vertices[3 * idx.vertex_index + 1];
-				pVertices[ind * 3 + 2] = attrib.vertices[3 * idx.vertex_index + 2];
+				VertexKey key = { idx.vertex_index, idx.normal_index, idx.texcoord_index };
+				GLuint newIndex = GLuint(uniqueVertices.size());
+				auto found = uniqueVertices.insert(make_pair(key, newIndex));
+
+				// Only copy the attributes the first time this combination is seen
+				if (found.second)
+				{
+					mesh_vertex vertex;
+					for (int c = 0; c < 3; c++) {
+						vertex.position[c] = attrib.vertices[3 * idx.vertex_index + c];
+					}
+
+					// Missing texture coordinates or normals are left as zero
+					for (int c = 0; c < 3; c++) {
+						vertex.normal[c] = (idx.normal_index >= 0) ? attrib.normals[3 * idx.normal_index + c] : 0;
+					}
+					for (int c = 0; c < 2; c++) {
+						vertex.texcoord[c] = (idx.texcoord_index >= 0) ? attrib.texcoords[2 * idx.texcoord_index + c] : 0;
+					}
+					mesh.vertices.push_back(vertex);
+				}
+
+				mesh.indices[write++] = found.first->second;
+			}
+			index_offset += fv;
+		}
+	}
+
+	for (int m = 0; m <= numMaterials; m++) {
+		if (slotStart[m + 1] == slotStart[m]) continue;
+		mesh_submesh submesh = { GLuint(slotStart[m]), GLuint(slotStart[m + 1] - slotStart[m]), (m < numMaterials) ? GLuint(m) : no_material };
+		mesh.submeshes.push_back(submesh);
+	}
+
+	// Bounding box of the vertices actually used by faces
+	mesh.bounds_min = mesh.bounds_max = vec3(0);
+	for (size_t i = 0; i < mesh.vertices.size(); i++) {
+		vec3 p(mesh.vertices[i].position[0], mesh.vertices[i].position[1], mesh.vertices[i].position[2]);
+		mesh.bounds_min = (i == 0) ? p : min(mesh.bounds_min, p);
+		mesh.bounds_max = (i == 0) ? p : max(mesh.bounds_max, p);
+	}
+}
+
+
+/* Copy a string into a fixed size field, returning false if it had to be cut short */
+template <size_t N>
+static bool CopyString(char (&field)[N], const string& value)
+{
+	size_t length = std::min(value.size(), N - 1);
+	memcpy(field, value.data(), length);
+	memset(field + length, 0, N - length);
+	return length == value.size();
+}
+
+
+/* Keep the name and diffuse map of each tinyobj material. Image paths in an .mtl file are
+   relative to it, so they are prefixed with its directory */
+static void CopyMaterials(const tinyobj::material_t* materials, size_t count, const string& basedir, mesh_data& mesh, string& warn)
+{
+	mesh.materials.resize(count);
+	for (size_t i = 0; i < count; i++) {
+		mesh_material& material = mesh.materials[i];
+		CopyString(material.name, materials[i].name);
+
+		string texname = materials[i].diffuse_texname.empty() ? string() : basedir + materials[i].diffuse_texname;
+		if (!CopyString(material.diffuse_texname, texname)) {
+			warn += "Texture path too long, material " + materials[i].name + " drawn without it\n";
+			material.diffuse_texname[0] = 0;
+		}
+	}
+}
+
 
-				pTextureCoords[ind * 2 + 0] = attrib.texcoords[2 * idx.texcoord_index + 0];
-				pTextureCoords[ind * 2 + 1] = attrib.texcoords[2 * idx.texcoord_index + 1];
+/* Reads the mapped file as an istream without copying it */
+struct memory_streambuf : public std::streambuf
+{
+	memory_streambuf(const char* data, size_t size)
+	{
+		char* begin = const_cast<char*>(data);
+		setg(begin, begin, begin + size);
+	}
+};
+
+/* What StreamMesh keeps while the file is read. The obj's positions, normals and texture
+   coordinates are needed until the end since faces refer to them by index, but each face
+   is triangulated and made into vertices and indices as soon as it is read.
+   The indices are in file order, with a run recorded each time the material changes, and
+   are only regrouped by material at the end if there is more than one */
+struct stream_builder
+{
+	mesh_data* mesh;
+	string basedir;
+	string* warn;
+	vector<float> positions, normals, texcoords;
+	unordered_map<VertexKey, GLuint, VertexKeyHash> uniqueVertices;
+	vector<tinyobj::index_t> face, triangles;
+	size_t invalid_faces;
+	GLuint material;				// Of the faces being read, or no_material
+	vector<mesh_submesh> runs;		// Ranges of the indices read with one material
+
+	// Regroup the runs by material into the mesh's sub-meshes, in the same order as BuildMesh
+	void finishSubmeshes()
+	{
+		mesh->submeshes.clear();
+		if (runs.empty()) return;
 
-				pNormals[ind * 3 + 0] = attrib.normals[3 * idx.normal_index + 0];
-				pNormals[ind * 3 + 1] = attrib.normals[3 * idx.normal_index + 1];
-				pNormals[ind * 3 + 2] = attrib.normals[3 * idx.normal_index + 2];
+		stable_sort(runs.begin(), runs.end(), [](const mesh_submesh& a, const mesh_submesh& b) { return a.material < b.material; });
+		bool reordered = runs.size() > 1 && runs.front().material != runs.back().material;
 
-				ind++;
+		vector<GLuint> grouped;
+		if (reordered) grouped.reserve(mesh->indices.size());
+		for (size_t r = 0; r < runs.size(); r++)
+		{
+			const mesh_submesh& run = runs[r];
+			if (mesh->submeshes.empty() || mesh->submeshes.back().material != run.material)
+			{
+				mesh_submesh submesh = { reordered ? GLuint(grouped.size()) : run.first_index, 0, run.material };
+				mesh->submeshes.push_back(submesh);
+			}
+			mesh->submeshes.back().index_count += run.index_count;
+			if (reordered)
+			{
+				grouped.insert(grouped.end(), mesh->indices.begin() + run.first_index, mesh->indices.begin() + run.first_index + run.index_count);
 			}
-			index_offset += fv;
 		}
+		if (reordered) mesh->indices.swap(grouped);
 	}
 
-	// Copy the vertix, normal and textcoord data into OpenGL buffers
-	glGenBuffers(1, &positionBufferObject);
-	glBindBuffer(GL_ARRAY_BUFFER, positionBufferObject);
-	glBufferData(GL_ARRAY_BUFFER, pVertices.size() * sizeof(tinyobj::real_t), &pVertices.front(), GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	// Make a raw obj index zero based, or -1 if it's missing or out of range
+	static int fixIndex(int index, size_t count)
+	{
+		int fixed = (index > 0) ? index - 1 : int(count) + index;
+		return (index != 0 && fixed >= 0 && size_t(fixed) < count) ? fixed : -1;
+	}
 
-	glGenBuffers(1, &normalBufferObject);
-	glBindBuffer(GL_ARRAY_BUFFER, normalBufferObject);
-	glBufferData(GL_ARRAY_BUFFER, pNormals.size() * sizeof(tinyobj::real_t), &pNormals.front(), GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	static void vertexCallback(void* user, tinyobj::real_t x, tinyobj::real_t y, tinyobj::real_t z, tinyobj::real_t /*w*/)
+	{
+		vector<float>& p = static_cast<stream_builder*>(user)->positions;
+		p.push_back(x); p.push_back(y); p.push_back(z);
+	}
+
+	static void normalCallback(void* user, tinyobj::real_t x, tinyobj::real_t y, tinyobj::real_t z)
+	{
+		vector<float>& n = static_cast<stream_builder*>(user)->normals;
+		n.push_back(x); n.push_back(y); n.push_back(z);
+	}
+
+	static void texcoordCallback(void* user, tinyobj::real_t x, tinyobj::real_t y, tinyobj::real_t /*z*/)
+	{
+		vector<float>& t = static_cast<stream_builder*>(user)->texcoords;
+		t.push_back(x); t.push_back(y);
+	}
+
+	// Gives every material read so far, each time an .mtl file is loaded
+	static void mtllibCallback(void* user, const tinyobj::material_t* materials, int num_materials)
+	{
+		stream_builder& b = *static_cast<stream_builder*>(user);
+		CopyMaterials(materials, size_t(num_materials), b.basedir, *b.mesh, *b.warn);
+	}
 
-	glGenBuffers(1, &texCoordsObject);
-	glBindBuffer(GL_ARRAY_BUFFER, texCoordsObject);
-	glBufferData(GL_ARRAY_BUFFER, pTextureCoords.size() * sizeof(tinyobj::real_t), &pTextureCoords.front(), GL_STATIC_DRAW);
+	static void usemtlCallback(void* user, const char* /*name*/, int material_id)
+	{
+		static_cast<stream_builder*>(user)->material = (material_id >= 0) ? GLuint(material_id) : no_material;
+	}
+
+	static void faceCallback(void* user, tinyobj::index_t* indices, int num_indices)
+	{
+		stream_builder& b = *static_cast<stream_builder*>(user);
+		size_t num_positions = b.positions.size() / 3;
+
+		b.face.clear();
+		for (int i = 0; i < num_indices; i++)
+		{
+			tinyobj::index_t idx;
+			idx.vertex_index = fixIndex(indices[i].vertex_index, num_positions);
+			idx.normal_index = fixIndex(indices[i].normal_index, b.normals.size() / 3);
+			idx.texcoord_index = fixIndex(indices[i].texcoord_index, b.texcoords.size() / 2);
+			if (idx.vertex_index < 0)
+			{
+				b.invalid_faces++;
+				return;
+			}
+			b.face.push_back(idx);
+		}
+
+		b.triangles.clear();
+		tinyobj::TriangulateFace(b.face.data(), num_indices, b.positions.data(), num_positions, &b.triangles);
+
+		if (b.triangles.empty()) return;
+
+		// The same vertex merging as BuildMesh
+		mesh_data& mesh = *b.mesh;
+		if (b.runs.empty() || b.runs.back().material != b.material)
+		{
+			mesh_submesh run = { GLuint(mesh.indices.size()), 0, b.material };
+			b.runs.push_back(run);
+		}
+		b.runs.back().index_count += GLuint(b.triangles.size());
+
+		for (size_t i = 0; i < b.triangles.size(); i++)
+		{
+			const tinyobj::index_t& idx = b.triangles[i];
+			VertexKey key = { idx.vertex_index, idx.normal_index, idx.texcoord_index };
+			auto found = b.uniqueVertices.insert(make_pair(key, GLuint(mesh.vertices.size())));
+			if (found.second)
+			{
+				mesh_vertex vertex;
+				for (int c = 0; c < 3; c++) {
+					vertex.position[c] = b.positions[3 * idx.vertex_index + c];
+				}
+				for (int c = 0; c < 3; c++) {
+					vertex.normal[c] = (idx.normal_index >= 0) ? b.normals[3 * idx.normal_index + c] : 0;
+				}
+				for (int c = 0; c < 2; c++) {
+					vertex.texcoord[c] = (idx.texcoord_index >= 0) ? b.texcoords[2 * idx.texcoord_index + c] : 0;
+				}
+				mesh.vertices.push_back(vertex);
+			}
+			mesh.indices.push_back(found.first->second);
+		}
+	}
+};
+
+
+/* Count the positions, normals and texture coordinates, and the indices the faces will
+   have once triangulated, so the streaming parser can size its arrays up front instead
+   of growing them by doubling */
+static void CountObjLines(const char* data, size_t size, size_t& positions, size_t& normals, size_t& texcoords, size_t& corners)
+{
+	positions = normals = texcoords = corners = 0;
+	const char* end = data + size;
+	for (const char* line = data; line < end;)
+	{
+		while (line < end && (*line == ' ' || *line == '\t')) line++;
+		if (end - line >= 2)
+		{
+			if (line[0] == 'v' && (line[1] == ' ' || line[1] == '\t')) positions++;
+			else if (line[0] == 'v' && line[1] == 'n') normals++;
+			else if (line[0] == 'v' && line[1] == 't') texcoords++;
+			else if (line[0] == 'f' && (line[1] == ' ' || line[1] == '\t'))
+			{
+				// A polygon of n vertices makes n - 2 triangles
+				size_t n = 0;
+				const char* c = line + 1;
+				while (c < end && *c != '\n' && *c != '\r')
+				{
+					while (c < end && (*c == ' ' || *c == '\t')) c++;
+					if (c == end || *c == '\n' || *c == '\r') break;
+					n++;
+					while (c < end && *c != ' ' && *c != '\t' && *c != '\n' && *c != '\r') c++;
+				}
+				if (n >= 3) corners += 3 * (n - 2);
+				line = c;
+			}
+		}
+
+		const char* next = static_cast<const char*>(memchr(line, '\n', end - line));
+		line = next ? next + 1 : end;
+	}
+}
+
+
+/* Build the mesh in one pass over the mapped obj file with tinyobj::LoadObjWithCallback.
+   Gives the same mesh as LoadObj followed by BuildMesh */
+static bool StreamMesh(const mapped_file& source, const string& basedir, mesh_data& mesh, string& warn, string& err)
+{
+	const char* data = reinterpret_cast<const char*>(source.data());
+	size_t positions, normals, texcoords, corners;
+	CountObjLines(data, source.size(), positions, normals, texcoords, corners);
+
+	stream_builder builder;
+	builder.mesh = &mesh;
+	builder.basedir = basedir;
+	builder.warn = &warn;
+	builder.invalid_faces = 0;
+	builder.material = no_material;
+	builder.positions.reserve(positions * 3);
+	builder.normals.reserve(normals * 3);
+	builder.texcoords.reserve(texcoords * 2);
+
+	// The number of unique vertices isn't known until the end, but there are at least as
+	// many as there are positions, normals or texture coordinates that faces use
+	size_t min_vertices = std::max(positions, std::max(normals, texcoords));
+	mesh.vertices.clear();
+	mesh.indices.clear();
+	mesh.materials.clear();
+	mesh.submeshes.clear();
+	mesh.lods.clear();
+	mesh.lod_submeshes.clear();
+	mesh.vertices.reserve(min_vertices);
+	mesh.indices.reserve(corners);
+	builder.uniqueVertices.reserve(min_vertices);
+
+	tinyobj::callback_t callbacks;
+	callbacks.vertex_cb = stream_builder::vertexCallback;
+	callbacks.normal_cb = stream_builder::normalCallback;
+	callbacks.texcoord_cb = stream_builder::texcoordCallback;
+	callbacks.index_cb = stream_builder::faceCallback;
+	callbacks.mtllib_cb = stream_builder::mtllibCallback;
+	callbacks.usemtl_cb = stream_builder::usemtlCallback;
+
+	memory_streambuf buffer(data, source.size());
+	istream stream(&buffer);
+	tinyobj::MaterialFileReader materialReader(basedir);
+	if (!tinyobj::LoadObjWithCallback(stream, callbacks, &builder, &materialReader, &warn, &err)) {
+		return false;
+	}
+	builder.finishSubmeshes();
+
+	if (builder.invalid_faces) {
+		warn += to_string(builder.invalid_faces) + " faces with invalid vertex indices skipped\n";
+	}
+
+	mesh.bounds_min = mesh.bounds_max = vec3(0);
+	for (size_t i = 0; i < mesh.vertices.size(); i++) {
+		vec3 p(mesh.vertices[i].position[0], mesh.vertices[i].position[1], mesh.vertices[i].position[2]);
+		mesh.bounds_min = (i == 0) ? p : min(mesh.bounds_min, p);
+		mesh.bounds_max = (i == 0) ? p : max(mesh.bounds_max, p);
+	}
+	return true;
+}
+
+
+void addDrawRange(vector<draw_batch>& batches, GLuint texture, GLuint first_index, GLuint index_count, GLuint index_size)
+{
+	size_t b = 0;
+	while (b < batches.size() && batches[b].texture != texture) b++;
+	if (b == batches.size())
+	{
+		draw_batch batch;
+		batch.texture = texture;
+		b = texture ? batches.size() : 0;
+		batches.insert(batches.begin() + b, batch);
+	}
+	batches[b].counts.push_back(GLsizei(index_count));
+	batches[b].offsets.push_back((const void*)(size_t(first_index) * index_size));
+}
+
+
+/* Copy the interleaved vertices and the indices of every level into OpenGL buffers, then
+   load the materials' textures and group each level's sub-meshes by texture */
+void TinyObjLoader::upload(const mesh_vertex* vertices, const void* indices, GLuint indexCount, GLuint indexSize)
+{
+	glGenBuffers(1, &vertexBufferObject);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBufferObject);
+	glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(mesh_vertex), vertices, GL_STATIC_DRAW);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glGenBuffers(1, &elementBufferObject);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBufferObject);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * indexSize, indices, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	material_textures.assign(materials.size(), 0);
+	for (size_t m = 0; m < materials.size(); m++)
+	{
+		if (materials[m].diffuse_texname[0]) material_textures[m] = textures->load(materials[m].diffuse_texname);
+	}
+
+	size_t submesh_count = submeshes.size();
+	batches.assign(lods.size() + 1, vector<draw_batch>());
+	for (size_t l = 0; l < batches.size(); l++)
+	{
+		const mesh_submesh* level = (l == 0) ? submeshes.data() : lod_submeshes.data() + (l - 1) * submesh_count;
+		for (size_t s = 0; s < submesh_count; s++)
+		{
+			GLuint texture = (level[s].material < material_textures.size()) ? material_textures[level[s].material] : 0;
+			addDrawRange(batches[l], texture, level[s].first_index, level[s].index_count, indexSize);
+		}
+	}
 }
 
 
-void TinyObjLoader::drawObject(int drawmode)
+void TinyObjLoader::drawObject(int drawmode, int lod)
 {
 
 	/* Draw the object as GL_POINTS */
-	glBindBuffer(GL_ARRAY_BUFFER, positionBufferObject);
-	glVertexAttribPointer(attribute_v_coord, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBufferObject);
+	glVertexAttribPointer(attribute_v_coord, 3, GL_FLOAT, GL_FALSE, sizeof(mesh_vertex), (void*)offsetof(mesh_vertex, position));
 	glEnableVertexAttribArray(attribute_v_coord);
 
 	/* Bind the object normals */
-	glBindBuffer(GL_ARRAY_BUFFER, normalBufferObject);
-	glVertexAttribPointer(attribute_v_normal, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	glVertexAttribPointer(attribute_v_normal, 3, GL_FLOAT, GL_FALSE, sizeof(mesh_vertex), (void*)offsetof(mesh_vertex, normal));
 	glEnableVertexAttribArray(attribute_v_normal);
 
-	/* Bind the object texture coords if they exist */
+	/* Bind the object texture coords */
 	glEnableVertexAttribArray(attribute_v_texcoord);
-	glBindBuffer(GL_ARRAY_BUFFER, texCoordsObject);
-	glVertexAttribPointer(attribute_v_texcoord, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	glVertexAttribPointer(attribute_v_texcoord, 2, GL_FLOAT, GL_FALSE, sizeof(mesh_vertex), (void*)offsetof(mesh_vertex, texcoord));
 
 	glPointSize(3.f);
 
@@ -165,8 +736,111 @@ void TinyObjLoader::drawObject(int drawmode)
 	}
 	else
 	{
-		glDrawArrays(GL_TRIANGLES, 0, numVertices);
+		// The simplified levels follow the full detail triangles in the index buffer
+		if (lod < 0 || lod > int(lods.size())) lod = 0;
+		const vector<draw_batch>& level = batches[lod];
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBufferObject);
+		for (size_t b = 0; b < level.size(); b++)
+		{
+			if (level[b].texture) glBindTexture(GL_TEXTURE_2D, level[b].texture);
+			glMultiDrawElements(GL_TRIANGLES, level[b].counts.data(), indexType,
+				level[b].offsets.data(), GLsizei(level[b].counts.size()));
+		}
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+}
+
+
+void TinyObjLoader::releaseTextures()
+{
+	for (size_t m = 0; m < material_textures.size(); m++)
+	{
+		if (material_textures[m]) textures->release(material_textures[m]);
+	}
+	material_textures.clear();
+}
+
+/* Time tinyobj::LoadObj, LoadObjParallel and the streaming parser on each file, best of
+   `repeats` loads. Each load goes as far as the finished mesh_data, so BuildMesh is
+   included for the first two. Also measures the most memory each load had resident above
+   what the process had before it, trimming the working set first so earlier loads don't
+   hide it, against the size of the mesh it produced. Built with GM_ALLOC_COUNTER, it
+   also counts the heap allocations each load makes and the most heap memory it had */
+void benchmarkObjParsing(const vector<string>& files, int repeats)
+{
+	const char* names[] = { "LoadObj", "LoadObjParallel", "WithCallback" };
+	if (!allocationCounting()) {
+		printf("Allocations aren't counted in this build; define GM_ALLOC_COUNTER to count them\n");
+	}
+	printf("%-20s %-16s %10s %10s %12s %10s %10s %12s %10s\n", "file", "parser", "ms", "MB/s", "allocations", "per line",
+		"peak MB", "resident MB", "mesh MB");
+
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		mapped_file source;
+		if (!source.open(files[i])) {
+			cerr << "Cannot open file [" << files[i] << "]" << endl;
+			continue;
+		}
+
+		size_t lines = 0;
+		for (size_t c = 0; c < source.size(); c++) {
+			if (source.data()[c] == '\n') lines++;
+		}
+		double megabytes = source.size() / (1024.0 * 1024.0);
+
+		for (int parser = 0; parser < 3; parser++)
+		{
+			double best = 0;
+			size_t allocations = 0;
+			size_t peak = 0, resident = 0, meshBytes = 0;
+			for (int r = 0; r < repeats; r++)
+			{
+				mesh_data mesh;
+				string err, warn;
+
+				size_t allocationsBefore = allocationCount();
+				size_t bytesBefore = allocatedBytes();
+				resetPeakAllocatedBytes();
+				trimResidentMemory();
+				resident_peak_sampler sampler;
+				auto start = chrono::high_resolution_clock::now();
+				if (parser == 2) {
+					StreamMesh(source, DirectoryOf(files[i]), mesh, warn, err);
+				}
+				else {
+					tinyobj::attrib_t attrib;
+					vector<tinyobj::shape_t> shapes;
+					vector<tinyobj::material_t> materials;
+					tinyobj::MaterialFileReader materialReader(DirectoryOf(files[i]));
+					if (parser == 1) {
+						tinyobj::LoadObjParallel(&attrib, &shapes, &materials, &warn, &err,
+							reinterpret_cast<const char*>(source.data()), source.size(), &materialReader,
+							true, true, worker_pool().concurrency(), &pool_parallel_for);
+					}
+					else {
+						tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, files[i].c_str(), DirectoryOf(files[i]).c_str());
+					}
+					BuildMesh(attrib, shapes, mesh);
+				}
+				double ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+				resident = std::max(resident, sampler.stop());
+				allocations = allocationCount() - allocationsBefore;
+				peak = peakAllocatedBytes() - bytesBefore;
+				meshBytes = mesh.vertices.capacity() * sizeof(mesh_vertex) + mesh.indices.capacity() * sizeof(GLuint);
+
+				if (r == 0 || ms < best) best = ms;
+			}
+
+			printf("%-20s %-16s %10.2f %10.1f %12zu %10.3f %10.1f %12.1f %10.1f\n", files[i].c_str(),
+				names[parser], best, megabytes / (best / 1000.0),
+				allocations, lines ? double(allocations) / lines : 0.0,
+				peak / (1024.0 * 1024.0), resident / (1024.0 * 1024.0), meshBytes / (1024.0 * 1024.0));
+		}
 	}
+
+	printf("Peak resident memory of the process: %.1f MB\n", peakResidentBytes() / (1024.0 * 1024.0));
 }
 
 static void PrintInfo(const tinyobj::attrib_t& attrib,
@@ -8,23 +8,76 @@ Iain Martin November 2018
 #pragma once
 
 #include "wrapper_glfw.h"
+#include "mesh_cache.h"
+#include "texture_cache.h"
+#include "bounds.h"
 #include <vector>
+#include <string>
 #include <glm/glm.hpp>
 
+/* An obj file that has been parsed, or whose mesh cache has been mapped, ready to upload.
+   Filled in by TinyObjLoader::parse_obj, which makes no GL calls so can run on any thread */
+struct parsed_obj
+{
+	std::string inputfile;
+	mesh_cache_view cache;		// Open when the mesh was found in the cache
+	mesh_data mesh;				// Otherwise the mesh built from the obj file
+	mesh_cache_key key;
+	bool haveKey;
+};
+
+// Index ranges drawn with one texture bound, by one glMultiDrawElements
+struct draw_batch
+{
+	GLuint texture;		// 0 to draw with whatever texture the caller has bound
+	std::vector<GLsizei> counts;
+	std::vector<const void*> offsets;
+};
+
+// Add a range of indices to the batch of its texture, adding the batch if there isn't one.
+// Batches are kept in the order their textures are first used, except that a batch
+// with no texture goes first so it can't pick up another batch's texture
+void addDrawRange(std::vector<draw_batch>& batches, GLuint texture, GLuint first_index, GLuint index_count, GLuint index_size);
+
 class TinyObjLoader
 {
 public:
 	TinyObjLoader();
 	~TinyObjLoader();
 
+	// Parse and upload in one go, exits if the file can't be loaded
 	void load_obj(std::string inputfile, bool debugPrint = false);
-	void drawObject(int drawmode);
+
+	// The two halves of load_obj: parse_obj on any thread, then upload_obj on the GL thread
+	bool parse_obj(const std::string& inputfile, parsed_obj& parsed) const;
+	void upload_obj(parsed_obj& parsed);
+
+	// Draw at full detail (lod 0) or one of the simplified levels (1 to lods.size()), binding
+	// each material's texture in turn. Materials without a texture use the one already bound
+	void drawObject(int drawmode, int lod = 0);
+
+	// Give the material textures back to the cache, while the GL context still exists.
+	// The model can't be drawn afterwards
+	void releaseTextures();
+
+	bounding_volume bounds;					// Set by upload_obj
+	std::vector<mesh_material> materials;	// From the obj file's .mtl files
+	std::vector<GLuint> material_textures;	// The diffuse map of each material, 0 if it has none
+	std::vector<mesh_submesh> submeshes;	// Index ranges of the materials in the obj file
+	std::vector<mesh_lod> lods;				// The simplified levels, see mesh_simplify.h
+	std::vector<mesh_submesh> lod_submeshes;	// The material ranges of each level in turn
+	texture_cache* textures;				// Where the diffuse maps are loaded, shared_textures() by default
+
+	bool parallel_parse;	// Parse the obj file on all worker threads instead of with tinyobj::LoadObj
+	bool stream_parse;		// Build the mesh in one pass with tinyobj::LoadObjWithCallback, using the least memory
+	std::vector<float> lod_ratios;	// Fraction of the triangles kept by each simplified level
 
 private:
+	void upload(const mesh_vertex* vertices, const void* indices, GLuint indexCount, GLuint indexSize);
+
 	// Define vertex buffer object names (e.g as globals)
-	GLuint positionBufferObject;
-	GLuint normalBufferObject;
-	GLuint texCoordsObject;
+	GLuint vertexBufferObject;		// Interleaved positions, normals and texture coordinates
+	GLuint elementBufferObject;
 
 	GLuint attribute_v_coord;
 	GLuint attribute_v_normal;
@@ -35,4 +88,9 @@ private:
 	GLuint numNormals;
 	GLint  numTexCoords;
 	GLuint numPIndexes;
+	GLenum indexType;		// GL_UNSIGNED_SHORT when every index fits in 16 bits
+	std::vector<std::vector<draw_batch>> batches;	// The batches of each level
 };
+
+// Compare the obj parsers on some files, printing the speed, allocations and peak heap use per load
+void benchmarkObjParsing(const std::vector<std::string>& files, int repeats);
@@ -52,6 +52,7 @@ THE SOFTWARE.
 #ifndef TINY_OBJ_LOADER_H_
 #define TINY_OBJ_LOADER_H_
 
+#include <functional>
 #include <map>
 #include <string>
 #include <vector>
@@ -372,6 +373,14 @@ bool LoadObjWithCallback(std::istream &inStream, const callback_t &callback,
                          MaterialReader *readMatFn = NULL,
                          std::string *warn = NULL, std::string *err = NULL);
 
+/// Triangulates one face the same way LoadObj does (ear clipping), for use
+/// with the faces passed to `callback.index_cb`. `indices` must already be
+/// zero based and `vertices` holds `num_vertices` xyz positions. Appends three
+/// indices per triangle to `triangles`.
+void TriangulateFace(const index_t *indices, int num_indices,
+                     const real_t *vertices, size_t num_vertices,
+                     std::vector<index_t> *triangles);
+
 /// Loads object from a std::istream, uses GetMtlIStreamFn to retrieve
 /// std::istream for materials.
 /// Returns true when loading .obj become success.
@@ -382,6 +391,28 @@ bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
              MaterialReader *readMatFn = NULL, bool triangulate = true,
              bool default_vcols_fallback = true);
 
+/// Runs `work(i)' for every i in [0, count), on as many threads as it likes,
+/// and returns once they have all run. Lets LoadObjParallel share an
+/// existing thread pool.
+typedef std::function<void(size_t count,
+                           const std::function<void(size_t)> &work)>
+    ParallelFor;
+
+/// Loads .obj from a memory buffer, such as a memory mapped file.
+/// The buffer is split into chunks at line breaks which are parsed on
+/// `num_threads' threads (0 = one per hardware thread), giving the same
+/// attrib, shapes and materials as LoadObj on the same data. The chunks are
+/// run by `parallel_for' when given, which should use about `num_threads'
+/// threads, and otherwise on threads started for the call.
+/// The buffer does not need to be null terminated.
+bool LoadObjParallel(attrib_t *attrib, std::vector<shape_t> *shapes,
+                     std::vector<material_t> *materials, std::string *warn,
+                     std::string *err, const char *buf, size_t len,
+                     MaterialReader *readMatFn = NULL, bool triangulate = true,
+                     bool default_vcols_fallback = true,
+                     unsigned int num_threads = 0,
+                     const ParallelFor *parallel_for = NULL);
+
 /// Loads materials into std::map
 void LoadMtl(std::map<std::string, int> *material_map,
              std::vector<material_t> *materials, std::istream *inStream,
@@ -404,6 +435,8 @@ bool ParseTextureNameAndOption(std::string *texname,
 #endif  // TINY_OBJ_LOADER_H_
 
 #ifdef TINYOBJLOADER_IMPLEMENTATION
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cctype>
 #include <cmath>
@@ -411,10 +444,16 @@ bool ParseTextureNameAndOption(std::string *texname,
 #include <cstdlib>
 #include <cstring>
 #include <limits>
+#include <stdint.h>
 #include <utility>
 
 #include <fstream>
 #include <sstream>
+#include <thread>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 namespace tinyobj {
 
@@ -428,15 +467,22 @@ struct vertex_index_t {
       : v_idx(vidx), vt_idx(vtidx), vn_idx(vnidx) {}
 };
 
-// Internal data structure for face representation
-// index + smoothing group.
-struct face_t {
-  unsigned int
-      smoothing_group_id;  // smoothing group id. 0 = smoothing groupd is off.
-  int pad_;
+// Internal data structure for the faces of a group. The vertex indices of
+// all faces are kept in one array, with a vertex count and smoothing group id
+// for each face, so that faces don't each need their own allocation.
+struct face_group_t {
   std::vector<vertex_index_t> vertex_indices;  // face vertex indices.
-
-  face_t() : smoothing_group_id(0) {}
+  std::vector<unsigned int> num_vertices;      // number of vertices per face.
+  std::vector<unsigned int>
+      smoothing_group_ids;  // 0 = smoothing groupd is off.
+
+  bool empty() const { return num_vertices.empty(); }
+  size_t size() const { return num_vertices.size(); }
+  void clear() {
+    vertex_indices.clear();
+    num_vertices.clear();
+    smoothing_group_ids.clear();
+  }
 };
 
 struct line_t {
@@ -751,6 +797,408 @@ static inline bool parseVertexWithColor(real_t *x, real_t *y, real_t *z,
   return found_color;
 }
 
+// Fast, correctly rounded decimal to real_t conversion (Eisel-Lemire), for
+// LoadObjParallel. It accepts exactly what tryParseDouble accepts but rounds
+// the decimal straight to real_t, instead of through a double built with pow
+// and ldexp. The rare inputs it can't decide fall back to strtof/strtod.
+
+// 128 bit approximations of 5^q for q in [-65, 38], high word first. Covers
+// every exponent a float can have; doubles outside the range use strtod.
+static const int kPow5MinExponent = -65;
+static const int kPow5MaxExponent = 38;
+static const uint64_t kPow5Table[] = {
+    0x86ccbb52ea94baeaULL, 0x98e947129fc2b4e9ULL,  // 5^-65
+    0xa87fea27a539e9a5ULL, 0x3f2398d747b36224ULL,  // 5^-64
+    0xd29fe4b18e88640eULL, 0x8eec7f0d19a03aadULL,  // 5^-63
+    0x83a3eeeef9153e89ULL, 0x1953cf68300424acULL,  // 5^-62
+    0xa48ceaaab75a8e2bULL, 0x5fa8c3423c052dd7ULL,  // 5^-61
+    0xcdb02555653131b6ULL, 0x3792f412cb06794dULL,  // 5^-60
+    0x808e17555f3ebf11ULL, 0xe2bbd88bbee40bd0ULL,  // 5^-59
+    0xa0b19d2ab70e6ed6ULL, 0x5b6aceaeae9d0ec4ULL,  // 5^-58
+    0xc8de047564d20a8bULL, 0xf245825a5a445275ULL,  // 5^-57
+    0xfb158592be068d2eULL, 0xeed6e2f0f0d56712ULL,  // 5^-56
+    0x9ced737bb6c4183dULL, 0x55464dd69685606bULL,  // 5^-55
+    0xc428d05aa4751e4cULL, 0xaa97e14c3c26b886ULL,  // 5^-54
+    0xf53304714d9265dfULL, 0xd53dd99f4b3066a8ULL,  // 5^-53
+    0x993fe2c6d07b7fabULL, 0xe546a8038efe4029ULL,  // 5^-52
+    0xbf8fdb78849a5f96ULL, 0xde98520472bdd033ULL,  // 5^-51
+    0xef73d256a5c0f77cULL, 0x963e66858f6d4440ULL,  // 5^-50
+    0x95a8637627989aadULL, 0xdde7001379a44aa8ULL,  // 5^-49
+    0xbb127c53b17ec159ULL, 0x5560c018580d5d52ULL,  // 5^-48
+    0xe9d71b689dde71afULL, 0xaab8f01e6e10b4a6ULL,  // 5^-47
+    0x9226712162ab070dULL, 0xcab3961304ca70e8ULL,  // 5^-46
+    0xb6b00d69bb55c8d1ULL, 0x3d607b97c5fd0d22ULL,  // 5^-45
+    0xe45c10c42a2b3b05ULL, 0x8cb89a7db77c506aULL,  // 5^-44
+    0x8eb98a7a9a5b04e3ULL, 0x77f3608e92adb242ULL,  // 5^-43
+    0xb267ed1940f1c61cULL, 0x55f038b237591ed3ULL,  // 5^-42
+    0xdf01e85f912e37a3ULL, 0x6b6c46dec52f6688ULL,  // 5^-41
+    0x8b61313bbabce2c6ULL, 0x2323ac4b3b3da015ULL,  // 5^-40
+    0xae397d8aa96c1b77ULL, 0xabec975e0a0d081aULL,  // 5^-39
+    0xd9c7dced53c72255ULL, 0x96e7bd358c904a21ULL,  // 5^-38
+    0x881cea14545c7575ULL, 0x7e50d64177da2e54ULL,  // 5^-37
+    0xaa242499697392d2ULL, 0xdde50bd1d5d0b9e9ULL,  // 5^-36
+    0xd4ad2dbfc3d07787ULL, 0x955e4ec64b44e864ULL,  // 5^-35
+    0x84ec3c97da624ab4ULL, 0xbd5af13bef0b113eULL,  // 5^-34
+    0xa6274bbdd0fadd61ULL, 0xecb1ad8aeacdd58eULL,  // 5^-33
+    0xcfb11ead453994baULL, 0x67de18eda5814af2ULL,  // 5^-32
+    0x81ceb32c4b43fcf4ULL, 0x80eacf948770ced7ULL,  // 5^-31
+    0xa2425ff75e14fc31ULL, 0xa1258379a94d028dULL,  // 5^-30
+    0xcad2f7f5359a3b3eULL, 0x096ee45813a04330ULL,  // 5^-29
+    0xfd87b5f28300ca0dULL, 0x8bca9d6e188853fcULL,  // 5^-28
+    0x9e74d1b791e07e48ULL, 0x775ea264cf55347eULL,  // 5^-27
+    0xc612062576589ddaULL, 0x95364afe032a819eULL,  // 5^-26
+    0xf79687aed3eec551ULL, 0x3a83ddbd83f52205ULL,  // 5^-25
+    0x9abe14cd44753b52ULL, 0xc4926a9672793543ULL,  // 5^-24
+    0xc16d9a0095928a27ULL, 0x75b7053c0f178294ULL,  // 5^-23
+    0xf1c90080baf72cb1ULL, 0x5324c68b12dd6339ULL,  // 5^-22
+    0x971da05074da7beeULL, 0xd3f6fc16ebca5e04ULL,  // 5^-21
+    0xbce5086492111aeaULL, 0x88f4bb1ca6bcf585ULL,  // 5^-20
+    0xec1e4a7db69561a5ULL, 0x2b31e9e3d06c32e6ULL,  // 5^-19
+    0x9392ee8e921d5d07ULL, 0x3aff322e62439fd0ULL,  // 5^-18
+    0xb877aa3236a4b449ULL, 0x09befeb9fad487c3ULL,  // 5^-17
+    0xe69594bec44de15bULL, 0x4c2ebe687989a9b4ULL,  // 5^-16
+    0x901d7cf73ab0acd9ULL, 0x0f9d37014bf60a11ULL,  // 5^-15
+    0xb424dc35095cd80fULL, 0x538484c19ef38c95ULL,  // 5^-14
+    0xe12e13424bb40e13ULL, 0x2865a5f206b06fbaULL,  // 5^-13
+    0x8cbccc096f5088cbULL, 0xf93f87b7442e45d4ULL,  // 5^-12
+    0xafebff0bcb24aafeULL, 0xf78f69a51539d749ULL,  // 5^-11
+    0xdbe6fecebdedd5beULL, 0xb573440e5a884d1cULL,  // 5^-10
+    0x89705f4136b4a597ULL, 0x31680a88f8953031ULL,  // 5^-9
+    0xabcc77118461cefcULL, 0xfdc20d2b36ba7c3eULL,  // 5^-8
+    0xd6bf94d5e57a42bcULL, 0x3d32907604691b4dULL,  // 5^-7
+    0x8637bd05af6c69b5ULL, 0xa63f9a49c2c1b110ULL,  // 5^-6
+    0xa7c5ac471b478423ULL, 0x0fcf80dc33721d54ULL,  // 5^-5
+    0xd1b71758e219652bULL, 0xd3c36113404ea4a9ULL,  // 5^-4
+    0x83126e978d4fdf3bULL, 0x645a1cac083126eaULL,  // 5^-3
+    0xa3d70a3d70a3d70aULL, 0x3d70a3d70a3d70a4ULL,  // 5^-2
+    0xccccccccccccccccULL, 0xcccccccccccccccdULL,  // 5^-1
+    0x8000000000000000ULL, 0x0000000000000000ULL,  // 5^0
+    0xa000000000000000ULL, 0x0000000000000000ULL,  // 5^1
+    0xc800000000000000ULL, 0x0000000000000000ULL,  // 5^2
+    0xfa00000000000000ULL, 0x0000000000000000ULL,  // 5^3
+    0x9c40000000000000ULL, 0x0000000000000000ULL,  // 5^4
+    0xc350000000000000ULL, 0x0000000000000000ULL,  // 5^5
+    0xf424000000000000ULL, 0x0000000000000000ULL,  // 5^6
+    0x9896800000000000ULL, 0x0000000000000000ULL,  // 5^7
+    0xbebc200000000000ULL, 0x0000000000000000ULL,  // 5^8
+    0xee6b280000000000ULL, 0x0000000000000000ULL,  // 5^9
+    0x9502f90000000000ULL, 0x0000000000000000ULL,  // 5^10
+    0xba43b74000000000ULL, 0x0000000000000000ULL,  // 5^11
+    0xe8d4a51000000000ULL, 0x0000000000000000ULL,  // 5^12
+    0x9184e72a00000000ULL, 0x0000000000000000ULL,  // 5^13
+    0xb5e620f480000000ULL, 0x0000000000000000ULL,  // 5^14
+    0xe35fa931a0000000ULL, 0x0000000000000000ULL,  // 5^15
+    0x8e1bc9bf04000000ULL, 0x0000000000000000ULL,  // 5^16
+    0xb1a2bc2ec5000000ULL, 0x0000000000000000ULL,  // 5^17
+    0xde0b6b3a76400000ULL, 0x0000000000000000ULL,  // 5^18
+    0x8ac7230489e80000ULL, 0x0000000000000000ULL,  // 5^19
+    0xad78ebc5ac620000ULL, 0x0000000000000000ULL,  // 5^20
+    0xd8d726b7177a8000ULL, 0x0000000000000000ULL,  // 5^21
+    0x878678326eac9000ULL, 0x0000000000000000ULL,  // 5^22
+    0xa968163f0a57b400ULL, 0x0000000000000000ULL,  // 5^23
+    0xd3c21bcecceda100ULL, 0x0000000000000000ULL,  // 5^24
+    0x84595161401484a0ULL, 0x0000000000000000ULL,  // 5^25
+    0xa56fa5b99019a5c8ULL, 0x0000000000000000ULL,  // 5^26
+    0xcecb8f27f4200f3aULL, 0x0000000000000000ULL,  // 5^27
+    0x813f3978f8940984ULL, 0x4000000000000000ULL,  // 5^28
+    0xa18f07d736b90be5ULL, 0x5000000000000000ULL,  // 5^29
+    0xc9f2c9cd04674edeULL, 0xa400000000000000ULL,  // 5^30
+    0xfc6f7c4045812296ULL, 0x4d00000000000000ULL,  // 5^31
+    0x9dc5ada82b70b59dULL, 0xf020000000000000ULL,  // 5^32
+    0xc5371912364ce305ULL, 0x6c28000000000000ULL,  // 5^33
+    0xf684df56c3e01bc6ULL, 0xc732000000000000ULL,  // 5^34
+    0x9a130b963a6c115cULL, 0x3c7f400000000000ULL,  // 5^35
+    0xc097ce7bc90715b3ULL, 0x4b9f100000000000ULL,  // 5^36
+    0xf0bdc21abb48db20ULL, 0x1e86d40000000000ULL,  // 5^37
+    0x96769950b50d88f4ULL, 0x1314448000000000ULL,  // 5^38
+};
+
+template <typename T>
+struct real_format;
+
+template <>
+struct real_format<float> {
+  typedef uint32_t bits_type;
+  static const int mantissa_bits = 23;
+  static const int minimum_exponent = -127;
+  static const int infinite_power = 0xFF;
+  static const int min_round_to_even = -17;
+  static const int max_round_to_even = 10;
+  static const int max_exact_pow10 = 10;  // 10^10 < 2^24 * 2^10
+  static float exactPow10(int q) {
+    static const float table[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f,
+                                  1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+    return table[q];
+  }
+};
+
+template <>
+struct real_format<double> {
+  typedef uint64_t bits_type;
+  static const int mantissa_bits = 52;
+  static const int minimum_exponent = -1023;
+  static const int infinite_power = 0x7FF;
+  static const int min_round_to_even = -4;
+  static const int max_round_to_even = 23;
+  static const int max_exact_pow10 = 22;
+  static double exactPow10(int q) {
+    static const double table[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                   1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                   1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                   1e18, 1e19, 1e20, 1e21, 1e22};
+    return table[q];
+  }
+};
+
+// 64 x 64 -> 128 bit multiply. Returns the low word.
+static inline uint64_t multiply64(uint64_t a, uint64_t b, uint64_t *high) {
+#if defined(_MSC_VER) && defined(_M_X64)
+  return _umul128(a, b, high);
+#elif defined(__SIZEOF_INT128__)
+  unsigned __int128 r = static_cast<unsigned __int128>(a) * b;
+  (*high) = static_cast<uint64_t>(r >> 64);
+  return static_cast<uint64_t>(r);
+#else
+  // From 32 bit halves, for 32 bit targets
+  uint64_t a_lo = a & 0xFFFFFFFFu, a_hi = a >> 32;
+  uint64_t b_lo = b & 0xFFFFFFFFu, b_hi = b >> 32;
+  uint64_t lo_lo = a_lo * b_lo;
+  uint64_t hi_lo = a_hi * b_lo;
+  uint64_t lo_hi = a_lo * b_hi;
+  uint64_t hi_hi = a_hi * b_hi;
+  uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFFu) + lo_hi;
+  (*high) = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+  return (cross << 32) | (lo_lo & 0xFFFFFFFFu);
+#endif
+}
+
+static inline int leadingZeros64(uint64_t x) {
+#if defined(_MSC_VER) && defined(_M_X64)
+  unsigned long index;
+  _BitScanReverse64(&index, x);
+  return 63 - static_cast<int>(index);
+#elif defined(__GNUC__)
+  return __builtin_clzll(x);
+#else
+  int n = 0;
+  while (!(x & (uint64_t(1) << 63))) {
+    x <<= 1;
+    n++;
+  }
+  return n;
+#endif
+}
+
+// Builds w * 10^q as the bits of a T, w != 0. Returns false if it can't be
+// decided without more precision.
+template <typename T>
+static bool eiselLemire(uint64_t w, int q,
+                        typename real_format<T>::bits_type *bits) {
+  typedef real_format<T> fmt;
+
+  int lz = leadingZeros64(w);
+  w <<= lz;
+
+  // w * 5^q, with enough of the product for the mantissa plus 3 bits
+  const uint64_t *pow5 = &kPow5Table[2 * (q - kPow5MinExponent)];
+  uint64_t high;
+  uint64_t low = multiply64(w, pow5[0], &high);
+  const uint64_t precision_mask =
+      uint64_t(0xFFFFFFFFFFFFFFFFULL) >> (fmt::mantissa_bits + 3);
+  if ((high & precision_mask) == precision_mask) {
+    uint64_t second_high;
+    multiply64(w, pow5[1], &second_high);
+    low += second_high;
+    if (second_high > low) high++;
+  }
+  if (low == 0xFFFFFFFFFFFFFFFFULL && (q < -27 || q > 55)) {
+    return false;
+  }
+
+  int upperbit = static_cast<int>(high >> 63);
+  int shift = upperbit + 64 - fmt::mantissa_bits - 3;
+  uint64_t mantissa = high >> shift;
+  int power2 = (((152170 + 65536) * q) >> 16) + 63 + upperbit - lz -
+               fmt::minimum_exponent;
+
+  if (power2 <= 0) {
+    // Subnormal
+    if (-power2 + 1 >= 64) {
+      (*bits) = 0;
+      return true;
+    }
+    mantissa >>= -power2 + 1;
+    mantissa += (mantissa & 1);
+    mantissa >>= 1;
+    power2 = (mantissa < (uint64_t(1) << fmt::mantissa_bits)) ? 0 : 1;
+    (*bits) = static_cast<typename fmt::bits_type>(
+        (mantissa & ((uint64_t(1) << fmt::mantissa_bits) - 1)) |
+        (uint64_t(power2) << fmt::mantissa_bits));
+    return true;
+  }
+
+  // Exactly halfway between two values: round to even
+  if (low <= 1 && q >= fmt::min_round_to_even &&
+      q <= fmt::max_round_to_even && (mantissa & 3) == 1) {
+    if ((mantissa << shift) == high) mantissa &= ~uint64_t(1);
+  }
+
+  mantissa += (mantissa & 1);
+  mantissa >>= 1;
+  if (mantissa >= (uint64_t(2) << fmt::mantissa_bits)) {
+    mantissa = uint64_t(1) << fmt::mantissa_bits;
+    power2++;
+  }
+  mantissa &= ~(uint64_t(1) << fmt::mantissa_bits);
+
+  if (power2 >= fmt::infinite_power) {
+    power2 = fmt::infinite_power;
+    mantissa = 0;
+  }
+  (*bits) = static_cast<typename fmt::bits_type>(
+      mantissa | (uint64_t(power2) << fmt::mantissa_bits));
+  return true;
+}
+
+// Converts w * 10^q to a T. `truncated' means digits after the first 19 were
+// dropped from w. Returns false if the caller must fall back to strtod.
+template <typename T>
+static bool decimalToReal(uint64_t w, int q, bool truncated, T *result) {
+  typedef real_format<T> fmt;
+
+  if (w == 0) {
+    (*result) = 0;
+    return true;
+  }
+
+  // Exact when w and 10^q are both exact in T
+  if (!truncated && q >= -fmt::max_exact_pow10 && q <= fmt::max_exact_pow10 &&
+      w <= (uint64_t(1) << (fmt::mantissa_bits + 1))) {
+    T value = static_cast<T>(w);
+    (*result) = (q < 0) ? value / fmt::exactPow10(-q)
+                        : value * fmt::exactPow10(q);
+    return true;
+  }
+
+  if (q < kPow5MinExponent || q > kPow5MaxExponent) return false;
+
+  typename fmt::bits_type bits;
+  if (!eiselLemire<T>(w, q, &bits)) return false;
+
+  // With dropped digits the value is between w and w + 1
+  if (truncated) {
+    typename fmt::bits_type upper_bits;
+    if (!eiselLemire<T>(w + 1, q, &upper_bits) || upper_bits != bits) {
+      return false;
+    }
+  }
+
+  memcpy(result, &bits, sizeof(T));
+  return true;
+}
+
+static inline void strtoReal(const char *s, float *result) {
+  (*result) = strtof(s, NULL);
+}
+
+static inline void strtoReal(const char *s, double *result) {
+  (*result) = strtod(s, NULL);
+}
+
+// tryParseDouble's grammar, parsed straight to a correctly rounded real_t
+static bool parseRealFast(const char *s, const char *s_end, real_t *result) {
+  const char *curr = s;
+  if (curr >= s_end) return false;
+
+  bool negative = false;
+  if (*curr == '+' || *curr == '-') {
+    negative = (*curr == '-');
+    curr++;
+  } else if (!IS_DIGIT(*curr)) {
+    return false;
+  }
+
+  // Up to 19 significant digits fit in w, later ones only move the exponent
+  uint64_t w = 0;
+  int digits = 0;
+  int exponent = 0;
+  bool truncated = false;
+
+  // Read the integer part.
+  const char *int_start = curr;
+  while (curr < s_end && IS_DIGIT(*curr)) {
+    int d = *curr - '0';
+    if (digits < 19) {
+      w = w * 10 + static_cast<uint64_t>(d);
+      if (w) digits++;
+    } else {
+      truncated |= (d != 0);
+      exponent++;
+    }
+    curr++;
+  }
+  if (curr == int_start) return false;
+
+  bool has_exponent = false;
+  if (curr < s_end && *curr == '.') {
+    // Read the decimal part.
+    curr++;
+    while (curr < s_end && IS_DIGIT(*curr)) {
+      int d = *curr - '0';
+      if (digits < 19) {
+        w = w * 10 + static_cast<uint64_t>(d);
+        if (w) digits++;
+        exponent--;
+      } else {
+        truncated |= (d != 0);
+      }
+      curr++;
+    }
+    has_exponent = (curr < s_end && (*curr == 'e' || *curr == 'E'));
+  } else if (curr < s_end && (*curr == 'e' || *curr == 'E')) {
+    has_exponent = true;
+  }
+
+  if (has_exponent) {
+    // Read the exponent part.
+    curr++;
+    bool exp_negative = false;
+    if (curr < s_end && (*curr == '+' || *curr == '-')) {
+      exp_negative = (*curr == '-');
+      curr++;
+    }
+    const char *exp_start = curr;
+    int exp_value = 0;
+    while (curr < s_end && IS_DIGIT(*curr)) {
+      if (exp_value < 100000) exp_value = exp_value * 10 + (*curr - '0');
+      curr++;
+    }
+    // Empty E is not allowed.
+    if (curr == exp_start) return false;
+    exponent += exp_negative ? -exp_value : exp_value;
+  }
+
+  real_t value;
+  if (!decimalToReal(w, exponent, truncated, &value)) {
+    // Needs more precision than 128 bits of 5^q: let the C library round it
+    char stack_buf[64];
+    size_t len = static_cast<size_t>(curr - s);
+    if (len < sizeof(stack_buf)) {
+      memcpy(stack_buf, s, len);
+      stack_buf[len] = '\0';
+      strtoReal(stack_buf, &value);
+    } else {
+      std::string long_buf(s, curr);
+      strtoReal(long_buf.c_str(), &value);
+    }
+    (*result) = value;
+    return true;
+  }
+
+  (*result) = negative ? -value : value;
+  return true;
+}
+
 static inline bool parseOnOff(const char **token, bool default_value = true) {
   (*token) += strspn((*token), " \t");
   const char *end = (*token) + strcspn((*token), " \t\r");
@@ -1064,231 +1512,233 @@ static int pnpoly(int nvert, T *vertx, T *verty, T testx, T testy) {
 }
 
 // TODO(syoyo): refactor function.
+// Triangulate a polygon of more than three vertices by ear clipping, calling
+// emit(a, b, c) for each triangle. `remainingFace` is scratch space.
+template <typename VertexArray, typename EmitTriangle>
+static void triangulatePolygon(const vertex_index_t *face, size_t npolys,
+                               const VertexArray &v,
+                               std::vector<vertex_index_t> &remainingFace,
+                               EmitTriangle emit) {
+  vertex_index_t i0, i1, i2;
+
+  // find the two axes to work in
+  size_t axes[2] = {1, 2};
+  for (size_t k = 0; k < npolys; ++k) {
+    i0 = face[(k + 0) % npolys];
+    i1 = face[(k + 1) % npolys];
+    i2 = face[(k + 2) % npolys];
+    size_t vi0 = size_t(i0.v_idx);
+    size_t vi1 = size_t(i1.v_idx);
+    size_t vi2 = size_t(i2.v_idx);
+
+    if (((3 * vi0 + 2) >= v.size()) || ((3 * vi1 + 2) >= v.size()) ||
+        ((3 * vi2 + 2) >= v.size())) {
+      // Invalid triangle.
+      // FIXME(syoyo): Is it ok to simply skip this invalid triangle?
+      continue;
+    }
+    real_t v0x = v[vi0 * 3 + 0];
+    real_t v0y = v[vi0 * 3 + 1];
+    real_t v0z = v[vi0 * 3 + 2];
+    real_t v1x = v[vi1 * 3 + 0];
+    real_t v1y = v[vi1 * 3 + 1];
+    real_t v1z = v[vi1 * 3 + 2];
+    real_t v2x = v[vi2 * 3 + 0];
+    real_t v2y = v[vi2 * 3 + 1];
+    real_t v2z = v[vi2 * 3 + 2];
+    real_t e0x = v1x - v0x;
+    real_t e0y = v1y - v0y;
+    real_t e0z = v1z - v0z;
+    real_t e1x = v2x - v1x;
+    real_t e1y = v2y - v1y;
+    real_t e1z = v2z - v1z;
+    real_t cx = std::fabs(e0y * e1z - e0z * e1y);
+    real_t cy = std::fabs(e0z * e1x - e0x * e1z);
+    real_t cz = std::fabs(e0x * e1y - e0y * e1x);
+    const real_t epsilon = std::numeric_limits<real_t>::epsilon();
+    if (cx > epsilon || cy > epsilon || cz > epsilon) {
+      // found a corner
+      if (cx > cy && cx > cz) {
+      } else {
+        axes[0] = 0;
+        if (cz > cx && cz > cy) axes[1] = 1;
+      }
+      break;
+    }
+  }
+
+  real_t area = 0;
+  for (size_t k = 0; k < npolys; ++k) {
+    i0 = face[(k + 0) % npolys];
+    i1 = face[(k + 1) % npolys];
+    size_t vi0 = size_t(i0.v_idx);
+    size_t vi1 = size_t(i1.v_idx);
+    if (((vi0 * 3 + axes[0]) >= v.size()) ||
+        ((vi0 * 3 + axes[1]) >= v.size()) ||
+        ((vi1 * 3 + axes[0]) >= v.size()) ||
+        ((vi1 * 3 + axes[1]) >= v.size())) {
+      // Invalid index.
+      continue;
+    }
+    real_t v0x = v[vi0 * 3 + axes[0]];
+    real_t v0y = v[vi0 * 3 + axes[1]];
+    real_t v1x = v[vi1 * 3 + axes[0]];
+    real_t v1y = v[vi1 * 3 + axes[1]];
+    area += (v0x * v1y - v0y * v1x) * static_cast<real_t>(0.5);
+  }
+
+  int maxRounds = 10;  // arbitrary max loop count to protect against
+                       // unexpected errors
+
+  remainingFace.assign(face, face + npolys);
+  size_t guess_vert = 0;
+  vertex_index_t ind[3];
+  real_t vx[3];
+  real_t vy[3];
+  while (remainingFace.size() > 3 && maxRounds > 0) {
+    npolys = remainingFace.size();
+    if (guess_vert >= npolys) {
+      maxRounds -= 1;
+      guess_vert -= npolys;
+    }
+    for (size_t k = 0; k < 3; k++) {
+      ind[k] = remainingFace[(guess_vert + k) % npolys];
+      size_t vi = size_t(ind[k].v_idx);
+      if (((vi * 3 + axes[0]) >= v.size()) ||
+          ((vi * 3 + axes[1]) >= v.size())) {
+        // ???
+        vx[k] = static_cast<real_t>(0.0);
+        vy[k] = static_cast<real_t>(0.0);
+      } else {
+        vx[k] = v[vi * 3 + axes[0]];
+        vy[k] = v[vi * 3 + axes[1]];
+      }
+    }
+    real_t e0x = vx[1] - vx[0];
+    real_t e0y = vy[1] - vy[0];
+    real_t e1x = vx[2] - vx[1];
+    real_t e1y = vy[2] - vy[1];
+    real_t cross = e0x * e1y - e0y * e1x;
+    // if an internal angle
+    if (cross * area < static_cast<real_t>(0.0)) {
+      guess_vert += 1;
+      continue;
+    }
+
+    // check all other verts in case they are inside this triangle
+    bool overlap = false;
+    for (size_t otherVert = 3; otherVert < npolys; ++otherVert) {
+      size_t idx = (guess_vert + otherVert) % npolys;
+
+      if (idx >= remainingFace.size()) {
+        // ???
+        continue;
+      }
+
+      size_t ovi = size_t(remainingFace[idx].v_idx);
+
+      if (((ovi * 3 + axes[0]) >= v.size()) ||
+          ((ovi * 3 + axes[1]) >= v.size())) {
+        // ???
+        continue;
+      }
+      real_t tx = v[ovi * 3 + axes[0]];
+      real_t ty = v[ovi * 3 + axes[1]];
+      if (pnpoly(3, vx, vy, tx, ty)) {
+        overlap = true;
+        break;
+      }
+    }
+
+    if (overlap) {
+      guess_vert += 1;
+      continue;
+    }
+
+    // this triangle is an ear
+    emit(ind[0], ind[1], ind[2]);
+
+    // remove v1 from the list
+    size_t removed_vert_index = (guess_vert + 1) % npolys;
+    while (removed_vert_index + 1 < npolys) {
+      remainingFace[removed_vert_index] =
+          remainingFace[removed_vert_index + 1];
+      removed_vert_index += 1;
+    }
+    remainingFace.pop_back();
+  }
+
+  if (remainingFace.size() == 3) {
+    emit(remainingFace[0], remainingFace[1], remainingFace[2]);
+  }
+}
+
+template <typename VertexArray>
 static bool exportGroupsToShape(shape_t *shape,
-                                const std::vector<face_t> &faceGroup,
+                                const face_group_t &faceGroup,
                                 std::vector<int> &lineGroup,
                                 const std::vector<tag_t> &tags,
                                 const int material_id, const std::string &name,
                                 bool triangulate,
-                                const std::vector<real_t> &v) {
+                                const VertexArray &v) {
   if (faceGroup.empty() && lineGroup.empty()) {
     return false;
   }
 
   if (!faceGroup.empty()) {
+    // Copy of a polygon for ear clipping, reused between faces
+    std::vector<vertex_index_t> remainingFace;
+
     // Flatten vertices and indices
+    size_t face_offset = 0;
     for (size_t i = 0; i < faceGroup.size(); i++) {
-      const face_t &face = faceGroup[i];
+      const vertex_index_t *face = faceGroup.vertex_indices.data() + face_offset;
+      const unsigned int smoothing_group_id = faceGroup.smoothing_group_ids[i];
 
-      size_t npolys = face.vertex_indices.size();
+      size_t npolys = faceGroup.num_vertices[i];
+      face_offset += npolys;
 
       if (npolys < 3) {
         // Face must have 3+ vertices.
         continue;
       }
 
-      vertex_index_t i0 = face.vertex_indices[0];
-      vertex_index_t i1(-1);
-      vertex_index_t i2 = face.vertex_indices[1];
-
-      if (triangulate) {
-        // find the two axes to work in
-        size_t axes[2] = {1, 2};
-        for (size_t k = 0; k < npolys; ++k) {
-          i0 = face.vertex_indices[(k + 0) % npolys];
-          i1 = face.vertex_indices[(k + 1) % npolys];
-          i2 = face.vertex_indices[(k + 2) % npolys];
-          size_t vi0 = size_t(i0.v_idx);
-          size_t vi1 = size_t(i1.v_idx);
-          size_t vi2 = size_t(i2.v_idx);
-
-          if (((3 * vi0 + 2) >= v.size()) || ((3 * vi1 + 2) >= v.size()) ||
-              ((3 * vi2 + 2) >= v.size())) {
-            // Invalid triangle.
-            // FIXME(syoyo): Is it ok to simply skip this invalid triangle?
-            continue;
-          }
-          real_t v0x = v[vi0 * 3 + 0];
-          real_t v0y = v[vi0 * 3 + 1];
-          real_t v0z = v[vi0 * 3 + 2];
-          real_t v1x = v[vi1 * 3 + 0];
-          real_t v1y = v[vi1 * 3 + 1];
-          real_t v1z = v[vi1 * 3 + 2];
-          real_t v2x = v[vi2 * 3 + 0];
-          real_t v2y = v[vi2 * 3 + 1];
-          real_t v2z = v[vi2 * 3 + 2];
-          real_t e0x = v1x - v0x;
-          real_t e0y = v1y - v0y;
-          real_t e0z = v1z - v0z;
-          real_t e1x = v2x - v1x;
-          real_t e1y = v2y - v1y;
-          real_t e1z = v2z - v1z;
-          real_t cx = std::fabs(e0y * e1z - e0z * e1y);
-          real_t cy = std::fabs(e0z * e1x - e0x * e1z);
-          real_t cz = std::fabs(e0x * e1y - e0y * e1x);
-          const real_t epsilon = std::numeric_limits<real_t>::epsilon();
-          if (cx > epsilon || cy > epsilon || cz > epsilon) {
-            // found a corner
-            if (cx > cy && cx > cz) {
-            } else {
-              axes[0] = 0;
-              if (cz > cx && cz > cy) axes[1] = 1;
-            }
-            break;
-          }
-        }
-
-        real_t area = 0;
-        for (size_t k = 0; k < npolys; ++k) {
-          i0 = face.vertex_indices[(k + 0) % npolys];
-          i1 = face.vertex_indices[(k + 1) % npolys];
-          size_t vi0 = size_t(i0.v_idx);
-          size_t vi1 = size_t(i1.v_idx);
-          if (((vi0 * 3 + axes[0]) >= v.size()) ||
-              ((vi0 * 3 + axes[1]) >= v.size()) ||
-              ((vi1 * 3 + axes[0]) >= v.size()) ||
-              ((vi1 * 3 + axes[1]) >= v.size())) {
-            // Invalid index.
-            continue;
-          }
-          real_t v0x = v[vi0 * 3 + axes[0]];
-          real_t v0y = v[vi0 * 3 + axes[1]];
-          real_t v1x = v[vi1 * 3 + axes[0]];
-          real_t v1y = v[vi1 * 3 + axes[1]];
-          area += (v0x * v1y - v0y * v1x) * static_cast<real_t>(0.5);
+      if (triangulate && npolys == 3) {
+        // A triangle is its own triangulation
+        for (size_t k = 0; k < 3; k++) {
+          index_t idx;
+          idx.vertex_index = face[k].v_idx;
+          idx.normal_index = face[k].vn_idx;
+          idx.texcoord_index = face[k].vt_idx;
+          shape->mesh.indices.push_back(idx);
         }
 
-        int maxRounds = 10;  // arbitrary max loop count to protect against
-                             // unexpected errors
-
-        face_t remainingFace = face;  // copy
-        size_t guess_vert = 0;
-        vertex_index_t ind[3];
-        real_t vx[3];
-        real_t vy[3];
-        while (remainingFace.vertex_indices.size() > 3 && maxRounds > 0) {
-          npolys = remainingFace.vertex_indices.size();
-          if (guess_vert >= npolys) {
-            maxRounds -= 1;
-            guess_vert -= npolys;
-          }
-          for (size_t k = 0; k < 3; k++) {
-            ind[k] = remainingFace.vertex_indices[(guess_vert + k) % npolys];
-            size_t vi = size_t(ind[k].v_idx);
-            if (((vi * 3 + axes[0]) >= v.size()) ||
-                ((vi * 3 + axes[1]) >= v.size())) {
-              // ???
-              vx[k] = static_cast<real_t>(0.0);
-              vy[k] = static_cast<real_t>(0.0);
-            } else {
-              vx[k] = v[vi * 3 + axes[0]];
-              vy[k] = v[vi * 3 + axes[1]];
-            }
-          }
-          real_t e0x = vx[1] - vx[0];
-          real_t e0y = vy[1] - vy[0];
-          real_t e1x = vx[2] - vx[1];
-          real_t e1y = vy[2] - vy[1];
-          real_t cross = e0x * e1y - e0y * e1x;
-          // if an internal angle
-          if (cross * area < static_cast<real_t>(0.0)) {
-            guess_vert += 1;
-            continue;
-          }
-
-          // check all other verts in case they are inside this triangle
-          bool overlap = false;
-          for (size_t otherVert = 3; otherVert < npolys; ++otherVert) {
-            size_t idx = (guess_vert + otherVert) % npolys;
-
-            if (idx >= remainingFace.vertex_indices.size()) {
-              // ???
-              continue;
-            }
-
-            size_t ovi = size_t(remainingFace.vertex_indices[idx].v_idx);
-
-            if (((ovi * 3 + axes[0]) >= v.size()) ||
-                ((ovi * 3 + axes[1]) >= v.size())) {
-              // ???
-              continue;
-            }
-            real_t tx = v[ovi * 3 + axes[0]];
-            real_t ty = v[ovi * 3 + axes[1]];
-            if (pnpoly(3, vx, vy, tx, ty)) {
-              overlap = true;
-              break;
-            }
-          }
-
-          if (overlap) {
-            guess_vert += 1;
-            continue;
-          }
-
-          // this triangle is an ear
-          {
-            index_t idx0, idx1, idx2;
-            idx0.vertex_index = ind[0].v_idx;
-            idx0.normal_index = ind[0].vn_idx;
-            idx0.texcoord_index = ind[0].vt_idx;
-            idx1.vertex_index = ind[1].v_idx;
-            idx1.normal_index = ind[1].vn_idx;
-            idx1.texcoord_index = ind[1].vt_idx;
-            idx2.vertex_index = ind[2].v_idx;
-            idx2.normal_index = ind[2].vn_idx;
-            idx2.texcoord_index = ind[2].vt_idx;
-
-            shape->mesh.indices.push_back(idx0);
-            shape->mesh.indices.push_back(idx1);
-            shape->mesh.indices.push_back(idx2);
-
-            shape->mesh.num_face_vertices.push_back(3);
-            shape->mesh.material_ids.push_back(material_id);
-            shape->mesh.smoothing_group_ids.push_back(face.smoothing_group_id);
+        shape->mesh.num_face_vertices.push_back(3);
+        shape->mesh.material_ids.push_back(material_id);
+        shape->mesh.smoothing_group_ids.push_back(smoothing_group_id);
+      } else if (triangulate) {
+        triangulatePolygon(face, npolys, v, remainingFace,
+                           [&](const vertex_index_t &a, const vertex_index_t &b,
+                               const vertex_index_t &c) {
+          const vertex_index_t *corners[3] = {&a, &b, &c};
+          for (int k = 0; k < 3; k++) {
+            index_t idx;
+            idx.vertex_index = corners[k]->v_idx;
+            idx.normal_index = corners[k]->vn_idx;
+            idx.texcoord_index = corners[k]->vt_idx;
+            shape->mesh.indices.push_back(idx);
           }
 
-          // remove v1 from the list
-          size_t removed_vert_index = (guess_vert + 1) % npolys;
-          while (removed_vert_index + 1 < npolys) {
-            remainingFace.vertex_indices[removed_vert_index] =
-                remainingFace.vertex_indices[removed_vert_index + 1];
-            removed_vert_index += 1;
-          }
-          remainingFace.vertex_indices.pop_back();
-        }
-
-        if (remainingFace.vertex_indices.size() == 3) {
-          i0 = remainingFace.vertex_indices[0];
-          i1 = remainingFace.vertex_indices[1];
-          i2 = remainingFace.vertex_indices[2];
-          {
-            index_t idx0, idx1, idx2;
-            idx0.vertex_index = i0.v_idx;
-            idx0.normal_index = i0.vn_idx;
-            idx0.texcoord_index = i0.vt_idx;
-            idx1.vertex_index = i1.v_idx;
-            idx1.normal_index = i1.vn_idx;
-            idx1.texcoord_index = i1.vt_idx;
-            idx2.vertex_index = i2.v_idx;
-            idx2.normal_index = i2.vn_idx;
-            idx2.texcoord_index = i2.vt_idx;
-
-            shape->mesh.indices.push_back(idx0);
-            shape->mesh.indices.push_back(idx1);
-            shape->mesh.indices.push_back(idx2);
-
-            shape->mesh.num_face_vertices.push_back(3);
-            shape->mesh.material_ids.push_back(material_id);
-            shape->mesh.smoothing_group_ids.push_back(face.smoothing_group_id);
-          }
-        }
+          shape->mesh.num_face_vertices.push_back(3);
+          shape->mesh.material_ids.push_back(material_id);
+          shape->mesh.smoothing_group_ids.push_back(smoothing_group_id);
+        });
       } else {
         for (size_t k = 0; k < npolys; k++) {
           index_t idx;
-          idx.vertex_index = face.vertex_indices[k].v_idx;
-          idx.normal_index = face.vertex_indices[k].vn_idx;
-          idx.texcoord_index = face.vertex_indices[k].vt_idx;
+          idx.vertex_index = face[k].v_idx;
+          idx.normal_index = face[k].vn_idx;
+          idx.texcoord_index = face[k].vt_idx;
           shape->mesh.indices.push_back(idx);
         }
 
@@ -1296,7 +1746,7 @@ static bool exportGroupsToShape(shape_t *shape,
             static_cast<unsigned char>(npolys));
         shape->mesh.material_ids.push_back(material_id);  // per face
         shape->mesh.smoothing_group_ids.push_back(
-            face.smoothing_group_id);  // per face
+            smoothing_group_id);  // per face
       }
     }
 
@@ -1323,83 +1773,409 @@ static void SplitString(const std::string &s, char delim,
   }
 }
 
-void LoadMtl(std::map<std::string, int> *material_map,
-             std::vector<material_t> *materials, std::istream *inStream,
-             std::string *warning, std::string *err) {
-  (void)err;
+// Parser state changed by the line, material, group, object, tag and
+// smoothing group commands. Shared by LoadObj and LoadObjParallel so that
+// both build their shapes with exactly the same code.
+struct obj_state {
+  std::vector<tag_t> tags;
+  face_group_t faceGroup;
+  std::vector<int> lineGroup;
+  std::string name;
 
-  // Create a default material anyway.
-  material_t material;
-  InitMaterial(&material);
+  // material
+  std::map<std::string, int> material_map;
+  int material;
 
-  // Issue 43. `d` wins against `Tr` since `Tr` is not in the MTL specification.
-  bool has_d = false;
-  bool has_tr = false;
+  // smoothing group id
+  unsigned int current_smoothing_id;  // 0 means no smoothing.
 
-  std::stringstream warn_ss;
+  shape_t shape;
 
-  size_t line_no = 0;
-  std::string linebuf;
-  while (inStream->peek() != -1) {
-    safeGetline(*inStream, linebuf);
-      line_no++;
+  obj_state() : material(-1), current_smoothing_id(0) {}
+};
 
-    // Trim trailing whitespace.
-    if (linebuf.size() > 0) {
-      linebuf = linebuf.substr(0, linebuf.find_last_not_of(" \t") + 1);
-    }
+// The first `count` values of a vertex array, standing in for the vertices
+// that LoadObj would have read by a given line.
+struct real_array_view {
+  const real_t *values;
+  size_t count;
 
-    // Trim newline '\r\n' or '\n'
-    if (linebuf.size() > 0) {
-      if (linebuf[linebuf.size() - 1] == '\n')
-        linebuf.erase(linebuf.size() - 1);
+  size_t size() const { return count; }
+  const real_t &operator[](size_t i) const { return values[i]; }
+};
+
+// Handles the `l', `usemtl', `mtllib', `g', `o', `t' and `s' commands.
+// Returns false if `token' is not one of them.
+template <typename VertexArray>
+static bool parseStateCommand(obj_state *state, const char *token,
+                              size_t line_num, const VertexArray &v,
+                              std::vector<shape_t> *shapes,
+                              std::vector<material_t> *materials,
+                              MaterialReader *readMatFn, bool triangulate,
+                              std::string *warn, std::string *err) {
+  // line
+  if (token[0] == 'l' && IS_SPACE((token[1]))) {
+    token += 2;
+
+    line_t line_cache;
+    bool end_line_bit = 0;
+    while (!IS_NEW_LINE(token[0])) {
+      // get index from string
+      int idx;
+      fixIndex(parseInt(&token), 0, &idx);
+
+      size_t n = strspn(token, " \t\r");
+      token += n;
+
+      if (!end_line_bit) {
+        line_cache.idx0 = idx;
+      } else {
+        line_cache.idx1 = idx;
+        state->lineGroup.push_back(line_cache.idx0);
+        state->lineGroup.push_back(line_cache.idx1);
+        line_cache = line_t();
+      }
+      end_line_bit = !end_line_bit;
     }
-    if (linebuf.size() > 0) {
-      if (linebuf[linebuf.size() - 1] == '\r')
-        linebuf.erase(linebuf.size() - 1);
+
+    return true;
+  }
+
+  // use mtl
+  if ((0 == strncmp(token, "usemtl", 6)) && IS_SPACE((token[6]))) {
+    token += 7;
+    std::stringstream ss;
+    ss << token;
+    std::string namebuf = ss.str();
+
+    int newMaterialId = -1;
+    if (state->material_map.find(namebuf) != state->material_map.end()) {
+      newMaterialId = state->material_map[namebuf];
+    } else {
+      // { error!! material not found }
     }
 
-    // Skip if empty line.
-    if (linebuf.empty()) {
-      continue;
+    if (newMaterialId != state->material) {
+      // Create per-face material. Thus we don't add `shape` to `shapes` at
+      // this time.
+      // just clear `faceGroup` after `exportGroupsToShape()` call.
+      exportGroupsToShape(&state->shape, state->faceGroup, state->lineGroup,
+                          state->tags, state->material, state->name,
+                          triangulate, v);
+      state->faceGroup.clear();
+      state->material = newMaterialId;
     }
 
-    // Skip leading space.
-    const char *token = linebuf.c_str();
-    token += strspn(token, " \t");
+    return true;
+  }
 
-    assert(token);
-    if (token[0] == '\0') continue;  // empty line
+  // load mtl
+  if ((0 == strncmp(token, "mtllib", 6)) && IS_SPACE((token[6]))) {
+    if (readMatFn) {
+      token += 7;
 
-    if (token[0] == '#') continue;  // comment line
+      std::vector<std::string> filenames;
+      SplitString(std::string(token), ' ', filenames);
 
-    // new mtl
-    if ((0 == strncmp(token, "newmtl", 6)) && IS_SPACE((token[6]))) {
-      // flush previous material.
-      if (!material.name.empty()) {
-        material_map->insert(std::pair<std::string, int>(
-            material.name, static_cast<int>(materials->size())));
-        materials->push_back(material);
-      }
+      if (filenames.empty()) {
+        if (warn) {
+          std::stringstream ss;
+          ss << "Looks like empty filename for mtllib. Use default "
+              "material (line " << line_num << ".)\n";
 
-      // initial temporary material
-      InitMaterial(&material);
+          (*warn) += ss.str();
+        }
+      } else {
+        bool found = false;
+        for (size_t s = 0; s < filenames.size(); s++) {
+          std::string warn_mtl;
+          std::string err_mtl;
+          bool ok = (*readMatFn)(filenames[s].c_str(), materials,
+                                 &state->material_map, &warn_mtl, &err_mtl);
+          if (warn && (!warn_mtl.empty())) {
+            (*warn) += warn_mtl;
+          }
 
-      has_d = false;
-      has_tr = false;
+          if (err && (!err_mtl.empty())) {
+            (*err) += err_mtl;
+          }
 
-      // set new mtl name
-      token += 7;
-      {
-        std::stringstream sstr;
-        sstr << token;
-        material.name = sstr.str();
+          if (ok) {
+            found = true;
+            break;
+          }
+        }
+
+        if (!found) {
+          
+        }
       }
-      continue;
     }
 
-    // ambient
-    if (token[0] == 'K' && token[1] == 'a' && IS_SPACE((token[2]))) {
+    return true;
+  }
+
+  // group name
+  if (token[0] == 'g' && IS_SPACE((token[1]))) {
+    // flush previous face group.
+    bool ret = exportGroupsToShape(&state->shape, state->faceGroup,
+                                   state->lineGroup, state->tags,
+                                   state->material, state->name, triangulate,
+                                   v);
+    (void)ret;  // return value not used.
+
+    if (state->shape.mesh.indices.size() > 0) {
+      shapes->push_back(state->shape);
+    }
+
+    state->shape = shape_t();
+
+    // material = -1;
+    state->faceGroup.clear();
+
+    std::vector<std::string> names;
+
+    while (!IS_NEW_LINE(token[0])) {
+      std::string str = parseString(&token);
+      names.push_back(str);
+      token += strspn(token, " \t\r");  // skip tag
+    }
+
+    // names[0] must be 'g'
+
+    if (names.size() < 2) {
+      // 'g' with empty names
+      if (warn) {
+        std::stringstream ss;
+        ss << "Empty group name. line: " << line_num << "\n";
+        (*warn) += ss.str();
+        state->name = "";
+      }
+    } else {
+      std::stringstream ss;
+      ss << names[1];
+
+      // tinyobjloader does not support multiple groups for a primitive.
+      // Currently we concatinate multiple group names with a space to get
+      // single group name.
+
+      for (size_t i = 2; i < names.size(); i++) {
+        ss << " " << names[i];
+      }
+
+      state->name = ss.str();
+    }
+
+    return true;
+  }
+
+  // object name
+  if (token[0] == 'o' && IS_SPACE((token[1]))) {
+    // flush previous face group.
+    bool ret = exportGroupsToShape(&state->shape, state->faceGroup,
+                                   state->lineGroup, state->tags,
+                                   state->material, state->name, triangulate,
+                                   v);
+    if (ret) {
+      shapes->push_back(state->shape);
+    }
+
+    // material = -1;
+    state->faceGroup.clear();
+    state->shape = shape_t();
+
+    // @todo { multiple object name? }
+    token += 2;
+    std::stringstream ss;
+    ss << token;
+    state->name = ss.str();
+
+    return true;
+  }
+
+  if (token[0] == 't' && IS_SPACE(token[1])) {
+    const int max_tag_nums = 8192;  // FIXME(syoyo): Parameterize.
+    tag_t tag;
+
+    token += 2;
+
+    tag.name = parseString(&token);
+
+    tag_sizes ts = parseTagTriple(&token);
+
+    if (ts.num_ints < 0) {
+      ts.num_ints = 0;
+    }
+    if (ts.num_ints > max_tag_nums) {
+      ts.num_ints = max_tag_nums;
+    }
+
+    if (ts.num_reals < 0) {
+      ts.num_reals = 0;
+    }
+    if (ts.num_reals > max_tag_nums) {
+      ts.num_reals = max_tag_nums;
+    }
+
+    if (ts.num_strings < 0) {
+      ts.num_strings = 0;
+    }
+    if (ts.num_strings > max_tag_nums) {
+      ts.num_strings = max_tag_nums;
+    }
+
+    tag.intValues.resize(static_cast<size_t>(ts.num_ints));
+
+    for (size_t i = 0; i < static_cast<size_t>(ts.num_ints); ++i) {
+      tag.intValues[i] = parseInt(&token);
+    }
+
+    tag.floatValues.resize(static_cast<size_t>(ts.num_reals));
+    for (size_t i = 0; i < static_cast<size_t>(ts.num_reals); ++i) {
+      tag.floatValues[i] = parseReal(&token);
+    }
+
+    tag.stringValues.resize(static_cast<size_t>(ts.num_strings));
+    for (size_t i = 0; i < static_cast<size_t>(ts.num_strings); ++i) {
+      tag.stringValues[i] = parseString(&token);
+    }
+
+    state->tags.push_back(tag);
+
+    return true;
+  }
+
+  if (token[0] == 's' && IS_SPACE(token[1])) {
+    // smoothing group id
+    token += 2;
+
+    // skip space.
+    token += strspn(token, " \t");  // skip space
+
+    if (token[0] == '\0') {
+      return true;
+    }
+
+    if (token[0] == '\r' || token[1] == '\n') {
+      return true;
+    }
+
+    if (strlen(token) >= 3) {
+      if (token[0] == 'o' && token[1] == 'f' && token[2] == 'f') {
+        state->current_smoothing_id = 0;
+      }
+    } else {
+      // assume number
+      int smGroupId = parseInt(&token);
+      if (smGroupId < 0) {
+        // parse error. force set to 0.
+        // FIXME(syoyo): Report warning.
+        state->current_smoothing_id = 0;
+      } else {
+        state->current_smoothing_id = static_cast<unsigned int>(smGroupId);
+      }
+    }
+
+    return true;
+  }  // smoothing group id
+
+  return false;
+}
+
+// Flushes the last face group into `shapes' at the end of the file.
+template <typename VertexArray>
+static void finishShapes(obj_state *state, std::vector<shape_t> *shapes,
+                         bool triangulate, const VertexArray &v) {
+  bool ret = exportGroupsToShape(&state->shape, state->faceGroup,
+                                 state->lineGroup, state->tags,
+                                 state->material, state->name, triangulate, v);
+  // exportGroupsToShape return false when `usemtl` is called in the last
+  // line.
+  // we also add `shape` to `shapes` when `shape.mesh` has already some
+  // faces(indices)
+  if (ret || state->shape.mesh.indices.size()) {
+    shapes->push_back(state->shape);
+  }
+  state->faceGroup.clear();  // for safety
+}
+
+void LoadMtl(std::map<std::string, int> *material_map,
+             std::vector<material_t> *materials, std::istream *inStream,
+             std::string *warning, std::string *err) {
+  (void)err;
+
+  // Create a default material anyway.
+  material_t material;
+  InitMaterial(&material);
+
+  // Issue 43. `d` wins against `Tr` since `Tr` is not in the MTL specification.
+  bool has_d = false;
+  bool has_tr = false;
+
+  std::stringstream warn_ss;
+
+  size_t line_no = 0;
+  std::string linebuf;
+  while (inStream->peek() != -1) {
+    safeGetline(*inStream, linebuf);
+      line_no++;
+
+    // Trim trailing whitespace.
+    if (linebuf.size() > 0) {
+      linebuf = linebuf.substr(0, linebuf.find_last_not_of(" \t") + 1);
+    }
+
+    // Trim newline '\r\n' or '\n'
+    if (linebuf.size() > 0) {
+      if (linebuf[linebuf.size() - 1] == '\n')
+        linebuf.erase(linebuf.size() - 1);
+    }
+    if (linebuf.size() > 0) {
+      if (linebuf[linebuf.size() - 1] == '\r')
+        linebuf.erase(linebuf.size() - 1);
+    }
+
+    // Skip if empty line.
+    if (linebuf.empty()) {
+      continue;
+    }
+
+    // Skip leading space.
+    const char *token = linebuf.c_str();
+    token += strspn(token, " \t");
+
+    assert(token);
+    if (token[0] == '\0') continue;  // empty line
+
+    if (token[0] == '#') continue;  // comment line
+
+    // new mtl
+    if ((0 == strncmp(token, "newmtl", 6)) && IS_SPACE((token[6]))) {
+      // flush previous material.
+      if (!material.name.empty()) {
+        material_map->insert(std::pair<std::string, int>(
+            material.name, static_cast<int>(materials->size())));
+        materials->push_back(material);
+      }
+
+      // initial temporary material
+      InitMaterial(&material);
+
+      has_d = false;
+      has_tr = false;
+
+      // set new mtl name
+      token += 7;
+      {
+        std::stringstream sstr;
+        sstr << token;
+        material.name = sstr.str();
+      }
+      continue;
+    }
+
+    // ambient
+    if (token[0] == 'K' && token[1] == 'a' && IS_SPACE((token[2]))) {
       token += 2;
       real_t r, g, b;
       parseReal3(&r, &g, &b, &token);
@@ -1809,25 +2585,12 @@ bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
   std::vector<real_t> vn;
   std::vector<real_t> vt;
   std::vector<real_t> vc;
-  std::vector<tag_t> tags;
-  std::vector<face_t> faceGroup;
-  std::vector<int> lineGroup;
-  std::string name;
-
-  // material
-  std::map<std::string, int> material_map;
-  int material = -1;
-
-  // smoothing group id
-  unsigned int current_smoothing_id =
-      0;  // Initial value. 0 means no smoothing.
+  obj_state state;
 
   int greatest_v_idx = -1;
   int greatest_vn_idx = -1;
   int greatest_vt_idx = -1;
 
-  shape_t shape;
-
   bool found_all_colors = true;
 
   size_t line_num = 0;
@@ -1903,42 +2666,13 @@ bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
       continue;
     }
 
-    // line
-    if (token[0] == 'l' && IS_SPACE((token[1]))) {
-      token += 2;
-
-      line_t line_cache;
-      bool end_line_bit = 0;
-      while (!IS_NEW_LINE(token[0])) {
-        // get index from string
-        int idx;
-        fixIndex(parseInt(&token), 0, &idx);
-
-        size_t n = strspn(token, " \t\r");
-        token += n;
-
-        if (!end_line_bit) {
-          line_cache.idx0 = idx;
-        } else {
-          line_cache.idx1 = idx;
-          lineGroup.push_back(line_cache.idx0);
-          lineGroup.push_back(line_cache.idx1);
-          line_cache = line_t();
-        }
-        end_line_bit = !end_line_bit;
-      }
-
-      continue;
-    }
     // face
     if (token[0] == 'f' && IS_SPACE((token[1]))) {
       token += 2;
       token += strspn(token, " \t");
 
-      face_t face;
-
-      face.smoothing_group_id = current_smoothing_id;
-      face.vertex_indices.reserve(3);
+      face_group_t &faceGroup = state.faceGroup;
+      size_t first_vertex = faceGroup.vertex_indices.size();
 
       while (!IS_NEW_LINE(token[0])) {
         vertex_index_t vi;
@@ -1959,258 +2693,556 @@ bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
         greatest_vt_idx =
             greatest_vt_idx > vi.vt_idx ? greatest_vt_idx : vi.vt_idx;
 
-        face.vertex_indices.push_back(vi);
+        faceGroup.vertex_indices.push_back(vi);
         size_t n = strspn(token, " \t\r");
         token += n;
       }
 
-      // replace with emplace_back + std::move on C++11
-      faceGroup.push_back(face);
+      faceGroup.num_vertices.push_back(static_cast<unsigned int>(
+          faceGroup.vertex_indices.size() - first_vertex));
+      faceGroup.smoothing_group_ids.push_back(state.current_smoothing_id);
 
       continue;
     }
 
-    // use mtl
-    if ((0 == strncmp(token, "usemtl", 6)) && IS_SPACE((token[6]))) {
-      token += 7;
-      std::stringstream ss;
-      ss << token;
-      std::string namebuf = ss.str();
+    // line, use mtl, load mtl, group name, object name, tag and smoothing
+    // group commands
+    if (parseStateCommand(&state, token, line_num, v, shapes, materials,
+                          readMatFn, triangulate, warn, err)) {
+      continue;
+    }
 
-      int newMaterialId = -1;
-      if (material_map.find(namebuf) != material_map.end()) {
-        newMaterialId = material_map[namebuf];
-      } else {
-        // { error!! material not found }
-      }
+    // Ignore unknown command.
+  }
 
-      if (newMaterialId != material) {
-        // Create per-face material. Thus we don't add `shape` to `shapes` at
-        // this time.
-        // just clear `faceGroup` after `exportGroupsToShape()` call.
-        exportGroupsToShape(&shape, faceGroup, lineGroup, tags, material, name,
-                            triangulate, v);
-        faceGroup.clear();
-        material = newMaterialId;
-      }
+  // not all vertices have colors, no default colors desired? -> clear colors
+  if (!found_all_colors && !default_vcols_fallback) {
+    vc.clear();
+  }
 
-      continue;
+  if (greatest_v_idx >= static_cast<int>(v.size() / 3)) {
+    if (warn) {
+      std::stringstream ss;
+      ss << "Vertex indices out of bounds (line " << line_num << ".)\n" << std::endl;
+      (*warn) += ss.str();
+    }
+  }
+  if (greatest_vn_idx >= static_cast<int>(vn.size() / 3)) {
+    if (warn) {
+      std::stringstream ss;
+      ss << "Vertex normal indices out of bounds (line " << line_num << ".)\n" << std::endl;
+      (*warn) += ss.str();
+    }
+  }
+  if (greatest_vt_idx >= static_cast<int>(vt.size() / 2)) {
+    if (warn) {
+      std::stringstream ss;
+      ss << "Vertex texcoord indices out of bounds (line " << line_num << ".)\n" << std::endl;
+      (*warn) += ss.str();
     }
+  }
 
-    // load mtl
-    if ((0 == strncmp(token, "mtllib", 6)) && IS_SPACE((token[6]))) {
-      if (readMatFn) {
-        token += 7;
+  finishShapes(&state, shapes, triangulate, v);
 
-        std::vector<std::string> filenames;
-        SplitString(std::string(token), ' ', filenames);
+  if (err) {
+    (*err) += errss.str();
+  }
 
-        if (filenames.empty()) {
-          if (warn) {
-            std::stringstream ss;
-            ss << "Looks like empty filename for mtllib. Use default "
-                "material (line " << line_num << ".)\n";
+  attrib->vertices.swap(v);
+  attrib->normals.swap(vn);
+  attrib->texcoords.swap(vt);
+  attrib->colors.swap(vc);
 
-            (*warn) += ss.str();
-          }
-        } else {
-          bool found = false;
-          for (size_t s = 0; s < filenames.size(); s++) {
-            std::string warn_mtl;
-            std::string err_mtl;
-            bool ok = (*readMatFn)(filenames[s].c_str(), materials,
-                                   &material_map, &warn_mtl, &err_mtl);
-            if (warn && (!warn_mtl.empty())) {
-              (*warn) += warn_mtl;
-            }
+  return true;
+}
 
-            if (err && (!err_mtl.empty())) {
-              (*err) += err_mtl;
-            }
+// Parallel loader. The buffer is split into chunks that end on line breaks
+// and the vertex, normal, texcoord and face lines of each chunk are parsed on
+// a worker thread. Relative (negative) face indices are resolved against the
+// chunk's own counts and fixed up once every chunk is parsed and the counts
+// give each chunk its offset into the merged arrays. All other commands are
+// kept and replayed in file order through parseStateCommand.
+//
+// The chunks are parsed straight from the buffer, without copying lines or
+// allocating per line: everything goes into arrays that only grow.
+
+// A command line kept for the in-order replay
+struct obj_chunk_command {
+  const char *line_begin;
+  const char *line_end;
+  size_t line_num;   // line number within the chunk
+  size_t num_faces;  // faces in the chunk before this line
+  size_t num_v;      // vertex values in the chunk before this line
+};
 
-            if (ok) {
-              found = true;
-              break;
-            }
-          }
+// A face corner with indices relative to the chunk
+struct obj_relative_index {
+  size_t corner;  // index into face_indices
+  int mask;       // 1 = v_idx, 2 = vn_idx, 4 = vt_idx
+};
 
-          if (!found) {
-            
-          }
-        }
-      }
+struct obj_chunk {
+  const char *begin;
+  const char *end;
 
-      continue;
-    }
+  std::vector<real_t> v;
+  std::vector<real_t> vn;
+  std::vector<real_t> vt;
+  std::vector<real_t> vc;
+  bool found_all_colors;
+
+  std::vector<vertex_index_t> face_indices;  // corners of all faces
+  std::vector<unsigned int> face_sizes;      // corners in each face
+  std::vector<obj_relative_index> relative;
+  std::vector<obj_chunk_command> commands;
+
+  size_t num_lines;
+  size_t error_line;  // line of the first face that failed to parse, or 0
+
+  obj_chunk()
+      : begin(NULL),
+        end(NULL),
+        found_all_colors(true),
+        num_lines(0),
+        error_line(0) {}
+};
 
-    // group name
-    if (token[0] == 'g' && IS_SPACE((token[1]))) {
-      // flush previous face group.
-      bool ret = exportGroupsToShape(&shape, faceGroup, lineGroup, tags,
-                                     material, name, triangulate, v);
-      (void)ret;  // return value not used.
+// Returns the end of the line starting at `p', and sets `next' to the start
+// of the following line. Lines end at "\n", "\r\n" or "\r" as in safeGetline.
+// The returned end is at the first null character, if the line has one, as
+// the line would be cut there when used as a C string.
+static const char *findLineEnd(const char *p, const char *end,
+                               const char **next) {
+  while (p < end && *p != '\n' && *p != '\r' && *p != '\0') p++;
+  const char *line_end = p;
+  while (p < end && *p != '\n' && *p != '\r') p++;
+  if (p < end) {
+    if (*p == '\r' && p + 1 < end && p[1] == '\n') p++;
+    p++;
+  }
+  (*next) = p;
+  return line_end;
+}
 
-      if (shape.mesh.indices.size() > 0) {
-        shapes->push_back(shape);
-      }
+// Bounded versions of the token helpers, for parsing straight from the
+// buffer. `end' is the end of the line.
 
-      shape = shape_t();
+static inline char charAt(const char *p, const char *end) {
+  return (p < end) ? *p : '\0';
+}
 
-      // material = -1;
-      faceGroup.clear();
+static inline const char *skipSpace(const char *p, const char *end) {
+  while (p < end && IS_SPACE(*p)) p++;
+  return p;
+}
 
-      std::vector<std::string> names;
+static inline real_t parseReal(const char **token, const char *end,
+                               double default_value = 0.0) {
+  const char *s = skipSpace(*token, end);
+  const char *e = s;
+  while (e < end && *e != ' ' && *e != '\t' && *e != '\r') e++;
+  real_t f;
+  if (!parseRealFast(s, e, &f)) f = static_cast<real_t>(default_value);
+  (*token) = e;
+  return f;
+}
 
-      while (!IS_NEW_LINE(token[0])) {
-        std::string str = parseString(&token);
-        names.push_back(str);
-        token += strspn(token, " \t\r");  // skip tag
-      }
+static inline bool parseReal(const char **token, const char *end,
+                             real_t *out) {
+  const char *s = skipSpace(*token, end);
+  const char *e = s;
+  while (e < end && *e != ' ' && *e != '\t' && *e != '\r') e++;
+  bool ret = parseRealFast(s, e, out);
+  (*token) = e;
+  return ret;
+}
 
-      // names[0] must be 'g'
+// As atoi
+static inline int parseIndex(const char *p, const char *end) {
+  while (p < end && (IS_SPACE(*p) || *p == '\r' || *p == '\v' || *p == '\f')) {
+    p++;
+  }
+  bool negative = false;
+  if (p < end && (*p == '+' || *p == '-')) {
+    negative = (*p == '-');
+    p++;
+  }
+  unsigned int value = 0;
+  while (p < end && IS_DIGIT(*p)) {
+    value = value * 10 + static_cast<unsigned int>(*p - '0');
+    p++;
+  }
+  return negative ? -static_cast<int>(value) : static_cast<int>(value);
+}
 
-      if (names.size() < 2) {
-        // 'g' with empty names
-        if (warn) {
-          std::stringstream ss;
-          ss << "Empty group name. line: " << line_num << "\n";
-          (*warn) += ss.str();
-          name = "";
-        }
-      } else {
-        std::stringstream ss;
-        ss << names[1];
+// As (*token) += strcspn((*token), "/ \t\r")
+static inline const char *skipIndex(const char *p, const char *end) {
+  while (p < end && *p != '/' && *p != ' ' && *p != '\t' && *p != '\r') p++;
+  return p;
+}
 
-        // tinyobjloader does not support multiple groups for a primitive.
-        // Currently we concatinate multiple group names with a space to get
-        // single group name.
+// parseTriple on the buffer. Sets a bit in `relative_mask' for each index
+// that was relative.
+static bool parseTriple(const char **token, const char *end, int vsize,
+                        int vnsize, int vtsize, vertex_index_t *ret,
+                        int *relative_mask) {
+  vertex_index_t vi(-1);
+  int mask = 0;
+  const char *p = *token;
 
-        for (size_t i = 2; i < names.size(); i++) {
-          ss << " " << names[i];
+  int idx = parseIndex(p, end);
+  if (!fixIndex(idx, vsize, &(vi.v_idx))) {
+    return false;
+  }
+  if (idx < 0) mask |= 1;
+
+  p = skipIndex(p, end);
+  if (charAt(p, end) == '/') {
+    p++;
+
+    if (charAt(p, end) == '/') {
+      // i//k
+      p++;
+      idx = parseIndex(p, end);
+      if (!fixIndex(idx, vnsize, &(vi.vn_idx))) {
+        return false;
+      }
+      if (idx < 0) mask |= 2;
+      p = skipIndex(p, end);
+    } else {
+      // i/j/k or i/j
+      idx = parseIndex(p, end);
+      if (!fixIndex(idx, vtsize, &(vi.vt_idx))) {
+        return false;
+      }
+      if (idx < 0) mask |= 4;
+
+      p = skipIndex(p, end);
+      if (charAt(p, end) == '/') {
+        // i/j/k
+        p++;  // skip '/'
+        idx = parseIndex(p, end);
+        if (!fixIndex(idx, vnsize, &(vi.vn_idx))) {
+          return false;
         }
-
-        name = ss.str();
+        if (idx < 0) mask |= 2;
+        p = skipIndex(p, end);
       }
-
-      continue;
     }
+  }
 
-    // object name
-    if (token[0] == 'o' && IS_SPACE((token[1]))) {
-      // flush previous face group.
-      bool ret = exportGroupsToShape(&shape, faceGroup, lineGroup, tags,
-                                     material, name, triangulate, v);
-      if (ret) {
-        shapes->push_back(shape);
-      }
-
-      // material = -1;
-      faceGroup.clear();
-      shape = shape_t();
+  (*token) = p;
+  (*ret) = vi;
+  (*relative_mask) = mask;
+  return true;
+}
 
-      // @todo { multiple object name? }
-      token += 2;
-      std::stringstream ss;
-      ss << token;
-      name = ss.str();
+// Runs `work(i)' for every i in [0, count) with the caller's `parallel_for',
+// or else on up to `num_threads' threads, including the calling thread.
+template <typename Work>
+static void parallelFor(size_t count, unsigned int num_threads,
+                        const ParallelFor *parallel_for, const Work &work) {
+  if (parallel_for && count > 1) {
+    (*parallel_for)(count, work);
+    return;
+  }
+  if (num_threads > count) num_threads = static_cast<unsigned int>(count);
+  if (num_threads <= 1) {
+    for (size_t i = 0; i < count; i++) work(i);
+    return;
+  }
 
-      continue;
-    }
+  std::atomic<size_t> next_item(0);
+  auto run = [&]() {
+    for (size_t i = next_item++; i < count; i = next_item++) work(i);
+  };
 
-    if (token[0] == 't' && IS_SPACE(token[1])) {
-      const int max_tag_nums = 8192;  // FIXME(syoyo): Parameterize.
-      tag_t tag;
+  std::vector<std::thread> threads;
+  for (unsigned int t = 1; t < num_threads; t++) {
+    threads.push_back(std::thread(run));
+  }
+  run();
+  for (size_t t = 0; t < threads.size(); t++) threads[t].join();
+}
 
-      token += 2;
+static void parseObjChunk(obj_chunk *chunk, bool default_vcols_fallback) {
+  const char *p = chunk->begin;
+  while (p < chunk->end) {
+    const char *line = p;
+    const char *end = findLineEnd(p, chunk->end, &p);
 
-      tag.name = parseString(&token);
+    chunk->num_lines++;
 
-      tag_sizes ts = parseTagTriple(&token);
+    // Skip leading space.
+    const char *token = skipSpace(line, end);
 
-      if (ts.num_ints < 0) {
-        ts.num_ints = 0;
-      }
-      if (ts.num_ints > max_tag_nums) {
-        ts.num_ints = max_tag_nums;
-      }
+    if (token == end) continue;  // empty line
 
-      if (ts.num_reals < 0) {
-        ts.num_reals = 0;
-      }
-      if (ts.num_reals > max_tag_nums) {
-        ts.num_reals = max_tag_nums;
-      }
+    if (token[0] == '#') continue;  // comment line
 
-      if (ts.num_strings < 0) {
-        ts.num_strings = 0;
-      }
-      if (ts.num_strings > max_tag_nums) {
-        ts.num_strings = max_tag_nums;
-      }
+    char c1 = charAt(token + 1, end);
+    char c2 = charAt(token + 2, end);
 
-      tag.intValues.resize(static_cast<size_t>(ts.num_ints));
+    // vertex
+    if (token[0] == 'v' && IS_SPACE(c1)) {
+      token += 2;
+      real_t x = parseReal(&token, end);
+      real_t y = parseReal(&token, end);
+      real_t z = parseReal(&token, end);
 
-      for (size_t i = 0; i < static_cast<size_t>(ts.num_ints); ++i) {
-        tag.intValues[i] = parseInt(&token);
+      // Extension: vertex colors
+      real_t r, g, b;
+      const bool found_color = parseReal(&token, end, &r) &&
+                               parseReal(&token, end, &g) &&
+                               parseReal(&token, end, &b);
+      if (!found_color) {
+        r = g = b = 1.0;
       }
+      chunk->found_all_colors &= found_color;
 
-      tag.floatValues.resize(static_cast<size_t>(ts.num_reals));
-      for (size_t i = 0; i < static_cast<size_t>(ts.num_reals); ++i) {
-        tag.floatValues[i] = parseReal(&token);
-      }
+      chunk->v.push_back(x);
+      chunk->v.push_back(y);
+      chunk->v.push_back(z);
 
-      tag.stringValues.resize(static_cast<size_t>(ts.num_strings));
-      for (size_t i = 0; i < static_cast<size_t>(ts.num_strings); ++i) {
-        tag.stringValues[i] = parseString(&token);
+      if (chunk->found_all_colors || default_vcols_fallback) {
+        chunk->vc.push_back(r);
+        chunk->vc.push_back(g);
+        chunk->vc.push_back(b);
       }
 
-      tags.push_back(tag);
-
       continue;
     }
 
-    if (token[0] == 's' && IS_SPACE(token[1])) {
-      // smoothing group id
-      token += 2;
+    // normal
+    if (token[0] == 'v' && c1 == 'n' && IS_SPACE(c2)) {
+      token += 3;
+      real_t x = parseReal(&token, end);
+      real_t y = parseReal(&token, end);
+      real_t z = parseReal(&token, end);
+      chunk->vn.push_back(x);
+      chunk->vn.push_back(y);
+      chunk->vn.push_back(z);
+      continue;
+    }
 
-      // skip space.
-      token += strspn(token, " \t");  // skip space
+    // texcoord
+    if (token[0] == 'v' && c1 == 't' && IS_SPACE(c2)) {
+      token += 3;
+      real_t x = parseReal(&token, end);
+      real_t y = parseReal(&token, end);
+      chunk->vt.push_back(x);
+      chunk->vt.push_back(y);
+      continue;
+    }
 
-      if (token[0] == '\0') {
-        continue;
-      }
+    // face
+    if (token[0] == 'f' && IS_SPACE(c1)) {
+      token += 2;
+      token = skipSpace(token, end);
 
-      if (token[0] == '\r' || token[1] == '\n') {
-        continue;
-      }
+      size_t first_corner = chunk->face_indices.size();
 
-      if (strlen(token) >= 3) {
-        if (token[0] == 'o' && token[1] == 'f' && token[2] == 'f') {
-          current_smoothing_id = 0;
+      while (token < end) {
+        vertex_index_t vi;
+        int relative_mask;
+        if (!parseTriple(&token, end, static_cast<int>(chunk->v.size() / 3),
+                         static_cast<int>(chunk->vn.size() / 3),
+                         static_cast<int>(chunk->vt.size() / 2), &vi,
+                         &relative_mask)) {
+          chunk->error_line = chunk->num_lines;
+          return;
         }
-      } else {
-        // assume number
-        int smGroupId = parseInt(&token);
-        if (smGroupId < 0) {
-          // parse error. force set to 0.
-          // FIXME(syoyo): Report warning.
-          current_smoothing_id = 0;
-        } else {
-          current_smoothing_id = static_cast<unsigned int>(smGroupId);
+
+        if (relative_mask) {
+          obj_relative_index rel;
+          rel.corner = chunk->face_indices.size();
+          rel.mask = relative_mask;
+          chunk->relative.push_back(rel);
         }
+
+        chunk->face_indices.push_back(vi);
+        while (token < end && (IS_SPACE(*token) || *token == '\r')) token++;
       }
 
+      chunk->face_sizes.push_back(
+          static_cast<unsigned int>(chunk->face_indices.size() - first_corner));
       continue;
-    }  // smoothing group id
+    }
 
-    // Ignore unknown command.
+    // Everything else is replayed in order once all chunks are parsed
+    obj_chunk_command command;
+    command.line_begin = token;
+    command.line_end = end;
+    command.line_num = chunk->num_lines;
+    command.num_faces = chunk->face_sizes.size();
+    command.num_v = chunk->v.size();
+    chunk->commands.push_back(command);
+  }
+}
+
+// Appends the chunk's faces up to `face_end' to the current face group
+static void appendChunkFaces(obj_state *state, const obj_chunk &chunk,
+                             size_t face_end, size_t *face, size_t *corner) {
+  size_t corner_end = *corner;
+  for (size_t f = *face; f < face_end; f++) corner_end += chunk.face_sizes[f];
+
+  face_group_t &group = state->faceGroup;
+  group.vertex_indices.insert(group.vertex_indices.end(),
+                              chunk.face_indices.begin() + static_cast<std::ptrdiff_t>(*corner),
+                              chunk.face_indices.begin() + static_cast<std::ptrdiff_t>(corner_end));
+  group.num_vertices.insert(group.num_vertices.end(),
+                            chunk.face_sizes.begin() + static_cast<std::ptrdiff_t>(*face),
+                            chunk.face_sizes.begin() + static_cast<std::ptrdiff_t>(face_end));
+  group.smoothing_group_ids.resize(
+      group.smoothing_group_ids.size() + (face_end - *face),
+      state->current_smoothing_id);
+
+  (*face) = face_end;
+  (*corner) = corner_end;
+}
+
+bool LoadObjParallel(attrib_t *attrib, std::vector<shape_t> *shapes,
+                     std::vector<material_t> *materials, std::string *warn,
+                     std::string *err, const char *buf, size_t len,
+                     MaterialReader *readMatFn /*= NULL*/, bool triangulate,
+                     bool default_vcols_fallback, unsigned int num_threads,
+                     const ParallelFor *parallel_for /*= NULL*/) {
+  attrib->vertices.clear();
+  attrib->normals.clear();
+  attrib->texcoords.clear();
+  attrib->colors.clear();
+  shapes->clear();
+
+  if (num_threads == 0) {
+    num_threads = std::thread::hardware_concurrency();
+    if (num_threads == 0) num_threads = 1;
+  }
+
+  // A few chunks per thread evens out the work, but each chunk should be big
+  // enough to be worth merging
+  const size_t min_chunk_size = 256 * 1024;
+  size_t num_chunks = len / min_chunk_size;
+  if (num_chunks > size_t(num_threads) * 4) num_chunks = size_t(num_threads) * 4;
+  if (num_chunks < 1) num_chunks = 1;
+
+  std::vector<obj_chunk> chunks(num_chunks);
+  const char *buf_end = buf + len;
+  const char *p = buf;
+  for (size_t c = 0; c < num_chunks; c++) {
+    chunks[c].begin = p;
+    if (c + 1 == num_chunks) {
+      p = buf_end;
+    } else {
+      const char *split = buf + len * (c + 1) / num_chunks;
+      if (split < p) split = p;
+      findLineEnd(split, buf_end, &p);
+    }
+    chunks[c].end = p;
+
+    // Reserve for roughly the bytes per line of a typical scanned mesh
+    size_t chunk_size = static_cast<size_t>(chunks[c].end - chunks[c].begin);
+    chunks[c].v.reserve(chunk_size / 32 * 3);
+    chunks[c].face_indices.reserve(chunk_size / 32 * 3);
+    chunks[c].face_sizes.reserve(chunk_size / 32);
+  }
+
+  parallelFor(num_chunks, num_threads, parallel_for, [&](size_t c) {
+    parseObjChunk(&chunks[c], default_vcols_fallback);
+  });
+
+  // Prefix sums of the chunk sizes give their offsets in the merged arrays
+  std::vector<size_t> v_offset(num_chunks + 1, 0);
+  std::vector<size_t> vn_offset(num_chunks + 1, 0);
+  std::vector<size_t> vt_offset(num_chunks + 1, 0);
+  std::vector<size_t> vc_offset(num_chunks + 1, 0);
+  std::vector<size_t> line_offset(num_chunks + 1, 0);
+  bool found_all_colors = true;
+  for (size_t c = 0; c < num_chunks; c++) {
+    if (chunks[c].error_line) {
+      if (err) {
+        std::stringstream ss;
+        ss <<  "Failed parse `f' line(e.g. zero value for face index. line " << line_offset[c] + chunks[c].error_line << ".)\n";
+        (*err) += ss.str();
+      }
+      return false;
+    }
+
+    v_offset[c + 1] = v_offset[c] + chunks[c].v.size();
+    vn_offset[c + 1] = vn_offset[c] + chunks[c].vn.size();
+    vt_offset[c + 1] = vt_offset[c] + chunks[c].vt.size();
+    vc_offset[c + 1] = vc_offset[c] + chunks[c].vc.size();
+    line_offset[c + 1] = line_offset[c] + chunks[c].num_lines;
+    found_all_colors &= chunks[c].found_all_colors;
   }
 
   // not all vertices have colors, no default colors desired? -> clear colors
-  if (!found_all_colors && !default_vcols_fallback) {
-    vc.clear();
+  bool keep_colors = found_all_colors || default_vcols_fallback;
+
+  std::vector<real_t> v(v_offset[num_chunks]);
+  std::vector<real_t> vn(vn_offset[num_chunks]);
+  std::vector<real_t> vt(vt_offset[num_chunks]);
+  std::vector<real_t> vc(keep_colors ? vc_offset[num_chunks] : 0);
+  std::vector<int> greatest_idx(num_chunks * 3, -1);
+
+  // Fix up the relative indices and merge the vertex arrays
+  parallelFor(num_chunks, num_threads, parallel_for, [&](size_t c) {
+    obj_chunk &chunk = chunks[c];
+
+    for (size_t i = 0; i < chunk.relative.size(); i++) {
+      const obj_relative_index &rel = chunk.relative[i];
+      vertex_index_t &vi = chunk.face_indices[rel.corner];
+      if (rel.mask & 1) vi.v_idx += static_cast<int>(v_offset[c] / 3);
+      if (rel.mask & 2) vi.vn_idx += static_cast<int>(vn_offset[c] / 3);
+      if (rel.mask & 4) vi.vt_idx += static_cast<int>(vt_offset[c] / 2);
+    }
+
+    int *greatest = &greatest_idx[c * 3];
+    for (size_t k = 0; k < chunk.face_indices.size(); k++) {
+      greatest[0] = std::max(greatest[0], chunk.face_indices[k].v_idx);
+      greatest[1] = std::max(greatest[1], chunk.face_indices[k].vn_idx);
+      greatest[2] = std::max(greatest[2], chunk.face_indices[k].vt_idx);
+    }
+
+    std::copy(chunk.v.begin(), chunk.v.end(), v.begin() + static_cast<std::ptrdiff_t>(v_offset[c]));
+    std::copy(chunk.vn.begin(), chunk.vn.end(), vn.begin() + static_cast<std::ptrdiff_t>(vn_offset[c]));
+    std::copy(chunk.vt.begin(), chunk.vt.end(), vt.begin() + static_cast<std::ptrdiff_t>(vt_offset[c]));
+    if (keep_colors) {
+      std::copy(chunk.vc.begin(), chunk.vc.end(), vc.begin() + static_cast<std::ptrdiff_t>(vc_offset[c]));
+    }
+  });
+
+  int greatest_v_idx = -1;
+  int greatest_vn_idx = -1;
+  int greatest_vt_idx = -1;
+  for (size_t c = 0; c < num_chunks; c++) {
+    greatest_v_idx = std::max(greatest_v_idx, greatest_idx[c * 3 + 0]);
+    greatest_vn_idx = std::max(greatest_vn_idx, greatest_idx[c * 3 + 1]);
+    greatest_vt_idx = std::max(greatest_vt_idx, greatest_idx[c * 3 + 2]);
   }
 
+  // Replay the faces and commands in file order. Each command sees only the
+  // vertices before it, as it would in LoadObj.
+  obj_state state;
+  std::string linebuf;
+  for (size_t c = 0; c < num_chunks; c++) {
+    const obj_chunk &chunk = chunks[c];
+    size_t face = 0;
+    size_t corner = 0;
+    for (size_t i = 0; i < chunk.commands.size(); i++) {
+      const obj_chunk_command &command = chunk.commands[i];
+      appendChunkFaces(&state, chunk, command.num_faces, &face, &corner);
+
+      linebuf.assign(command.line_begin, command.line_end);
+      real_array_view v_so_far = {v.empty() ? NULL : &v[0],
+                                  v_offset[c] + command.num_v};
+      parseStateCommand(&state, linebuf.c_str(),
+                        line_offset[c] + command.line_num, v_so_far, shapes,
+                        materials, readMatFn, triangulate, warn, err);
+    }
+    appendChunkFaces(&state, chunk, chunk.face_sizes.size(), &face, &corner);
+  }
+
+  size_t line_num = line_offset[num_chunks];
   if (greatest_v_idx >= static_cast<int>(v.size() / 3)) {
     if (warn) {
       std::stringstream ss;
@@ -2233,20 +3265,7 @@ bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
     }
   }
 
-  bool ret = exportGroupsToShape(&shape, faceGroup, lineGroup, tags, material,
-                                 name, triangulate, v);
-  // exportGroupsToShape return false when `usemtl` is called in the last
-  // line.
-  // we also add `shape` to `shapes` when `shape.mesh` has already some
-  // faces(indices)
-  if (ret || shape.mesh.indices.size()) {
-    shapes->push_back(shape);
-  }
-  faceGroup.clear();  // for safety
-
-  if (err) {
-    (*err) += errss.str();
-  }
+  finishShapes(&state, shapes, triangulate, v);
 
   attrib->vertices.swap(v);
   attrib->normals.swap(vn);
@@ -2256,6 +3275,47 @@ bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
   return true;
 }
 
+// Array of positions with the size() and [] used by triangulatePolygon
+struct position_array_t {
+  const real_t *data;
+  size_t count;
+  size_t size() const { return count; }
+  real_t operator[](size_t i) const { return data[i]; }
+};
+
+void TriangulateFace(const index_t *indices, int num_indices,
+                     const real_t *vertices, size_t num_vertices,
+                     std::vector<index_t> *triangles) {
+  if (num_indices < 3) return;
+  if (num_indices == 3) {
+    triangles->insert(triangles->end(), indices, indices + 3);
+    return;
+  }
+
+  // Reused between calls so that polygons don't allocate
+  thread_local std::vector<vertex_index_t> face, remainingFace;
+  face.clear();
+  for (int k = 0; k < num_indices; k++) {
+    face.push_back(vertex_index_t(indices[k].vertex_index,
+                                  indices[k].texcoord_index,
+                                  indices[k].normal_index));
+  }
+
+  position_array_t v = {vertices, num_vertices * 3};
+  triangulatePolygon(face.data(), face.size(), v, remainingFace,
+                     [&](const vertex_index_t &a, const vertex_index_t &b,
+                         const vertex_index_t &c) {
+    const vertex_index_t *corners[3] = {&a, &b, &c};
+    for (int k = 0; k < 3; k++) {
+      index_t idx;
+      idx.vertex_index = corners[k]->v_idx;
+      idx.normal_index = corners[k]->vn_idx;
+      idx.texcoord_index = corners[k]->vt_idx;
+      triangles->push_back(idx);
+    }
+  });
+}
+
 bool LoadObjWithCallback(std::istream &inStream, const callback_t &callback,
                          void *user_data /*= NULL*/,
                          MaterialReader *readMatFn /*= NULL*/,